@@ -0,0 +1,101 @@
+/* the scene and camera the gbuffer_*.vert and gbuffer_*.frag shaders
+ * rasterize, laid out like ray_tracing.glsl has them. positions are
+ * projected the way screenToWorldDirection casts the camera rays, so a texel
+ * sees what the camera ray of its pixel would */
+
+#define PI 3.1415926
+/* matches NO_SPHERE in ray_tracing.glsl */
+#define NO_SPHERE 0xFFFFFFFF
+
+struct MeshVertex {
+  vec3 position;
+  float u;
+  vec3 normal;
+  float v;
+};
+
+struct MeshInfo {
+  uint rootNode;
+  uint triangleCount;
+  uint materialIndex;
+  uint firstTriangle;
+};
+
+struct InstanceInfo {
+  /* rows of the 3x4 world to object transform */
+  vec4 worldToObject[3];
+  uint meshIndex;
+  uvec3 padding;
+};
+
+/* the start of UniformBufferObject, the rest is left out */
+layout(set = 0, binding = 0) uniform UniformBufferObject {
+  mat4 view;
+  mat4 projection;
+  vec4 viewportSize;
+  vec4 cameraPosition;
+}
+ubo;
+
+layout(std430, set = 0, binding = 1) readonly buffer Spheres {
+  vec4 spheres[];
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer SphereMaterialIndices {
+  uint sphereMaterials[];
+};
+
+layout(std430, set = 0, binding = 3) readonly buffer MeshVertices {
+  MeshVertex meshVertices[];
+};
+
+layout(std430, set = 0, binding = 4) readonly buffer MeshIndices {
+  uint meshIndices[];
+};
+
+layout(std430, set = 0, binding = 5) readonly buffer MeshInfos {
+  MeshInfo meshInfos[];
+};
+
+layout(std430, set = 0, binding = 6) readonly buffer Instances {
+  InstanceInfo instances[];
+};
+
+layout(push_constant) uniform GBufferPushConstants {
+  vec2 jitter;
+  vec2 targetSize;
+}
+pushConstants;
+
+/* the camera rays look down -z of the view and pixel p of the image gets
+ * the ray through 2 p / viewportSize - 1, see screenToWorldDirection. the
+ * raster samples at the centre of its texels, so the image is moved half a
+ * texel less the jitter. depth runs from 0 at the near plane toward 1 */
+vec4 worldToClip(vec3 position) {
+  vec3 eye = (ubo.view * vec4(position, 1.0)).xyz;
+  float near = -ubo.projection[3][2] / (ubo.projection[2][2] + 1.0);
+  vec2 ndc = vec2(ubo.projection[0][0], ubo.projection[1][1]) * eye.xy;
+  vec2 pixel = (ndc / -eye.z + 1.0) * 0.5 * ubo.viewportSize.xy;
+  vec2 raster = (pixel + 0.5 - pushConstants.jitter) * 2.0 /
+                    pushConstants.targetSize -
+                1.0;
+  return vec4(raster * -eye.z, -eye.z - near, -eye.z);
+}
+
+/* the inverse of worldToClip for the raster position of a fragment */
+vec3 fragmentDirection(vec2 fragCoord) {
+  vec2 pixel = fragCoord - 0.5 + pushConstants.jitter;
+  vec2 ndc = 2.0 * pixel / ubo.viewportSize.xy - 1.0;
+  vec3 eye = vec3(ndc / vec2(ubo.projection[0][0], ubo.projection[1][1]),
+                  -1.0);
+  return normalize((inverse(ubo.view) * vec4(eye, 0.0)).xyz);
+}
+
+/* matches directionToEquirectangular in ray_tracing.glsl */
+vec2 directionToEquirectangular(vec3 dir) {
+  float phi = atan(dir.z, dir.x);
+  if (phi < 0.0) {
+    phi += 2.0 * PI;
+  }
+  return vec2(phi / (2.0 * PI), acos(clamp(dir.y, -1.0, 1.0)) / PI);
+}
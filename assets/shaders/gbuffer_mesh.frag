@@ -0,0 +1,30 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "gbuffer_common.glsl"
+
+/* the hit of the camera ray on a mesh triangle, shaded like
+ * intersectInstances leaves it */
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec2 inUV;
+layout(location = 3) flat in vec3 inFaceNormal;
+layout(location = 4) flat in float inUVDensity;
+layout(location = 5) flat in uint inMaterial;
+
+layout(location = 0) out vec4 outPosition;
+layout(location = 1) out vec4 outNormal;
+layout(location = 2) out uvec4 outMaterial;
+
+void main() {
+  vec3 normal = dot(inNormal, inNormal) > 0.0 ? inNormal : inFaceNormal;
+  normal = normalize(normal);
+  if (dot(normal, inPosition - ubo.cameraPosition.xyz) > 0.0) {
+    normal = -normal;
+  }
+
+  outPosition = vec4(inPosition, inUVDensity);
+  outNormal = vec4(normal, 1.0);
+  outMaterial = uvec4(inMaterial, NO_SPHERE, floatBitsToUint(inUV));
+}
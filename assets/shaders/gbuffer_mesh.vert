@@ -0,0 +1,51 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "gbuffer_common.glsl"
+
+/* the triangles of the mesh of instance gl_InstanceIndex, gl_VertexIndex
+ * counts from the first index of the mesh in the shared index buffer */
+
+layout(location = 0) out vec3 outPosition;
+layout(location = 1) out vec3 outNormal;
+layout(location = 2) out vec2 outUV;
+layout(location = 3) flat out vec3 outFaceNormal;
+layout(location = 4) flat out float outUVDensity;
+layout(location = 5) flat out uint outMaterial;
+
+void main() {
+  InstanceInfo instance = instances[gl_InstanceIndex];
+  uint triangle = uint(gl_VertexIndex) / 3;
+  MeshVertex vertex = meshVertices[meshIndices[gl_VertexIndex]];
+  MeshVertex a = meshVertices[meshIndices[triangle * 3 + 0]];
+  MeshVertex b = meshVertices[meshIndices[triangle * 3 + 1]];
+  MeshVertex c = meshVertices[meshIndices[triangle * 3 + 2]];
+
+  mat4 worldToObject =
+      transpose(mat4(instance.worldToObject[0], instance.worldToObject[1],
+                     instance.worldToObject[2], vec4(0.0, 0.0, 0.0, 1.0)));
+  vec3 position = (inverse(worldToObject) * vec4(vertex.position, 1.0)).xyz;
+
+  /* normals go back to world space with the transposed inverse, like
+   * intersectInstances takes them */
+  mat3 normalToWorld = transpose(mat3(worldToObject));
+  vec3 area = cross(b.position - a.position, c.position - a.position);
+  vec3 worldArea = normalToWorld * area;
+  float worldDeterminant = determinant(mat3(worldToObject));
+
+  vec2 uvA = vec2(a.u, a.v);
+  vec2 uvEdgeB = vec2(b.u, b.v) - uvA;
+  vec2 uvEdgeC = vec2(c.u, c.v) - uvA;
+  float uvArea = abs(uvEdgeB.x * uvEdgeC.y - uvEdgeB.y * uvEdgeC.x);
+  float worldAreaLength = length(worldArea) / abs(worldDeterminant);
+
+  outPosition = position;
+  outNormal = normalToWorld * vertex.normal;
+  outUV = vec2(vertex.u, vertex.v);
+  outFaceNormal = worldArea;
+  outUVDensity = uvArea > 0.0 && worldAreaLength > 0.0
+                     ? 0.5 * log2(uvArea / worldAreaLength)
+                     : 0.0;
+  outMaterial = meshInfos[instance.meshIndex].materialIndex;
+  gl_Position = worldToClip(position);
+}
@@ -0,0 +1,41 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "gbuffer_common.glsl"
+
+/* the near hit of the camera ray on the sphere the quad was drawn for, like
+ * raySphere finds it */
+
+layout(location = 0) flat in uint inSphere;
+
+layout(location = 0) out vec4 outPosition;
+layout(location = 1) out vec4 outNormal;
+layout(location = 2) out uvec4 outMaterial;
+
+void main() {
+  vec4 sphere = spheres[inSphere];
+  vec3 origin = ubo.cameraPosition.xyz;
+  vec3 dir = fragmentDirection(gl_FragCoord.xy);
+
+  vec3 offsetOrigin = origin - sphere.xyz;
+  float b = dot(offsetOrigin, dir);
+  float c = dot(offsetOrigin, offsetOrigin) - sphere.w * sphere.w;
+  float discriminant = b * b - c;
+  if (discriminant < 0.0) {
+    discard;
+  }
+  float dst = -b - sqrt(discriminant);
+  if (dst < 0.0) {
+    discard;
+  }
+
+  vec3 position = origin + dir * dst;
+  vec3 normal = (position - sphere.xyz) / sphere.w;
+  vec4 clip = worldToClip(position);
+  gl_FragDepth = clip.z / clip.w;
+
+  outPosition = vec4(position, -0.5 * log2(4.0 * PI * sphere.w * sphere.w));
+  outNormal = vec4(normal, 1.0);
+  outMaterial = uvec4(sphereMaterials[inSphere], inSphere,
+                      floatBitsToUint(directionToEquirectangular(normal)));
+}
@@ -0,0 +1,39 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "gbuffer_common.glsl"
+
+/* a quad facing the camera that covers the outline of sphere
+ * gl_InstanceIndex, the fragment shader intersects the sphere itself */
+
+layout(location = 0) flat out uint outSphere;
+
+const vec2 corners[6] = vec2[](vec2(-1.0, -1.0), vec2(1.0, -1.0),
+                               vec2(1.0, 1.0), vec2(-1.0, -1.0),
+                               vec2(1.0, 1.0), vec2(-1.0, 1.0));
+
+void main() {
+  outSphere = gl_InstanceIndex;
+
+  vec4 sphere = spheres[gl_InstanceIndex];
+  vec3 toCentre = sphere.xyz - ubo.cameraPosition.xyz;
+  float dst2 = dot(toCentre, toCentre);
+  float radius2 = sphere.w * sphere.w;
+  /* the camera rays don't hit a sphere from the inside either */
+  if (dst2 <= radius2) {
+    gl_Position = vec4(0.0);
+    return;
+  }
+
+  /* the cone of rays touching the sphere crosses the plane through its
+   * centre in a circle this wide */
+  float extent = sphere.w * sqrt(dst2 / (dst2 - radius2));
+  vec3 forward = toCentre * inversesqrt(dst2);
+  vec3 up = abs(forward.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+  vec3 right = normalize(cross(up, forward));
+  up = cross(forward, right);
+
+  vec2 corner = corners[gl_VertexIndex];
+  gl_Position =
+      worldToClip(sphere.xyz + (right * corner.x + up * corner.y) * extent);
+}
@@ -0,0 +1,84 @@
+/* shared by the lbvh_*.comp passes, which all use the same descriptor set
+ * layout and push constants */
+
+#define LBVH_GROUP_SIZE 256
+#define LBVH_RADIX_BITS 4
+#define LBVH_RADIX_SIZE (1 << LBVH_RADIX_BITS)
+
+layout(local_size_x = LBVH_GROUP_SIZE) in;
+
+/* count == 0 - interior node with children at leftFirst and leftFirst + 1 */
+struct BVHNode {
+  vec3 boundsMin;
+  uint leftFirst;
+  vec3 boundsMax;
+  uint count;
+};
+
+layout(push_constant) uniform LBVHPushConstants {
+  uint count;
+  /* lowest bit of the radix digit being sorted */
+  uint shift;
+  /* halves of keys and values the radix passes read from and write to */
+  uint readOffset;
+  uint writeOffset;
+}
+pushConstants;
+
+/* xyz - position, w - radius */
+layout(std430, set = 0, binding = 0) readonly buffer Spheres {
+  vec4 spheres[];
+};
+
+/* the fit pass reads bounds other invocations have just written */
+layout(std430, set = 0, binding = 1) coherent buffer BVHNodes {
+  BVHNode nodes[];
+};
+
+/* two halves of count entries each, the sorted codes end up in the first */
+layout(std430, set = 0, binding = 2) buffer MortonKeys {
+  uint keys[];
+};
+
+/* the sphere index each key belongs to */
+layout(std430, set = 0, binding = 3) buffer MortonValues {
+  uint values[];
+};
+
+/* digit major counts of every workgroup, scanned into scatter offsets */
+layout(std430, set = 0, binding = 4) buffer RadixHistograms {
+  uint histograms[];
+};
+
+/* node slot to the slot of its parent */
+layout(std430, set = 0, binding = 5) buffer Parents {
+  uint parents[];
+};
+
+/* children of a node that have their bounds, cleared before every build */
+layout(std430, set = 0, binding = 6) buffer Flags {
+  uint flags[];
+};
+
+/* the centroid bounds minimum and reciprocal extent the Morton codes are
+ * quantized over, written by the host with calculateMortonQuantization */
+layout(std430, set = 0, binding = 7) readonly buffer BuildState {
+  vec3 mortonOrigin;
+  vec3 mortonInvExtent;
+};
+
+/* length of the common prefix of the sorted codes at i and j, ties are broken
+ * by the indices so every code is unique. -1 when j is out of range */
+int lbvhDelta(uint i, int j) {
+  if (j < 0 || j >= int(pushConstants.count)) {
+    return -1;
+  }
+
+  uint keyI = keys[i];
+  uint keyJ = keys[j];
+  if (keyI == keyJ) {
+    return 32 + 31 - findMSB(i ^ uint(j));
+  }
+
+  return 31 - findMSB(keyI ^ keyJ);
+}
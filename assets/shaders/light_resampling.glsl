@@ -0,0 +1,217 @@
+/* ReSTIR direct lighting at the first hits, after Bitterli et al. 2020,
+ * shared by the wavefront_*.comp kernels through wavefront_common.glsl.
+ * resample temporal streams light samples drawn the way next event
+ * estimation draws them through a reservoir per pixel, keeps the winner only
+ * if it is visible and merges the reservoir the pixel had before. resample
+ * spatial then merges the reservoirs of nearby pixels that saw a similar
+ * surface, and shade sends its single shadow ray toward whatever won. the
+ * samples of one pixel are worth reusing at another because the weights are
+ * kept in the measure the light was drawn in, solid angle for the
+ * environment and area for the spheres, neither of which depends on the
+ * shading point */
+
+#define RESERVOIR_CANDIDATE_COUNT 16
+/* the history may hold at most this many times the candidates of a frame,
+ * so it can't outweigh what the pixel sees now for ever */
+#define RESERVOIR_HISTORY_LIMIT 20
+#define RESERVOIR_SPATIAL_COUNT 5
+/* in pixels */
+#define RESERVOIR_SPATIAL_RADIUS 30.0
+/* how far a reused reservoir may be from the shading point, relative to
+ * the distance to the camera, and how close their normals must be */
+#define RESERVOIR_DEPTH_TOLERANCE 0.1
+#define RESERVOIR_NORMAL_TOLERANCE 0.9
+
+/* reservoirBias, see WavefrontReservoirBias in wavefront.h. the biased
+ * merge divides by every candidate seen, the unbiased one only by those of
+ * the reservoirs that could have drawn the winner themselves */
+#define RESERVOIR_BIASED 0
+#define RESERVOIR_UNBIASED 1
+
+struct Reservoir {
+  /* toward the environment, or from the centre of lightSphere to the point
+   * on it */
+  vec3 lightDir;
+  /* NO_SPHERE for the environment */
+  uint lightSphere;
+  /* the shading point that owns the reservoir, offset like the rays that
+   * leave it */
+  vec3 position;
+  /* the sum of the resampling weights while candidates stream in, the
+   * contribution weight of the sample once the reservoir is finished */
+  float weight;
+  /* zero where the camera ray missed */
+  vec3 normal;
+  /* the candidates behind the sample */
+  float sampleCount;
+};
+
+/* two images of pathCapacity reservoirs, resample temporal fills the first
+ * and resample spatial the second, which shade reads and the next sample
+ * takes as its history */
+layout(std430, set = 3, binding = 21) buffer Reservoirs {
+  Reservoir reservoirs[];
+};
+
+bool resamplesLights() { return pushConstants.reservoirResampling != 0; }
+
+uint reservoirOffset(uint image) { return image * pushConstants.pathCapacity; }
+
+/* a PCG state of its own, which leaves the dimensions of the path alone */
+uint reservoirSeed(PathState path, uint pass) {
+  return hashCombine(pcgSeed(path.pixel, path.sampleIndex), pass);
+}
+
+Reservoir emptyReservoir(vec3 position, vec3 normal) {
+  Reservoir reservoir;
+  reservoir.lightDir = vec3(0.0);
+  reservoir.lightSphere = NO_SPHERE;
+  reservoir.position = position;
+  reservoir.weight = 0.0;
+  reservoir.normal = normal;
+  reservoir.sampleCount = 0.0;
+  return reservoir;
+}
+
+/* what a light sample brings to a diffuse point before its albedo, in the
+ * measure the sample was drawn in, and the direction toward it */
+vec3 reservoirSampleLight(vec3 position, vec3 normal, uint lightSphere,
+                          vec3 lightDir, out vec3 dir) {
+  if (lightSphere == NO_SPHERE) {
+    dir = lightDir;
+    return getSampledEnvironmentLight(dir) * max(dot(normal, dir), 0.0);
+  }
+
+  vec4 sphere = spheres[lightSphere];
+  vec3 toPoint = sphere.xyz + lightDir * sphere.w - position;
+  float dst2 = dot(toPoint, toPoint);
+  dir = toPoint * inversesqrt(dst2);
+  float cosTheta = dot(normal, dir);
+  float cosLight = -dot(lightDir, dir);
+  if (cosTheta <= 0.0 || cosLight <= 0.0) {
+    return vec3(0.0);
+  }
+  RayTracingMaterial material = materials[sphereMaterials[lightSphere]];
+  return material.emissionColour.xyz * material.emissionColour.w * cosTheta *
+         cosLight / dst2;
+}
+
+/* the luminance of the light, shadows left out */
+float reservoirTargetPdf(vec3 position, vec3 normal, uint lightSphere,
+                         vec3 lightDir) {
+  vec3 dir;
+  vec3 light =
+      reservoirSampleLight(position, normal, lightSphere, lightDir, dir);
+  return dot(light, vec3(0.2126, 0.7152, 0.0722));
+}
+
+/* picks a light the way next event estimation does and returns the pdf of
+ * the sample in the measure of its light, 0 when it can't be used */
+float sampleLightCandidate(vec3 position, vec3 normal, inout uint rngState,
+                           out uint lightSphere, out vec3 lightDir) {
+  float environmentProbability = environmentLightProbability();
+  uint sphereCount = ubo.sceneCounts.y;
+  vec2 directionSample = vec2(randomValue(rngState), randomValue(rngState));
+  if (randomValue(rngState) < environmentProbability || sphereCount == 0) {
+    float pdf;
+    lightSphere = NO_SPHERE;
+    lightDir = sampleEnvironmentDirection(directionSample, pdf);
+    return environmentProbability * pdf;
+  }
+
+  uint light;
+  float pickPdf;
+  float pickSample = randomValue(rngState);
+  if (pushConstants.lightSelection == LIGHT_SELECTION_BVH) {
+    light = sampleLightBVH(position, normal, pickSample, pickPdf);
+  } else {
+    light = min(uint(pickSample * sphereCount), sphereCount - 1);
+    pickPdf = 1.0 / float(sphereCount);
+  }
+
+  lightSphere = emissiveSpheres[light];
+  vec4 sphere = spheres[lightSphere];
+  float directionPdf;
+  vec3 dir =
+      sampleSphereDirection(position, sphere, directionSample, directionPdf);
+  if (directionPdf <= 0.0) {
+    lightDir = vec3(0.0);
+    return 0.0;
+  }
+
+  /* the near side of the sphere, the only one the cone covers */
+  vec3 toCentre = sphere.xyz - position;
+  float b = dot(toCentre, dir);
+  float c = dot(toCentre, toCentre) - sphere.w * sphere.w;
+  float dst = b - sqrt(max(b * b - c, 0.0));
+  lightDir = (position + dir * dst - sphere.xyz) / sphere.w;
+
+  /* from solid angle to the area of the sphere */
+  float cosLight = max(-dot(lightDir, dir), 0.0);
+  return (1.0 - environmentProbability) * pickPdf * directionPdf * cosLight /
+         max(dst * dst, 1e-8);
+}
+
+/* streams a candidate in, weight being its resampling weight and
+ * sampleCount the candidates it stands for. true when it took the place of
+ * the sample held so far */
+bool updateReservoir(inout Reservoir reservoir, uint lightSphere,
+                     vec3 lightDir, float weight, float sampleCount,
+                     inout uint rngState) {
+  reservoir.weight += weight;
+  reservoir.sampleCount += sampleCount;
+  if (weight > 0.0 && randomValue(rngState) * reservoir.weight <= weight) {
+    reservoir.lightSphere = lightSphere;
+    reservoir.lightDir = lightDir;
+    return true;
+  }
+  return false;
+}
+
+/* what merging other into a reservoir at position weighs */
+float reservoirMergeWeight(Reservoir other, vec3 position, vec3 normal) {
+  return reservoirTargetPdf(position, normal, other.lightSphere,
+                            other.lightDir) *
+         other.weight * other.sampleCount;
+}
+
+/* turns the weight sum into the contribution weight of the sample,
+ * normalization being the candidates it is divided among */
+void finishReservoir(inout Reservoir reservoir, float normalization) {
+  float targetPdf =
+      reservoirTargetPdf(reservoir.position, reservoir.normal,
+                         reservoir.lightSphere, reservoir.lightDir);
+  reservoir.weight = targetPdf > 0.0 && normalization > 0.0
+                         ? reservoir.weight / (normalization * targetPdf)
+                         : 0.0;
+}
+
+/* whether the surface of other is close enough to reuse its samples */
+bool reservoirMatches(Reservoir other, vec3 position, vec3 normal) {
+  return dot(other.normal, normal) >= RESERVOIR_NORMAL_TOLERANCE &&
+         distance(other.position, position) <=
+             RESERVOIR_DEPTH_TOLERANCE *
+                 distance(position, ubo.cameraPosition.xyz);
+}
+
+/* traced like connect traces shadow rays */
+bool reservoirSampleVisible(vec3 position, uint lightSphere, vec3 lightDir) {
+  Ray ray;
+  ray.origin = position;
+  reservoirSampleLight(position, vec3(0.0), lightSphere, lightDir, ray.dir);
+  HitInfo hitInfo = calculateRayCollision(ray);
+  return lightSphere == NO_SPHERE ? !hitInfo.didHit
+                                  : hitInfo.sphereIndex == lightSphere;
+}
+
+/* the candidates other adds to the unbiased normalization of the sample
+ * held by reservoir, those of a reservoir that couldn't have drawn it don't
+ * count */
+float reservoirNormalization(Reservoir reservoir, Reservoir other) {
+  bool couldDraw =
+      reservoirTargetPdf(other.position, other.normal, reservoir.lightSphere,
+                         reservoir.lightDir) > 0.0 &&
+      reservoirSampleVisible(other.position, reservoir.lightSphere,
+                             reservoir.lightDir);
+  return couldDraw ? other.sampleCount : 0.0;
+}
@@ -0,0 +1,208 @@
+/* online path guiding shared by the wavefront_*.comp kernels through
+ * wavefront_common.glsl, after Müller et al. 2017. a binary tree halves the
+ * scene bounds into leaves and every leaf keeps a quadtree over the
+ * cylindrical mapping of the sphere of directions, which learns where its
+ * incident radiance comes from. shade draws diffuse bounces from a mix of the
+ * quadtree and the cosine lobe, guide record splats what the first diffuse
+ * vertices of every path saw into the training trees and the host refines
+ * the trees from them between iterations, see path_guiding.h */
+
+/* match guide_* in path_guiding.h */
+#define GUIDE_MAX_SPATIAL_NODES (1 << 16)
+#define GUIDE_MAX_DIRECTION_NODES (1 << 18)
+#define GUIDE_VERTEX_COUNT 4
+#define GUIDE_LEAF_AXIS 3
+#define GUIDE_MAX_DEPTH 20
+#define NO_GUIDE_NODE 0xFFFFFFFF
+/* chance a guided diffuse bounce is drawn from the quadtree */
+#define GUIDE_FRACTION 0.5
+/* the training energies count in steps of 1/1024 in 64 bits, a single splat
+ * is clamped so fireflies don't take over a quadtree */
+#define GUIDE_ENERGY_SCALE 1024.0
+#define GUIDE_MAX_ENERGY 65536.0
+
+/* guiding, bits of WavefrontPushConstants::guiding */
+#define GUIDING_SAMPLE 1
+#define GUIDING_TRAIN 2
+
+struct GuideSpatialNode {
+  uint child;
+  uint axis;
+};
+
+struct GuideDirectionNode {
+  uint children[4];
+  float energy[4];
+};
+
+/* a diffuse vertex of the path in flight, snapshot being the luminance its
+ * pixel had gathered before the light found past the vertex */
+struct GuideVertex {
+  uint leaf;
+  /* of the bounce direction, for the diffuse lobe alone */
+  float pdf;
+  vec2 coords;
+  /* luminance of the path throughput after the bounce */
+  float throughput;
+  float snapshot;
+  uvec2 padding;
+};
+
+layout(std430, set = 3, binding = 17) readonly buffer GuideSpatialTree {
+  /* a cube, so the halving splits keep the cells close to cubes */
+  vec4 guideBoundsMin;
+  vec4 guideBoundsMax;
+  GuideSpatialNode guideSpatialNodes[GUIDE_MAX_SPATIAL_NODES];
+};
+
+layout(std430, set = 3, binding = 18) readonly buffer GuideDirectionTree {
+  GuideDirectionNode guideDirectionNodes[GUIDE_MAX_DIRECTION_NODES];
+};
+
+/* indexed like the sampled trees, the host reads it back once an iteration
+ * is over */
+layout(std430, set = 3, binding = 19) buffer GuideTraining {
+  uint guideSampleCounts[GUIDE_MAX_SPATIAL_NODES];
+  uint guideEnergies[GUIDE_MAX_DIRECTION_NODES * 4 * 2];
+};
+
+/* GUIDE_VERTEX_COUNT per pixel */
+layout(std430, set = 3, binding = 20) buffer GuideVertices {
+  GuideVertex guideVertices[];
+};
+
+bool guideSamples() { return (pushConstants.guiding & GUIDING_SAMPLE) != 0; }
+bool guideTrains() { return (pushConstants.guiding & GUIDING_TRAIN) != 0; }
+
+uint guideLeaf(vec3 position) {
+  vec3 size = guideBoundsMax.xyz - guideBoundsMin.xyz;
+  vec3 point = clamp((position - guideBoundsMin.xyz) / max(size, vec3(1e-6)),
+                     0.0, 1.0);
+  uint node = 0;
+  while (guideSpatialNodes[node].axis != GUIDE_LEAF_AXIS) {
+    uint axis = guideSpatialNodes[node].axis;
+    point[axis] *= 2.0;
+    uint side = min(uint(point[axis]), 1u);
+    point[axis] -= float(side);
+    node = guideSpatialNodes[node].child + side;
+  }
+  return node;
+}
+
+/* equal areas of the square map to equal solid angles */
+vec2 directionToGuide(vec3 dir) {
+  float phi = atan(dir.y, dir.x);
+  if (phi < 0.0) {
+    phi += 2.0 * PI;
+  }
+  return vec2((clamp(dir.z, -1.0, 1.0) + 1.0) * 0.5, phi / (2.0 * PI));
+}
+
+vec3 guideToDirection(vec2 coords) {
+  float cosTheta = 2.0 * coords.x - 1.0;
+  float sinTheta = sqrt(max(1.0 - cosTheta * cosTheta, 0.0));
+  float phi = 2.0 * PI * coords.y;
+  return vec3(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);
+}
+
+/* a quadtree that hasn't learned anything yet can't be sampled */
+bool guideTrained(uint root) {
+  GuideDirectionNode node = guideDirectionNodes[root];
+  return node.energy[0] + node.energy[1] + node.energy[2] + node.energy[3] >
+         0.0;
+}
+
+/* picks a column and then a quadrant in it in proportion to their energy,
+ * reusing what is left of u at every level */
+vec3 sampleGuide(uint root, vec2 u, out float pdf) {
+  uint node = root;
+  vec2 origin = vec2(0.0);
+  float size = 1.0;
+  float squarePdf = 1.0;
+  for (uint depth = 0; depth <= GUIDE_MAX_DEPTH; depth++) {
+    float energy[4] = guideDirectionNodes[node].energy;
+    float total = energy[0] + energy[1] + energy[2] + energy[3];
+
+    float left = (energy[0] + energy[2]) / total;
+    uint x = 0;
+    if (u.x < left) {
+      u.x /= left;
+    } else {
+      x = 1;
+      u.x = (u.x - left) / (1.0 - left);
+    }
+    float bottom = energy[x] / (energy[x] + energy[x + 2]);
+    uint y = 0;
+    if (u.y < bottom) {
+      u.y /= bottom;
+    } else {
+      y = 1;
+      u.y = (u.y - bottom) / (1.0 - bottom);
+    }
+
+    uint quadrant = x + 2 * y;
+    squarePdf *= 4.0 * energy[quadrant] / total;
+    size *= 0.5;
+    origin += vec2(x, y) * size;
+    uint child = guideDirectionNodes[node].children[quadrant];
+    if (child == 0) {
+      break;
+    }
+    node = child;
+  }
+
+  pdf = squarePdf / (4.0 * PI);
+  return guideToDirection(origin + min(u, vec2(0.99999)) * size);
+}
+
+float guidePdf(uint root, vec3 dir) {
+  vec2 coords = directionToGuide(dir);
+  uint node = root;
+  float squarePdf = 1.0;
+  for (uint depth = 0; depth <= GUIDE_MAX_DEPTH; depth++) {
+    float energy[4] = guideDirectionNodes[node].energy;
+    uvec2 side = uvec2(greaterThanEqual(coords, vec2(0.5)));
+    uint quadrant = side.x + 2 * side.y;
+    squarePdf *= 4.0 * energy[quadrant] /
+                 (energy[0] + energy[1] + energy[2] + energy[3]);
+    coords = coords * 2.0 - vec2(side);
+    uint child = guideDirectionNodes[node].children[quadrant];
+    if (child == 0) {
+      break;
+    }
+    node = child;
+  }
+  return squarePdf / (4.0 * PI);
+}
+
+void addGuideEnergy(uint node, uint quadrant, uint value) {
+  /* carry into the high word when the low one wraps around */
+  uint index = (node * 4 + quadrant) * 2;
+  uint low = atomicAdd(guideEnergies[index], value);
+  if (low + value < low) {
+    atomicAdd(guideEnergies[index + 1], 1);
+  }
+}
+
+/* adds energy to the quadrant the coords fall in at every level of the
+ * quadtree of leaf, so every quadrant sums up its children */
+void splatGuide(uint leaf, vec2 coords, float energy) {
+  atomicAdd(guideSampleCounts[leaf], 1);
+  uint value = uint(min(energy, GUIDE_MAX_ENERGY) * GUIDE_ENERGY_SCALE);
+  if (value == 0) {
+    return;
+  }
+
+  uint node = guideSpatialNodes[leaf].child;
+  for (uint depth = 0; depth <= GUIDE_MAX_DEPTH; depth++) {
+    uvec2 side = uvec2(greaterThanEqual(coords, vec2(0.5)));
+    uint quadrant = side.x + 2 * side.y;
+    addGuideEnergy(node, quadrant, value);
+    coords = coords * 2.0 - vec2(side);
+    uint child = guideDirectionNodes[node].children[quadrant];
+    if (child == 0) {
+      break;
+    }
+    node = child;
+  }
+}
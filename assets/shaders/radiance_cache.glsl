@@ -0,0 +1,133 @@
+/* world-space radiance cache shared by the wavefront_*.comp kernels through
+ * wavefront_common.glsl. a hash grid of cells keyed by position, level of
+ * detail and normal direction, each keeping the diffuse radiance leaving its
+ * surfaces. every diffuse vertex of a path adds one estimate to its cell: the
+ * light its shadow ray finds plus, once the next vertex is known, what comes
+ * back from there. paths past their first diffuse vertex stop at cells with
+ * enough samples, which feeds cached light back into the estimates and lets
+ * it spread over several bounces across frames */
+
+#define CACHE_ENTRY_COUNT (1 << 20)
+#define CACHE_PROBE_COUNT 8
+#define NO_CACHE_CELL 0xFFFFFFFF
+/* cell size at a distance of 1 from the camera, doubling with every
+ * doubling of the distance */
+#define CACHE_CELL_SIZE 0.04
+/* the frame sums count in steps of 1/1024, a single estimate is clamped so
+ * a cell takes thousands of them before overflowing */
+#define CACHE_SUM_SCALE 1024.0
+#define CACHE_MAX_ESTIMATE 256.0
+/* samples before a cell ends paths and how many the running average keeps */
+#define CACHE_MIN_SAMPLES 16.0
+#define CACHE_MAX_SAMPLES 256.0
+/* frames a cell survives without being touched */
+#define CACHE_MAX_AGE 64
+
+/* radianceCache, bits of WavefrontPushConstants::radiance_cache */
+#define RADIANCE_CACHE_ENABLED 1
+
+struct RadianceCacheEntry {
+  /* 0 for a free entry */
+  uint checksum;
+  uint lastFrame;
+  /* estimates added this frame and their sum */
+  uint sampleCount;
+  uint padding;
+  uvec3 radianceSum;
+  uint sumPadding;
+  /* running average over the last frames */
+  vec3 radiance;
+  float weight;
+};
+
+layout(std430, set = 3, binding = 16) buffer RadianceCache {
+  RadianceCacheEntry cacheEntries[CACHE_ENTRY_COUNT];
+};
+
+bool radianceCacheEnabled() {
+  return (pushConstants.radianceCache & RADIANCE_CACHE_ENABLED) != 0;
+}
+
+/* the hash picks the first entry to probe and the checksum tells cells that
+ * land on the same entry apart */
+void cacheCellKey(vec3 position, vec3 normal, out uint hash,
+                  out uint checksum) {
+  float level = floor(log2(max(distance(position, ubo.cameraPosition.xyz),
+                               1.0)));
+  ivec3 cell = ivec3(floor(position / (CACHE_CELL_SIZE * exp2(level))));
+
+  /* the axis the normal leans along most and its sign */
+  vec3 absNormal = abs(normal);
+  uint axis = absNormal.x > absNormal.y
+                  ? (absNormal.x > absNormal.z ? 0 : 2)
+                  : (absNormal.y > absNormal.z ? 1 : 2);
+  uint direction = axis * 2 + uint(normal[axis] < 0.0);
+
+  uint key = hashCombine(hashUint(uint(level) << 3 | direction), uint(cell.x));
+  key = hashCombine(key, uint(cell.y));
+  hash = hashCombine(key, uint(cell.z));
+  checksum = max(hashCombine(hash, 0x2545f491u), 1u);
+}
+
+uint findCacheCell(vec3 position, vec3 normal) {
+  uint hash;
+  uint checksum;
+  cacheCellKey(position, normal, hash, checksum);
+  for (uint i = 0; i < CACHE_PROBE_COUNT; i++) {
+    uint entry = (hash + i) % CACHE_ENTRY_COUNT;
+    uint entryChecksum = cacheEntries[entry].checksum;
+    if (entryChecksum == checksum) {
+      return entry;
+    }
+    if (entryChecksum == 0) {
+      break;
+    }
+  }
+  return NO_CACHE_CELL;
+}
+
+/* NO_CACHE_CELL once every probed entry belongs to another cell */
+uint insertCacheCell(vec3 position, vec3 normal) {
+  uint hash;
+  uint checksum;
+  cacheCellKey(position, normal, hash, checksum);
+  for (uint i = 0; i < CACHE_PROBE_COUNT; i++) {
+    uint entry = (hash + i) % CACHE_ENTRY_COUNT;
+    uint previous = atomicCompSwap(cacheEntries[entry].checksum, 0, checksum);
+    if (previous == 0 || previous == checksum) {
+      atomicMax(cacheEntries[entry].lastFrame, ubo.frame.y);
+      return entry;
+    }
+  }
+  return NO_CACHE_CELL;
+}
+
+void addCacheEstimate(uint cell, vec3 estimate) {
+  if (cell == NO_CACHE_CELL) {
+    return;
+  }
+  uvec3 value = uvec3(min(estimate, vec3(CACHE_MAX_ESTIMATE)) *
+                      CACHE_SUM_SCALE);
+  if (value.x > 0) {
+    atomicAdd(cacheEntries[cell].radianceSum.x, value.x);
+  }
+  if (value.y > 0) {
+    atomicAdd(cacheEntries[cell].radianceSum.y, value.y);
+  }
+  if (value.z > 0) {
+    atomicAdd(cacheEntries[cell].radianceSum.z, value.z);
+  }
+}
+
+/* the cached radiance of the cell at a hit, false while it has too few
+ * samples to stand in for the rest of the path */
+bool lookupCache(vec3 position, vec3 normal, out vec3 radiance) {
+  uint cell = findCacheCell(position, normal);
+  if (cell == NO_CACHE_CELL ||
+      cacheEntries[cell].weight < CACHE_MIN_SAMPLES) {
+    return false;
+  }
+  atomicMax(cacheEntries[cell].lastFrame, ubo.frame.y);
+  radiance = cacheEntries[cell].radiance;
+  return true;
+}
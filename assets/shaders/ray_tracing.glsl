@@ -0,0 +1,1307 @@
+/* scene data and ray queries shared by the wavefront_*.comp kernels, which
+ * include it through wavefront_common.glsl */
+
+#extension GL_EXT_nonuniform_qualifier : require
+
+#define PI 3.1415926
+#define FLT_MAX 3.402823466e+38
+/* matches bvh_stack_size in bvh.h, the host rejects trees that would
+ * overflow it */
+#define BVH_STACK_SIZE 64
+#define RAY_EPSILON 1e-4
+/* HitInfo.sphereIndex of hits on meshes and misses */
+#define NO_SPHERE 0xFFFFFFFF
+/* matches max_material_textures in main.cpp */
+#define MAX_MATERIAL_TEXTURES 64
+/* how much wider a bounce leaves the ray cone of a path, in radians, where
+ * the lobe is fully rough. the curvature of the surface is left out */
+#define RAY_CONE_ROUGH_SPREAD 0.5
+
+/* renderSettings.z, how the spheres are traversed */
+#define TRAVERSAL_BRUTE_FORCE 0
+#define TRAVERSAL_BVH 1
+#define TRAVERSAL_COMPRESSED_BVH 2
+
+/* 4 bit child codes of CompressedBVHNode, leaves store their primitive count
+ * - 1 */
+#define COMPRESSED_BVH_WIDTH 4
+#define COMPRESSED_BVH_CHILD_INTERNAL 0x8
+#define COMPRESSED_BVH_CHILD_EMPTY 0xF
+
+/* slots of RayStats, each counter is a low and a high word */
+#define STAT_RAYS 0
+#define STAT_BYTES_READ 1
+#define STAT_LEGACY_BYTES_READ 2
+#define STAT_EXTEND_GROUPS 3
+#define STAT_UNIQUE_SPHERES 4
+#define STAT_SHADE_GROUPS 5
+#define STAT_UNIQUE_MATERIALS 6
+#define STAT_LIGHT_PICKS 7
+#define STAT_LIGHT_NODES 8
+#define STAT_LIGHT_CONTRIBUTION 9
+#define STAT_LIGHT_CONTRIBUTION_SQUARED 10
+#define STAT_ACTIVE_PIXELS 11
+#define STAT_SQUARED_ERROR 12
+#define STAT_PATH_SEGMENTS 13
+#define STAT_CACHE_TERMINATIONS 14
+#define STAT_CACHE_ENTRIES 15
+
+/* sizes used by the bytes read counters, the legacy layout inlined the
+ * material into every sphere */
+#define SPHERE_SIZE 16
+#define LEGACY_SPHERE_SIZE 64
+#define MATERIAL_SIZE 64
+#define BVH_NODE_SIZE 32
+#define COMPRESSED_BVH_NODE_SIZE 48
+#define TRIANGLE_SIZE 108
+#define MESH_INFO_SIZE 16
+#define LEGACY_MESH_INFO_SIZE 64
+#define INSTANCE_SIZE 64
+
+struct Ray {
+  vec3 origin;
+  vec3 dir;
+};
+
+struct RayTracingMaterial {
+  /* a - smoothness */
+  vec4 colour;
+  /* a - emissionStrength */
+  vec4 emissionColour;
+  /* a - specularProbability */
+  vec4 specularColour;
+  /* indices into materialTextures plus one, 0 for none */
+  uint albedoTexture;
+  uint roughnessTexture;
+  uvec2 padding;
+};
+
+struct HitInfo {
+  bool didHit;
+  float dst;
+  vec3 hitPoint;
+  vec3 normal;
+  uint materialIndex;
+  uint sphereIndex;
+  vec2 uv;
+  /* half the log2 of the texture space area per world space area around the
+   * hit, see rayConeLod */
+  float uvDensity;
+};
+
+/* count == 0 - interior node with children at leftFirst and leftFirst + 1 */
+struct BVHNode {
+  vec3 boundsMin;
+  uint leftFirst;
+  vec3 boundsMax;
+  uint count;
+};
+
+/* 4 wide node, child c spans origin + q * 2^exponent with q taken from byte c
+ * of quantizedMin and quantizedMax. internal children follow each other from
+ * the low 24 bits of childBaseCodes and the primitives of leaf children from
+ * primitiveBase, empty children come last */
+struct CompressedBVHNode {
+  vec3 origin;
+  /* biased exponents of x, y and z, the codes of children 0 and 1 on top */
+  uint exponentsCodes;
+  /* codes of children 2 and 3 on top */
+  uint childBaseCodes;
+  uint primitiveBase;
+  uint quantizedMin[3];
+  uint quantizedMax[3];
+};
+
+/* count == 1 - leaf whose light is emissiveSpheres[leftFirst], interior nodes
+ * as in BVHNode. flux is the power of the lights below */
+struct LightBVHNode {
+  vec3 boundsMin;
+  uint leftFirst;
+  vec3 boundsMax;
+  uint count;
+  float flux;
+  uint parent;
+  uvec2 padding;
+};
+
+struct MeshVertex {
+  vec3 position;
+  float u;
+  vec3 normal;
+  float v;
+};
+
+struct MeshInfo {
+  uint rootNode;
+  uint triangleCount;
+  uint materialIndex;
+  uint firstTriangle;
+};
+
+struct InstanceInfo {
+  /* rows of the 3x4 world to object transform */
+  vec4 worldToObject[3];
+  uint meshIndex;
+  uvec3 padding;
+};
+
+/* per-ray constants of the watertight ray-triangle test */
+struct WatertightRay {
+  ivec3 k;
+  vec3 shear;
+};
+
+layout(set = 0, binding = 0, rgba8) uniform image2D resultImage;
+
+layout(set = 1, binding = 0) uniform UniformBufferObject {
+  mat4 view;
+  mat4 projection;
+  vec4 viewportSize;
+  vec4 cameraPosition;
+  vec4 renderSettings;
+  uvec4 frame;
+  vec4 groundColour;
+  vec4 skyColourHorizon;
+  vec4 skyColourZenith;
+  vec4 sunPosition;
+  float sunFocus;
+  float sunInternsity;
+  float defocusStrength;
+  float divergeStrength;
+  /* x - instance count, y - emissive sphere count, z, w - size of the
+   * environment map, 0 without one */
+  uvec4 sceneCounts;
+  /* x - relative noise threshold, 0 samples every pixel, y - frames before a
+   * pixel may converge */
+  vec4 adaptiveSettings;
+  /* the camera of the last frame, which the history gets reprojected from */
+  mat4 previousView;
+  mat4 previousProjection;
+  vec4 previousCameraPosition;
+  /* x - 1 when the camera moved since the last frame and the history gets
+   * reprojected, y - samples a pixel keeps at most */
+  vec4 reprojectionSettings;
+  /* bounds of the spheres and instances, the direction sort key quantizes
+   * ray origins over them */
+  vec4 sceneBoundsMin;
+  vec4 sceneBoundsMax;
+}
+ubo;
+
+/* xyz - position, w - radius */
+layout(std430, set = 2, binding = 0) readonly buffer Spheres {
+  vec4 spheres[];
+};
+
+layout(std430, set = 2, binding = 1) readonly buffer BVHNodes {
+  BVHNode nodes[];
+};
+
+layout(std430, set = 2, binding = 2) readonly buffer MeshVertices {
+  MeshVertex meshVertices[];
+};
+
+layout(std430, set = 2, binding = 3) readonly buffer MeshIndices {
+  uint meshIndices[];
+};
+
+layout(std430, set = 2, binding = 4) readonly buffer MeshBVHNodes {
+  BVHNode meshNodes[];
+};
+
+layout(std430, set = 2, binding = 5) readonly buffer MeshInfos {
+  MeshInfo meshInfos[];
+};
+
+layout(std430, set = 2, binding = 6) readonly buffer Instances {
+  InstanceInfo instances[];
+};
+
+layout(std430, set = 2, binding = 7) readonly buffer InstanceBVHNodes {
+  BVHNode instanceNodes[];
+};
+
+layout(std430, set = 2, binding = 8) readonly buffer SphereMaterialIndices {
+  uint sphereMaterials[];
+};
+
+layout(std430, set = 2, binding = 9) readonly buffer Materials {
+  RayTracingMaterial materials[];
+};
+
+layout(std430, set = 2, binding = 10) buffer RayStats {
+  uint stats[];
+};
+
+layout(std430, set = 2, binding = 11) readonly buffer CompressedBVHNodes {
+  CompressedBVHNode compressedNodes[];
+};
+
+/* indices of the spheres with an emissive material, the lights next event
+ * estimation picks from along with the sun */
+layout(std430, set = 2, binding = 12) readonly buffer EmissiveSpheres {
+  uint emissiveSpheres[];
+};
+
+layout(std430, set = 2, binding = 13) readonly buffer LightBVHNodes {
+  LightBVHNode lightNodes[];
+};
+
+/* one per sphere, the light BVH leaf of the emissive ones */
+layout(std430, set = 2, binding = 14) readonly buffer SphereLightLeaves {
+  uint sphereLightLeaves[];
+};
+
+/* sceneCounts.z by sceneCounts.w texels of the environment map, see
+ * environment_map.h. xyz - radiance, w - pdf over the unit square */
+layout(std430, set = 2, binding = 15) readonly buffer EnvironmentTexels {
+  vec4 environmentTexels[];
+};
+
+/* the marginal CDF over the rows, then the conditional CDF of every row */
+layout(std430, set = 2, binding = 16) readonly buffer EnvironmentCDF {
+  float environmentCdf[];
+};
+
+/* the images the materials refer to, with mip chains. the slots past the
+ * ones the scene uses hold a white placeholder */
+layout(set = 4, binding = 0) uniform sampler2D
+    materialTextures[MAX_MATERIAL_TEXTURES];
+
+/* accumulated per invocation and flushed once, so the atomics stay off the
+ * traversal loops */
+uint rayCount = 0;
+uint bytesRead = 0;
+uint legacyBytesRead = 0;
+uint lightNodeVisits = 0;
+
+/* one bit per sphere index hashed into SPHERE_FETCH_BITS, lets the extend
+ * kernel count the distinct spheres its workgroup fetched when it sets
+ * trackSphereFetches */
+#define SPHERE_FETCH_BITS 4096
+shared uint sphereFetchMask[SPHERE_FETCH_BITS / 32];
+bool trackSphereFetches = false;
+
+uint nextRandom(inout uint state);
+float randomValue(inout uint state);
+float randomValueNormalDistribution(inout uint state);
+vec3 randomDirection(inout uint state);
+vec2 randomPointInCircle(inout uint rngState);
+vec3 randomHemisphereDirection(vec3 normal, inout uint rngState);
+vec2 pointInCircle(vec2 u);
+vec3 directionAroundAxis(vec3 axis, float cosTheta, float phi);
+vec3 cosineHemisphereDirection(vec3 normal, vec2 u);
+
+HitInfo raySphere(Ray ray, vec3 sphereCentre, float sphereRadius);
+float rayAABB(Ray ray, vec3 invDir, vec3 boundsMin, vec3 boundsMax,
+              float maxDst);
+WatertightRay watertightRay(Ray ray);
+bool rayTriangle(Ray ray, WatertightRay wray, vec3 a, vec3 b, vec3 c,
+                 float maxDst, out float dst, out vec3 barycentrics);
+bool intersectMesh(Ray ray, vec3 invDir, WatertightRay wray, uint meshIndex,
+                   inout float closestDst, inout uint closestTriangle,
+                   inout vec3 closestBarycentrics);
+void intersectInstances(Ray ray, inout HitInfo closestHit);
+HitInfo calculateRayCollisionBruteForce(Ray ray);
+HitInfo calculateRayCollisionBVH(Ray ray);
+HitInfo calculateRayCollisionCompressedBVH(Ray ray);
+HitInfo calculateRayCollision(Ray ray);
+vec3 screenToWorldDirection(vec2 point);
+bool worldToScreen(vec4 position, mat4 view, mat4 projection, out vec2 point);
+vec2 directionToEquirectangular(vec3 dir);
+float pixelSpreadAngle();
+float rayConeLod(float coneWidth, float uvDensity, vec3 normal, vec3 dir);
+vec4 sampleMaterialTexture(uint slot, vec2 uv, float lod);
+RayTracingMaterial getTexturedMaterial(uint materialIndex, vec2 uv,
+                                       float lod);
+bool hasEnvironmentMap();
+vec3 getSkyLight(Ray ray);
+float getSunLight(vec3 dir);
+vec3 getEnvironmentMapLight(vec3 dir);
+vec3 getSampledEnvironmentLight(vec3 dir);
+vec3 getEnvironmentLight(Ray ray);
+float environmentLightProbability();
+vec3 sampleSunDirection(vec2 u, out float pdf);
+float sunDirectionPdf(vec3 dir);
+vec3 sampleEnvironmentMapDirection(vec2 u, out float pdf);
+float environmentMapDirectionPdf(vec3 dir);
+vec3 sampleEnvironmentDirection(vec2 u, out float pdf);
+float environmentDirectionPdf(vec3 dir);
+vec3 sampleSphereDirection(vec3 origin, vec4 sphere, vec2 u, out float pdf);
+float sphereDirectionPdf(vec3 origin, vec4 sphere);
+float lightNodeImportance(uint node, vec3 point, vec3 normal);
+float lightChildProbability(uint left, vec3 point, vec3 normal);
+uint sampleLightBVH(vec3 point, vec3 normal, float u, out float pdf);
+float lightBVHPdf(uint sphere, vec3 point, vec3 normal);
+float linearToGamma(float linearComponent);
+void countBytesRead(uint bytes, uint legacyBytes);
+void countSphereFetch(uint sphere);
+void addStat(uint stat, uint value);
+void addStatWide(uint stat, uint high, uint low);
+
+uint nextRandom(inout uint state) {
+  state = state * 747796405 + 2891336453;
+  uint result = ((state >> ((state >> 28) + 4)) ^ state) * 277803737;
+  result = (result >> 22) ^ result;
+  return result;
+}
+
+float randomValue(inout uint state) { return nextRandom(state) / 4294967295.0; }
+
+float randomValueNormalDistribution(inout uint state) {
+  float theta = 2 * 3.1415926 * randomValue(state);
+  float rho = sqrt(-2 * log(randomValue(state)));
+  return rho * cos(theta);
+}
+
+vec3 randomDirection(inout uint state) {
+  float x = randomValueNormalDistribution(state);
+  float y = randomValueNormalDistribution(state);
+  float z = randomValueNormalDistribution(state);
+  return normalize(vec3(x, y, z));
+}
+
+vec2 randomPointInCircle(inout uint rngState) {
+  float angle = randomValue(rngState) * 2 * PI;
+  vec2 pointOnCircle = vec2(cos(angle), sin(angle));
+  return pointOnCircle * sqrt(randomValue(rngState));
+}
+
+/* the same mapping from a 2D sample */
+vec2 pointInCircle(vec2 u) {
+  float angle = u.x * 2 * PI;
+  return vec2(cos(angle), sin(angle)) * sqrt(u.y);
+}
+
+vec3 randomHemisphereDirection(vec3 normal, inout uint rngState) {
+  vec3 dir = randomDirection(rngState);
+  return dir * sign(dot(normal, dir));
+}
+
+/* Duff et al. 2017 orthonormal basis around a unit axis */
+vec3 directionAroundAxis(vec3 axis, float cosTheta, float phi) {
+  float s = axis.z >= 0.0 ? 1.0 : -1.0;
+  float a = -1.0 / (s + axis.z);
+  float b = axis.x * axis.y * a;
+  vec3 tangent = vec3(1.0 + s * axis.x * axis.x * a, s * b, -s * axis.x);
+  vec3 bitangent = vec3(b, s + axis.y * axis.y * a, -axis.y);
+
+  float sinTheta = sqrt(max(1.0 - cosTheta * cosTheta, 0.0));
+  return normalize(tangent * (sinTheta * cos(phi)) +
+                   bitangent * (sinTheta * sin(phi)) + axis * cosTheta);
+}
+
+/* pdf cosTheta / PI, the same distribution as offsetting the normal by a
+ * random unit vector but from a single 2D sample */
+vec3 cosineHemisphereDirection(vec3 normal, vec2 u) {
+  return directionAroundAxis(normal, sqrt(u.x), 2 * PI * u.y);
+}
+
+HitInfo raySphere(Ray ray, vec3 sphereCentre, float sphereRadius) {
+  HitInfo hitInfo;
+  hitInfo.didHit = false;
+  hitInfo.dst = 0;
+  hitInfo.hitPoint = vec3(0.0);
+  hitInfo.normal = vec3(0.0);
+  hitInfo.materialIndex = 0;
+  hitInfo.sphereIndex = NO_SPHERE;
+  hitInfo.uv = vec2(0.0);
+  hitInfo.uvDensity = 0.0;
+
+  vec3 offsetRayOrigin = ray.origin - sphereCentre;
+  float a = dot(ray.dir, ray.dir);
+  float b = 2 * dot(offsetRayOrigin, ray.dir);
+  float c = dot(offsetRayOrigin, offsetRayOrigin) - sphereRadius * sphereRadius;
+  float discrimintant = b * b - 4 * a * c;
+
+  if (discrimintant >= 0) {
+    float dst = (-b - sqrt(discrimintant)) / (2 * a);
+
+    if (dst >= 0) {
+      hitInfo.didHit = true;
+      hitInfo.dst = dst;
+      hitInfo.hitPoint = ray.origin + ray.dir * dst;
+      hitInfo.normal = normalize(hitInfo.hitPoint - sphereCentre);
+    }
+  }
+
+  return hitInfo;
+}
+
+float rayAABB(Ray ray, vec3 invDir, vec3 boundsMin, vec3 boundsMax,
+              float maxDst) {
+  vec3 t0 = (boundsMin - ray.origin) * invDir;
+  vec3 t1 = (boundsMax - ray.origin) * invDir;
+  vec3 tMin = min(t0, t1);
+  vec3 tMax = max(t0, t1);
+  float dstNear = max(max(tMin.x, tMin.y), max(tMin.z, 0.0));
+  float dstFar = min(min(tMax.x, tMax.y), tMax.z);
+
+  if (dstNear > dstFar || dstNear > maxDst) {
+    return FLT_MAX;
+  }
+
+  return dstNear;
+}
+
+HitInfo calculateRayCollisionBruteForce(Ray ray) {
+  HitInfo closestHit;
+  closestHit.didHit = false;
+  closestHit.hitPoint = vec3(0.0);
+  closestHit.normal = vec3(0.0);
+  closestHit.dst = FLT_MAX;
+  closestHit.materialIndex = 0;
+  closestHit.sphereIndex = NO_SPHERE;
+  closestHit.uv = vec2(0.0);
+  closestHit.uvDensity = 0.0;
+
+  uint closestSphere = 0;
+  for (int i = 0; i < spheres.length(); i++) {
+    vec4 sphere = spheres[i];
+    countSphereFetch(i);
+    HitInfo hitInfo = raySphere(ray, sphere.xyz, sphere.w);
+
+    if (hitInfo.didHit && hitInfo.dst < closestHit.dst) {
+      closestHit = hitInfo;
+      closestSphere = i;
+    }
+  }
+  countBytesRead(spheres.length() * SPHERE_SIZE,
+                 spheres.length() * LEGACY_SPHERE_SIZE);
+
+  if (closestHit.didHit) {
+    closestHit.materialIndex = sphereMaterials[closestSphere];
+    closestHit.sphereIndex = closestSphere;
+    countBytesRead(4 + MATERIAL_SIZE, 0);
+  }
+
+  return closestHit;
+}
+
+HitInfo calculateRayCollisionBVH(Ray ray) {
+  HitInfo closestHit;
+  closestHit.didHit = false;
+  closestHit.hitPoint = vec3(0.0);
+  closestHit.normal = vec3(0.0);
+  closestHit.dst = FLT_MAX;
+  closestHit.materialIndex = 0;
+  closestHit.sphereIndex = NO_SPHERE;
+  closestHit.uv = vec2(0.0);
+  closestHit.uvDensity = 0.0;
+
+  vec3 invDir = 1.0 / ray.dir;
+  countBytesRead(BVH_NODE_SIZE, BVH_NODE_SIZE);
+  if (rayAABB(ray, invDir, nodes[0].boundsMin, nodes[0].boundsMax,
+              closestHit.dst) == FLT_MAX) {
+    return closestHit;
+  }
+
+  uint stack[BVH_STACK_SIZE];
+  int stackSize = 0;
+  stack[stackSize++] = 0;
+
+  uint closestSphere = 0;
+  while (stackSize > 0) {
+    BVHNode node = nodes[stack[--stackSize]];
+    countBytesRead(BVH_NODE_SIZE, BVH_NODE_SIZE);
+
+    if (node.count > 0) {
+      for (uint i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+        vec4 sphere = spheres[i];
+        countSphereFetch(i);
+        HitInfo hitInfo = raySphere(ray, sphere.xyz, sphere.w);
+
+        if (hitInfo.didHit && hitInfo.dst < closestHit.dst) {
+          closestHit = hitInfo;
+          closestSphere = i;
+        }
+      }
+      countBytesRead(node.count * SPHERE_SIZE,
+                     node.count * LEGACY_SPHERE_SIZE);
+      continue;
+    }
+
+    countBytesRead(2 * BVH_NODE_SIZE, 2 * BVH_NODE_SIZE);
+
+    uint nearChild = node.leftFirst;
+    uint farChild = node.leftFirst + 1;
+    float dstNear = rayAABB(ray, invDir, nodes[nearChild].boundsMin,
+                            nodes[nearChild].boundsMax, closestHit.dst);
+    float dstFar = rayAABB(ray, invDir, nodes[farChild].boundsMin,
+                           nodes[farChild].boundsMax, closestHit.dst);
+    if (dstNear > dstFar) {
+      float tempDst = dstNear;
+      dstNear = dstFar;
+      dstFar = tempDst;
+      uint tempChild = nearChild;
+      nearChild = farChild;
+      farChild = tempChild;
+    }
+
+    /* push the far child first so the near one is visited first and can
+     * shrink closestHit.dst before the far one is popped */
+    if (dstFar != FLT_MAX) {
+      stack[stackSize++] = farChild;
+    }
+    if (dstNear != FLT_MAX) {
+      stack[stackSize++] = nearChild;
+    }
+  }
+
+  /* the material is only fetched for the closest sphere */
+  if (closestHit.didHit) {
+    closestHit.materialIndex = sphereMaterials[closestSphere];
+    closestHit.sphereIndex = closestSphere;
+    countBytesRead(4 + MATERIAL_SIZE, 0);
+  }
+
+  return closestHit;
+}
+
+HitInfo calculateRayCollisionCompressedBVH(Ray ray) {
+  HitInfo closestHit;
+  closestHit.didHit = false;
+  closestHit.hitPoint = vec3(0.0);
+  closestHit.normal = vec3(0.0);
+  closestHit.dst = FLT_MAX;
+  closestHit.materialIndex = 0;
+  closestHit.sphereIndex = NO_SPHERE;
+  closestHit.uv = vec2(0.0);
+  closestHit.uvDensity = 0.0;
+
+  vec3 invDir = 1.0 / ray.dir;
+
+  uint stack[BVH_STACK_SIZE];
+  int stackSize = 0;
+  stack[stackSize++] = 0;
+
+  uint closestSphere = 0;
+  while (stackSize > 0) {
+    /* one node holds the bounds of all its children, so a node is the only
+     * read needed to test them */
+    CompressedBVHNode node = compressedNodes[stack[--stackSize]];
+    countBytesRead(COMPRESSED_BVH_NODE_SIZE, COMPRESSED_BVH_NODE_SIZE);
+
+    vec3 scale = vec3(uintBitsToFloat((node.exponentsCodes & 0xFF) << 23),
+                      uintBitsToFloat((node.exponentsCodes >> 8 & 0xFF) << 23),
+                      uintBitsToFloat((node.exponentsCodes >> 16 & 0xFF) << 23));
+    vec3 origin = node.origin - ray.origin;
+    uint codes = node.exponentsCodes >> 24 | (node.childBaseCodes >> 24) << 8;
+    uint childBase = node.childBaseCodes & 0xFFFFFF;
+
+    uint internalCount = 0;
+    uint primitiveOffset = 0;
+    uint hitChildren[COMPRESSED_BVH_WIDTH];
+    float hitDsts[COMPRESSED_BVH_WIDTH];
+    uint hitCount = 0;
+    for (uint c = 0; c < COMPRESSED_BVH_WIDTH; c++) {
+      uint code = codes >> (c * 4) & 0xF;
+      if (code == COMPRESSED_BVH_CHILD_EMPTY) {
+        break;
+      }
+
+      uint shift = c * 8;
+      vec3 quantizedMin = vec3(node.quantizedMin[0] >> shift & 0xFF,
+                               node.quantizedMin[1] >> shift & 0xFF,
+                               node.quantizedMin[2] >> shift & 0xFF);
+      vec3 quantizedMax = vec3(node.quantizedMax[0] >> shift & 0xFF,
+                               node.quantizedMax[1] >> shift & 0xFF,
+                               node.quantizedMax[2] >> shift & 0xFF);
+      vec3 t0 = (quantizedMin * scale + origin) * invDir;
+      vec3 t1 = (quantizedMax * scale + origin) * invDir;
+      vec3 tMin = min(t0, t1);
+      vec3 tMax = max(t0, t1);
+      float dstNear = max(max(tMin.x, tMin.y), max(tMin.z, 0.0));
+      float dstFar = min(min(tMax.x, tMax.y), tMax.z);
+      bool hit = dstNear <= dstFar && dstNear <= closestHit.dst;
+
+      if (code == COMPRESSED_BVH_CHILD_INTERNAL) {
+        /* kept sorted far to near, the order they get pushed in */
+        if (hit) {
+          uint i = hitCount++;
+          for (; i > 0 && hitDsts[i - 1] < dstNear; i--) {
+            hitDsts[i] = hitDsts[i - 1];
+            hitChildren[i] = hitChildren[i - 1];
+          }
+          hitDsts[i] = dstNear;
+          hitChildren[i] = childBase + internalCount;
+        }
+        internalCount++;
+        continue;
+      }
+
+      uint count = code + 1;
+      if (hit) {
+        uint first = node.primitiveBase + primitiveOffset;
+        for (uint i = first; i < first + count; i++) {
+          vec4 sphere = spheres[i];
+          countSphereFetch(i);
+          HitInfo hitInfo = raySphere(ray, sphere.xyz, sphere.w);
+
+          if (hitInfo.didHit && hitInfo.dst < closestHit.dst) {
+            closestHit = hitInfo;
+            closestSphere = i;
+          }
+        }
+        countBytesRead(count * SPHERE_SIZE, count * LEGACY_SPHERE_SIZE);
+      }
+      primitiveOffset += count;
+    }
+
+    for (uint i = 0; i < hitCount; i++) {
+      stack[stackSize++] = hitChildren[i];
+    }
+  }
+
+  if (closestHit.didHit) {
+    closestHit.materialIndex = sphereMaterials[closestSphere];
+    closestHit.sphereIndex = closestSphere;
+    countBytesRead(4 + MATERIAL_SIZE, 0);
+  }
+
+  return closestHit;
+}
+
+WatertightRay watertightRay(Ray ray) {
+  WatertightRay wray;
+
+  /* Woop et al. 2013: shear the ray so its largest direction component
+   * becomes the z axis, keeping the winding order when that component is
+   * negative */
+  vec3 absDir = abs(ray.dir);
+  int kz = absDir.x > absDir.y ? (absDir.x > absDir.z ? 0 : 2)
+                               : (absDir.y > absDir.z ? 1 : 2);
+  int kx = (kz + 1) % 3;
+  int ky = (kx + 1) % 3;
+  if (ray.dir[kz] < 0.0) {
+    int temp = kx;
+    kx = ky;
+    ky = temp;
+  }
+
+  wray.k = ivec3(kx, ky, kz);
+  wray.shear = vec3(ray.dir[kx] / ray.dir[kz], ray.dir[ky] / ray.dir[kz],
+                    1.0 / ray.dir[kz]);
+
+  return wray;
+}
+
+bool rayTriangle(Ray ray, WatertightRay wray, vec3 a, vec3 b, vec3 c,
+                 float maxDst, out float dst, out vec3 barycentrics) {
+  dst = FLT_MAX;
+  barycentrics = vec3(0.0);
+
+  vec3 A = a - ray.origin;
+  vec3 B = b - ray.origin;
+  vec3 C = c - ray.origin;
+
+  float Ax = A[wray.k.x] - wray.shear.x * A[wray.k.z];
+  float Ay = A[wray.k.y] - wray.shear.y * A[wray.k.z];
+  float Bx = B[wray.k.x] - wray.shear.x * B[wray.k.z];
+  float By = B[wray.k.y] - wray.shear.y * B[wray.k.z];
+  float Cx = C[wray.k.x] - wray.shear.x * C[wray.k.z];
+  float Cy = C[wray.k.y] - wray.shear.y * C[wray.k.z];
+
+  float U = Cx * By - Cy * Bx;
+  float V = Ax * Cy - Ay * Cx;
+  float W = Bx * Ay - By * Ax;
+
+  if ((U < 0.0 || V < 0.0 || W < 0.0) && (U > 0.0 || V > 0.0 || W > 0.0)) {
+    return false;
+  }
+
+  float det = U + V + W;
+  if (det == 0.0) {
+    return false;
+  }
+
+  float Az = wray.shear.z * A[wray.k.z];
+  float Bz = wray.shear.z * B[wray.k.z];
+  float Cz = wray.shear.z * C[wray.k.z];
+  float T = U * Az + V * Bz + W * Cz;
+
+  /* reject hits behind the origin or past maxDst without dividing */
+  if (det < 0.0 && (T >= 0.0 || T < maxDst * det)) {
+    return false;
+  }
+  if (det > 0.0 && (T <= 0.0 || T > maxDst * det)) {
+    return false;
+  }
+
+  float invDet = 1.0 / det;
+  dst = T * invDet;
+  barycentrics = vec3(U, V, W) * invDet;
+
+  return true;
+}
+
+bool intersectMesh(Ray ray, vec3 invDir, WatertightRay wray, uint meshIndex,
+                   inout float closestDst, inout uint closestTriangle,
+                   inout vec3 closestBarycentrics) {
+  uint rootNode = meshInfos[meshIndex].rootNode;
+  countBytesRead(MESH_INFO_SIZE + BVH_NODE_SIZE,
+                 LEGACY_MESH_INFO_SIZE + BVH_NODE_SIZE);
+  if (rayAABB(ray, invDir, meshNodes[rootNode].boundsMin,
+              meshNodes[rootNode].boundsMax, closestDst) == FLT_MAX) {
+    return false;
+  }
+
+  uint stack[BVH_STACK_SIZE];
+  int stackSize = 0;
+  stack[stackSize++] = rootNode;
+
+  bool didHit = false;
+  while (stackSize > 0) {
+    BVHNode node = meshNodes[stack[--stackSize]];
+    countBytesRead(BVH_NODE_SIZE, BVH_NODE_SIZE);
+
+    if (node.count > 0) {
+      for (uint i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+        vec3 a = meshVertices[meshIndices[i * 3 + 0]].position;
+        vec3 b = meshVertices[meshIndices[i * 3 + 1]].position;
+        vec3 c = meshVertices[meshIndices[i * 3 + 2]].position;
+
+        float dst;
+        vec3 barycentrics;
+        if (rayTriangle(ray, wray, a, b, c, closestDst, dst, barycentrics) &&
+            dst < closestDst) {
+          closestDst = dst;
+          closestTriangle = i;
+          closestBarycentrics = barycentrics;
+          didHit = true;
+        }
+      }
+      countBytesRead(node.count * TRIANGLE_SIZE, node.count * TRIANGLE_SIZE);
+      continue;
+    }
+
+    countBytesRead(2 * BVH_NODE_SIZE, 2 * BVH_NODE_SIZE);
+
+    uint nearChild = node.leftFirst;
+    uint farChild = node.leftFirst + 1;
+    float dstNear = rayAABB(ray, invDir, meshNodes[nearChild].boundsMin,
+                            meshNodes[nearChild].boundsMax, closestDst);
+    float dstFar = rayAABB(ray, invDir, meshNodes[farChild].boundsMin,
+                           meshNodes[farChild].boundsMax, closestDst);
+    if (dstNear > dstFar) {
+      float tempDst = dstNear;
+      dstNear = dstFar;
+      dstFar = tempDst;
+      uint tempChild = nearChild;
+      nearChild = farChild;
+      farChild = tempChild;
+    }
+
+    if (dstFar != FLT_MAX) {
+      stack[stackSize++] = farChild;
+    }
+    if (dstNear != FLT_MAX) {
+      stack[stackSize++] = nearChild;
+    }
+  }
+
+  return didHit;
+}
+
+void intersectInstances(Ray ray, inout HitInfo closestHit) {
+  vec3 invDir = 1.0 / ray.dir;
+  countBytesRead(BVH_NODE_SIZE, BVH_NODE_SIZE);
+  if (rayAABB(ray, invDir, instanceNodes[0].boundsMin,
+              instanceNodes[0].boundsMax, closestHit.dst) == FLT_MAX) {
+    return;
+  }
+
+  uint stack[BVH_STACK_SIZE];
+  int stackSize = 0;
+  stack[stackSize++] = 0;
+
+  float closestDst = closestHit.dst;
+  uint closestInstance = 0;
+  uint closestTriangle = 0;
+  vec3 closestBarycentrics = vec3(0.0);
+  bool didHit = false;
+
+  while (stackSize > 0) {
+    BVHNode node = instanceNodes[stack[--stackSize]];
+    countBytesRead(BVH_NODE_SIZE, BVH_NODE_SIZE);
+
+    if (node.count > 0) {
+      for (uint i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+        /* the direction is transformed without normalizing, so distances in
+         * object space stay comparable with world space ones */
+        InstanceInfo instance = instances[i];
+        Ray objectRay;
+        objectRay.origin = vec3(dot(instance.worldToObject[0],
+                                    vec4(ray.origin, 1.0)),
+                                dot(instance.worldToObject[1],
+                                    vec4(ray.origin, 1.0)),
+                                dot(instance.worldToObject[2],
+                                    vec4(ray.origin, 1.0)));
+        objectRay.dir = vec3(dot(instance.worldToObject[0].xyz, ray.dir),
+                             dot(instance.worldToObject[1].xyz, ray.dir),
+                             dot(instance.worldToObject[2].xyz, ray.dir));
+
+        if (intersectMesh(objectRay, 1.0 / objectRay.dir,
+                          watertightRay(objectRay), instance.meshIndex,
+                          closestDst, closestTriangle, closestBarycentrics)) {
+          closestInstance = i;
+          didHit = true;
+        }
+      }
+      countBytesRead(node.count * INSTANCE_SIZE, node.count * INSTANCE_SIZE);
+      continue;
+    }
+
+    countBytesRead(2 * BVH_NODE_SIZE, 2 * BVH_NODE_SIZE);
+
+    uint nearChild = node.leftFirst;
+    uint farChild = node.leftFirst + 1;
+    float dstNear = rayAABB(ray, invDir, instanceNodes[nearChild].boundsMin,
+                            instanceNodes[nearChild].boundsMax, closestDst);
+    float dstFar = rayAABB(ray, invDir, instanceNodes[farChild].boundsMin,
+                           instanceNodes[farChild].boundsMax, closestDst);
+    if (dstNear > dstFar) {
+      float tempDst = dstNear;
+      dstNear = dstFar;
+      dstFar = tempDst;
+      uint tempChild = nearChild;
+      nearChild = farChild;
+      farChild = tempChild;
+    }
+
+    if (dstFar != FLT_MAX) {
+      stack[stackSize++] = farChild;
+    }
+    if (dstNear != FLT_MAX) {
+      stack[stackSize++] = nearChild;
+    }
+  }
+
+  if (!didHit) {
+    return;
+  }
+
+  /* shading data is only fetched for the closest triangle */
+  uint i = closestTriangle;
+  vec3 normal =
+      meshVertices[meshIndices[i * 3 + 0]].normal * closestBarycentrics.x +
+      meshVertices[meshIndices[i * 3 + 1]].normal * closestBarycentrics.y +
+      meshVertices[meshIndices[i * 3 + 2]].normal * closestBarycentrics.z;
+  if (dot(normal, normal) == 0.0) {
+    vec3 a = meshVertices[meshIndices[i * 3 + 0]].position;
+    vec3 b = meshVertices[meshIndices[i * 3 + 1]].position;
+    vec3 c = meshVertices[meshIndices[i * 3 + 2]].position;
+    normal = cross(b - a, c - a);
+  }
+
+  /* normals go back to world space with the transposed inverse */
+  InstanceInfo instance = instances[closestInstance];
+  normal = normalize(instance.worldToObject[0].xyz * normal.x +
+                     instance.worldToObject[1].xyz * normal.y +
+                     instance.worldToObject[2].xyz * normal.z);
+
+  MeshVertex a = meshVertices[meshIndices[i * 3 + 0]];
+  MeshVertex b = meshVertices[meshIndices[i * 3 + 1]];
+  MeshVertex c = meshVertices[meshIndices[i * 3 + 2]];
+  vec2 uvA = vec2(a.u, a.v);
+  vec2 uvB = vec2(b.u, b.v);
+  vec2 uvC = vec2(c.u, c.v);
+  vec2 uv = uvA * closestBarycentrics.x + uvB * closestBarycentrics.y +
+            uvC * closestBarycentrics.z;
+
+  /* the area vector of the triangle goes to world space like the normal,
+   * scaled by the determinant of the object to world transform */
+  vec3 area = cross(b.position - a.position, c.position - a.position);
+  vec3 worldArea = instance.worldToObject[0].xyz * area.x +
+                   instance.worldToObject[1].xyz * area.y +
+                   instance.worldToObject[2].xyz * area.z;
+  float determinant =
+      dot(instance.worldToObject[0].xyz,
+          cross(instance.worldToObject[1].xyz, instance.worldToObject[2].xyz));
+  vec2 uvEdgeB = uvB - uvA;
+  vec2 uvEdgeC = uvC - uvA;
+  float uvArea = abs(uvEdgeB.x * uvEdgeC.y - uvEdgeB.y * uvEdgeC.x);
+  float worldAreaLength = length(worldArea) / abs(determinant);
+
+  closestHit.didHit = true;
+  closestHit.dst = closestDst;
+  closestHit.hitPoint = ray.origin + ray.dir * closestDst;
+  closestHit.normal = dot(normal, ray.dir) > 0.0 ? -normal : normal;
+  closestHit.materialIndex = meshInfos[instance.meshIndex].materialIndex;
+  closestHit.sphereIndex = NO_SPHERE;
+  closestHit.uv = uv;
+  closestHit.uvDensity = uvArea > 0.0 && worldAreaLength > 0.0
+                             ? 0.5 * log2(uvArea / worldAreaLength)
+                             : 0.0;
+  countBytesRead(MATERIAL_SIZE, 0);
+}
+
+HitInfo calculateRayCollision(Ray ray) {
+  rayCount++;
+
+  HitInfo closestHit;
+  if (ubo.renderSettings.z == TRAVERSAL_COMPRESSED_BVH) {
+    closestHit = calculateRayCollisionCompressedBVH(ray);
+  } else if (ubo.renderSettings.z == TRAVERSAL_BVH) {
+    closestHit = calculateRayCollisionBVH(ray);
+  } else {
+    closestHit = calculateRayCollisionBruteForce(ray);
+  }
+
+  if (ubo.sceneCounts.x > 0) {
+    intersectInstances(ray, closestHit);
+  }
+
+  /* spheres are mapped like the environment, the unit square covering the
+   * whole surface */
+  if (closestHit.didHit && closestHit.sphereIndex != NO_SPHERE) {
+    vec4 sphere = spheres[closestHit.sphereIndex];
+    closestHit.uv = directionToEquirectangular(
+        (closestHit.hitPoint - sphere.xyz) / sphere.w);
+    closestHit.uvDensity = -0.5 * log2(4 * PI * sphere.w * sphere.w);
+  }
+
+  return closestHit;
+}
+
+vec3 screenToWorldDirection(vec2 point) {
+  vec3 ndc = vec3((2.0f * point.x) / ubo.viewportSize.x - 1.0f,
+                  (2.0f * point.y) / ubo.viewportSize.y - 1.0f, 1.0f);
+
+  vec4 clip = vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+
+  vec4 eye = inverse(ubo.projection) * clip;
+  eye = vec4(eye.x, eye.y, -1.0f, 0.0f);
+
+  vec3 world = vec3(inverse(ubo.view) * eye);
+  world = normalize(world);
+
+  return world;
+}
+
+/* the inverse of screenToWorldDirection for a camera with the given view and
+ * projection, a position with w = 0 is a direction like the sky. camera rays
+ * leave along -z in eye space, so false when the position is behind it */
+bool worldToScreen(vec4 position, mat4 view, mat4 projection, out vec2 point) {
+  vec3 eye = (view * position).xyz;
+  if (-eye.z <= 0.0) {
+    point = vec2(0.0);
+    return false;
+  }
+
+  vec2 ndc = vec2(projection[0][0], projection[1][1]) * eye.xy / -eye.z;
+  point = (ndc + 1.0) * 0.5 * ubo.viewportSize.xy;
+  return true;
+}
+
+/* the angle a pixel spans from the camera, which camera rays start their
+ * cones with */
+float pixelSpreadAngle() {
+  return atan(2.0 / (abs(ubo.projection[1][1]) * ubo.viewportSize.y));
+}
+
+/* the ray cones of Akenine-Moller et al. 2019, the mip level a cone
+ * coneWidth wide covers where it meets the surface at an angle, for a 1x1
+ * texture. sampleMaterialTexture adds the size of the texture */
+float rayConeLod(float coneWidth, float uvDensity, vec3 normal, vec3 dir) {
+  float cosTheta = max(abs(dot(normal, normalize(dir))), 1e-4);
+  return uvDensity + log2(max(coneWidth, 1e-8) / cosTheta);
+}
+
+vec4 sampleMaterialTexture(uint slot, vec2 uv, float lod) {
+  uint index = slot - 1;
+  ivec2 size = textureSize(materialTextures[nonuniformEXT(index)], 0);
+  return textureLod(materialTextures[nonuniformEXT(index)], uv,
+                    lod + 0.5 * log2(float(size.x * size.y)));
+}
+
+/* the material of a hit with its textures applied, the albedo texture tints
+ * the colour and the roughness one scales 1 - smoothness */
+RayTracingMaterial getTexturedMaterial(uint materialIndex, vec2 uv,
+                                       float lod) {
+  RayTracingMaterial material = materials[materialIndex];
+  if (material.albedoTexture > 0) {
+    material.colour.xyz *=
+        sampleMaterialTexture(material.albedoTexture, uv, lod).xyz;
+  }
+  if (material.roughnessTexture > 0) {
+    float roughness =
+        sampleMaterialTexture(material.roughnessTexture, uv, lod).y;
+    material.colour.w = 1.0 - (1.0 - material.colour.w) * roughness;
+  }
+  return material;
+}
+
+bool hasEnvironmentMap() { return ubo.sceneCounts.z > 0; }
+
+/* the environment next event estimation leaves alone. the sun is left to
+ * getSampledEnvironmentLight so it can be sampled on its own, an
+ * environment map takes the place of both */
+vec3 getSkyLight(Ray ray) {
+  if (hasEnvironmentMap()) {
+    return vec3(0.0);
+  }
+
+  float skyGradientT = pow(smoothstep(0, 0.4, ray.dir.y), 0.35);
+  float groundToSkyT = smoothstep(-0.01, 0, ray.dir.y);
+  vec3 skyGradient =
+      mix(ubo.skyColourHorizon.xyz, ubo.skyColourZenith.xyz, skyGradientT);
+
+  return mix(ubo.groundColour.xyz, skyGradient, groundToSkyT);
+}
+
+float getSunLight(vec3 dir) {
+  float sun = pow(max(0, dot(dir, ubo.sunPosition.xyz)), ubo.sunFocus) *
+              ubo.sunInternsity;
+  return sun * int(dir.y >= 0);
+}
+
+/* equirectangular, row 0 looks straight up */
+vec2 directionToEquirectangular(vec3 dir) {
+  float phi = atan(dir.z, dir.x);
+  if (phi < 0.0) {
+    phi += 2 * PI;
+  }
+  return vec2(phi / (2 * PI), acos(clamp(dir.y, -1.0, 1.0)) / PI);
+}
+
+vec4 getEnvironmentTexel(vec3 dir) {
+  uvec2 size = ubo.sceneCounts.zw;
+  uvec2 texel = min(uvec2(directionToEquirectangular(dir) * vec2(size)),
+                    size - 1);
+  return environmentTexels[texel.y * size.x + texel.x];
+}
+
+vec3 getEnvironmentMapLight(vec3 dir) { return getEnvironmentTexel(dir).xyz; }
+
+/* the environment next event estimation samples */
+vec3 getSampledEnvironmentLight(vec3 dir) {
+  return hasEnvironmentMap() ? getEnvironmentMapLight(dir)
+                             : vec3(getSunLight(dir));
+}
+
+vec3 getEnvironmentLight(Ray ray) {
+  return getSkyLight(ray) + getSampledEnvironmentLight(ray.dir);
+}
+
+/* next event estimation picks the environment half the time when there are
+ * emissive spheres too and one of the spheres otherwise */
+float environmentLightProbability() {
+  if (!hasEnvironmentMap() && ubo.sunInternsity <= 0.0) {
+    return 0.0;
+  }
+  return ubo.sceneCounts.y > 0 ? 0.5 : 1.0;
+}
+
+/* the sun is a cosine power lobe around sunPosition, which gets sampled
+ * exactly so every sample carries the same weight */
+vec3 sampleSunDirection(vec2 u, out float pdf) {
+  float cosTheta = pow(u.x, 1.0 / (ubo.sunFocus + 1.0));
+  vec3 dir = directionAroundAxis(normalize(ubo.sunPosition.xyz), cosTheta,
+                                 2 * PI * u.y);
+  pdf = sunDirectionPdf(dir);
+  return dir;
+}
+
+float sunDirectionPdf(vec3 dir) {
+  float cosTheta = max(dot(dir, normalize(ubo.sunPosition.xyz)), 0.0);
+  return (ubo.sunFocus + 1.0) / (2 * PI) * pow(cosTheta, ubo.sunFocus);
+}
+
+/* the interval of the count + 1 CDF values at offset that u falls in, and
+ * where in it */
+uint sampleEnvironmentCdf(uint offset, uint count, float u, out float t) {
+  uint low = 0;
+  uint high = count;
+  while (high - low > 1) {
+    uint middle = (low + high) / 2;
+    if (environmentCdf[offset + middle] <= u) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+
+  float start = environmentCdf[offset + low];
+  float width = environmentCdf[offset + low + 1] - start;
+  t = width > 0.0 ? clamp((u - start) / width, 0.0, 1.0) : 0.5;
+  return low;
+}
+
+/* picks a row by the marginal CDF and a texel in it by the conditional one,
+ * so texels are drawn in proportion to their luminance times their solid
+ * angle */
+vec3 sampleEnvironmentMapDirection(vec2 u, out float pdf) {
+  uvec2 size = ubo.sceneCounts.zw;
+  float rowT;
+  uint row = sampleEnvironmentCdf(0, size.y, u.y, rowT);
+  float columnT;
+  uint column =
+      sampleEnvironmentCdf(size.y + 1 + row * (size.x + 1), size.x, u.x,
+                           columnT);
+
+  float phi = 2 * PI * (column + columnT) / size.x;
+  float theta = PI * (row + rowT) / size.y;
+  float sinTheta = sin(theta);
+  vec3 dir = vec3(sinTheta * cos(phi), cos(theta), sinTheta * sin(phi));
+
+  /* from the unit square to solid angle */
+  pdf = sinTheta > 0.0 ? environmentTexels[row * size.x + column].w /
+                             (2 * PI * PI * sinTheta)
+                       : 0.0;
+  return dir;
+}
+
+float environmentMapDirectionPdf(vec3 dir) {
+  float sinTheta = sqrt(max(1.0 - dir.y * dir.y, 0.0));
+  return sinTheta > 0.0
+             ? getEnvironmentTexel(dir).w / (2 * PI * PI * sinTheta)
+             : 0.0;
+}
+
+vec3 sampleEnvironmentDirection(vec2 u, out float pdf) {
+  return hasEnvironmentMap() ? sampleEnvironmentMapDirection(u, pdf)
+                             : sampleSunDirection(u, pdf);
+}
+
+float environmentDirectionPdf(vec3 dir) {
+  return hasEnvironmentMap() ? environmentMapDirectionPdf(dir)
+                             : sunDirectionPdf(dir);
+}
+
+/* uniform over the cone of directions the sphere covers from origin, which
+ * has no samples wasted on its back. the pdf is 0 from inside the sphere */
+vec3 sampleSphereDirection(vec3 origin, vec4 sphere, vec2 u, out float pdf) {
+  vec3 toCentre = sphere.xyz - origin;
+  float dst2 = dot(toCentre, toCentre);
+  float sinThetaMax2 = sphere.w * sphere.w / dst2;
+  if (sinThetaMax2 >= 1.0) {
+    pdf = 0.0;
+    return vec3(0.0);
+  }
+
+  /* 1 - cosThetaMax without the cancellation for small or far spheres */
+  float cosThetaMax = sqrt(1.0 - sinThetaMax2);
+  float oneMinusCosThetaMax = sinThetaMax2 / (1.0 + cosThetaMax);
+  float cosTheta = 1.0 - u.x * oneMinusCosThetaMax;
+  pdf = 1.0 / (2 * PI * oneMinusCosThetaMax);
+
+  return directionAroundAxis(toCentre / sqrt(dst2), cosTheta, 2 * PI * u.y);
+}
+
+float sphereDirectionPdf(vec3 origin, vec4 sphere) {
+  vec3 toCentre = sphere.xyz - origin;
+  float sinThetaMax2 = sphere.w * sphere.w / dot(toCentre, toCentre);
+  if (sinThetaMax2 >= 1.0) {
+    return 0.0;
+  }
+
+  float oneMinusCosThetaMax = sinThetaMax2 / (1.0 + sqrt(1.0 - sinThetaMax2));
+  return 1.0 / (2 * PI * oneMinusCosThetaMax);
+}
+
+/* Conty and Kulla 2018 without the emission cones, which are whole spheres
+ * for sphere lights. a node is worth its flux over the squared distance,
+ * times the best cosine any point of its bounds could have with the normal */
+float lightNodeImportance(uint node, vec3 point, vec3 normal) {
+  LightBVHNode lightNode = lightNodes[node];
+  lightNodeVisits++;
+
+  vec3 centre = (lightNode.boundsMin + lightNode.boundsMax) * 0.5;
+  vec3 toCentre = centre - point;
+  vec3 halfExtent = lightNode.boundsMax - centre;
+  float radius2 = dot(halfExtent, halfExtent);
+  float dst2 = dot(toCentre, toCentre);
+  if (dst2 <= radius2) {
+    return lightNode.flux / max(radius2, 1e-8);
+  }
+
+  float cosTheta = dot(normal, toCentre) * inversesqrt(dst2);
+  float sinBound2 = radius2 / dst2;
+  float cosBound = sqrt(1.0 - sinBound2);
+  /* the cosine of the angle to the normal less the angle the bounds cover */
+  float cosBoundedTheta = 1.0;
+  if (cosTheta < cosBound) {
+    float sinTheta = sqrt(max(1.0 - cosTheta * cosTheta, 0.0));
+    cosBoundedTheta = cosTheta * cosBound + sinTheta * sqrt(sinBound2);
+  }
+
+  return lightNode.flux * max(cosBoundedTheta, 0.0) / dst2;
+}
+
+/* both children of a node are weighed the same when neither can be seen */
+float lightChildProbability(uint left, vec3 point, vec3 normal) {
+  float leftImportance = lightNodeImportance(left, point, normal);
+  float rightImportance = lightNodeImportance(left + 1, point, normal);
+  float importance = leftImportance + rightImportance;
+  return importance > 0.0 ? leftImportance / importance : 0.5;
+}
+
+/* picks a light index with one random number, rescaling it to what is left
+ * of its range at every level */
+uint sampleLightBVH(vec3 point, vec3 normal, float u, out float pdf) {
+  uint node = 0;
+  pdf = 1.0;
+  while (lightNodes[node].count == 0) {
+    uint left = lightNodes[node].leftFirst;
+    float leftProbability = lightChildProbability(left, point, normal);
+    if (u < leftProbability) {
+      node = left;
+      pdf *= leftProbability;
+      u /= leftProbability;
+    } else {
+      node = left + 1;
+      pdf *= 1.0 - leftProbability;
+      u = (u - leftProbability) / (1.0 - leftProbability);
+    }
+    u = min(u, 0.99999994);
+  }
+
+  return lightNodes[node].leftFirst;
+}
+
+/* the chance sampleLightBVH picks the light of sphere, walking up from its
+ * leaf */
+float lightBVHPdf(uint sphere, vec3 point, vec3 normal) {
+  uint node = sphereLightLeaves[sphere];
+  float pdf = 1.0;
+  while (node != 0) {
+    uint parent = lightNodes[node].parent;
+    uint left = lightNodes[parent].leftFirst;
+    float leftProbability = lightChildProbability(left, point, normal);
+    pdf *= node == left ? leftProbability : 1.0 - leftProbability;
+    node = parent;
+  }
+
+  return pdf;
+}
+
+float linearToGamma(float linearComponent) { return sqrt(linearComponent); }
+
+void countBytesRead(uint bytes, uint legacyBytes) {
+  bytesRead += bytes;
+  legacyBytesRead += legacyBytes;
+}
+
+void countSphereFetch(uint sphere) {
+  if (trackSphereFetches) {
+    uint bit = sphere % SPHERE_FETCH_BITS;
+    atomicOr(sphereFetchMask[bit / 32], 1u << (bit % 32));
+  }
+}
+
+void addStat(uint stat, uint value) {
+  /* carry into the high word when the low one wraps around */
+  uint low = atomicAdd(stats[stat * 2], value);
+  if (low + value < low) {
+    atomicAdd(stats[stat * 2 + 1], 1);
+  }
+}
+
+/* adds a 64-bit value given as its two words */
+void addStatWide(uint stat, uint high, uint low) {
+  addStat(stat, low);
+  if (high > 0) {
+    atomicAdd(stats[stat * 2 + 1], high);
+  }
+}
@@ -0,0 +1,99 @@
+/* where the random numbers of a path come from, shared by the wavefront_*.comp
+ * kernels through wavefront_common.glsl. every use of a random number along a
+ * path has its own dimension, so the Sobol points of a pixel stay stratified
+ * per use across its samples. PCG draws from the path state in order and
+ * ignores the dimension */
+
+/* sequence, see WavefrontSequence in wavefront.h */
+#define SEQUENCE_PCG 0
+#define SEQUENCE_SOBOL 1
+
+/* dimensions of the camera ray, 2D samples take two */
+#define DIMENSION_DEFOCUS 0
+#define DIMENSION_JITTER 2
+#define CAMERA_DIMENSIONS 4
+
+/* dimensions of every bounce, after the camera ones */
+#define DIMENSION_LIGHT_CHOICE 0
+#define DIMENSION_LIGHT_PICK 1
+#define DIMENSION_LIGHT_DIRECTION 2
+#define DIMENSION_LOBE 4
+#define DIMENSION_BSDF_DIRECTION 5
+#define DIMENSION_ROULETTE 7
+#define DIMENSION_GUIDE_CHOICE 8
+#define BOUNCE_DIMENSIONS 9
+
+uint hashUint(uint x) { return nextRandom(x); }
+
+uint hashCombine(uint seed, uint value) {
+  return seed ^ (hashUint(value) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+/* the PCG state of a sample. hashing the pixel and sample index apart keeps
+ * neighbouring pixels and samples from sharing states */
+uint pcgSeed(uint pixel, uint sampleIndex) {
+  return hashCombine(hashUint(pixel), sampleIndex);
+}
+
+/* Burley 2020, an Owen scramble of the bits of x from the most significant
+ * one down */
+uint laineKarrasPermutation(uint x, uint seed) {
+  x ^= x * 0x3d20adeau;
+  x += seed;
+  x *= (seed >> 16) | 1u;
+  x ^= x * 0x05526c56u;
+  x ^= x * 0x53a22864u;
+  return x;
+}
+
+uint nestedUniformScramble(uint x, uint seed) {
+  return bitfieldReverse(laineKarrasPermutation(bitfieldReverse(x), seed));
+}
+
+/* the second Sobol dimension, the first is bitfieldReverse(index) */
+uint sobolSecondDimension(uint index) {
+  uint result = 0;
+  uint v = 1u << 31;
+  while (index != 0) {
+    if ((index & 1) != 0) {
+      result ^= v;
+    }
+    index >>= 1;
+    v ^= v >> 1;
+  }
+  return result;
+}
+
+/* 24 bits keep the value below 1 */
+float unitFloat(uint x) { return float(x >> 8) / 16777216.0; }
+
+/* the first two Sobol dimensions, shuffled and scrambled per pixel and
+ * dimension so every dimension pair is an independent 2D sequence */
+vec2 sobol2D(uint pixel, uint sampleIndex, uint dimension) {
+  uint seed = hashCombine(hashUint(pixel), dimension);
+  uint index = nestedUniformScramble(sampleIndex, seed);
+  uvec2 point = uvec2(bitfieldReverse(index), sobolSecondDimension(index));
+  return vec2(
+      unitFloat(nestedUniformScramble(point.x, hashCombine(seed, 0u))),
+      unitFloat(nestedUniformScramble(point.y, hashCombine(seed, 1u))));
+}
+
+vec2 sample2D(inout PathState path, uint dimension) {
+  if (pushConstants.sequence == SEQUENCE_SOBOL) {
+    return sobol2D(path.pixel, path.sampleIndex, dimension);
+  }
+  return vec2(randomValue(path.rngState), randomValue(path.rngState));
+}
+
+float sample1D(inout PathState path, uint dimension) {
+  if (pushConstants.sequence == SEQUENCE_SOBOL) {
+    return sobol2D(path.pixel, path.sampleIndex, dimension).x;
+  }
+  return randomValue(path.rngState);
+}
+
+/* a dimension of the bounce shade is running */
+uint bounceDimension(uint dimension) {
+  return CAMERA_DIMENSIONS + pushConstants.bounce * BOUNCE_DIMENSIONS +
+         dimension;
+}
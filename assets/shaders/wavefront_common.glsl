@@ -0,0 +1,257 @@
+/* shared by the wavefront_*.comp kernels. a path is one sample of one pixel
+ * and its rays move between two queues: extend finds the closest hit of every
+ * ray in the read queue and shade appends the rays that keep bouncing to the
+ * other one, which leaves out finished paths as it goes. shade also queues a
+ * shadow ray toward a light for every hit, which connect traces */
+
+#include "ray_tracing.glsl"
+
+#define WAVEFRONT_GROUP_SIZE 64
+#define WAVEFRONT_TILE_SIZE 16
+
+/* a pixel stays converged until the accumulation restarts */
+#define PIXEL_CONVERGED 1.0
+
+/* sortMode, see WavefrontSortMode in wavefront.h */
+#define SORT_NONE 0
+#define SORT_DIRECTION 1
+#define SORT_MATERIAL 2
+/* bins of the counting sort, the direction key is the octant on top of a 4x4x4
+ * grid of origin cells */
+#define SORT_BIN_COUNT 512
+
+/* lightSelection, see WavefrontLightSelection in wavefront.h */
+#define LIGHT_SELECTION_UNIFORM 0
+#define LIGHT_SELECTION_BVH 1
+
+/* the ray a path continues with and what it carries so far */
+struct PathState {
+  vec3 origin;
+  uint pixel;
+  vec3 dir;
+  uint rngState;
+  vec3 throughput;
+  /* pdf of the diffuse lobe sampling dir, which weighs the light dir finds
+   * against next event estimation. 0 for camera rays and specular bounces,
+   * whose light is always counted in full */
+  float bsdfPdf;
+  /* normal at the vertex the ray left from, the light BVH weighs lights by
+   * it */
+  vec3 bsdfNormal;
+  /* the sample of its pixel the path is, counted since the accumulation
+   * restarted */
+  uint sampleIndex;
+  /* what the light found from the next vertex on is worth to the radiance
+   * cache estimate of the last one */
+  vec3 cacheTransport;
+  /* cache cell of the last diffuse vertex, NO_CACHE_CELL when there is none
+   * to add to */
+  uint cacheCell;
+  /* the ray cone texture lookups pick their mip level by, its width at
+   * origin and the angle it widens by, see rayConeLod */
+  float coneWidth;
+  float coneSpread;
+  uvec2 padding;
+};
+
+/* what the first sample of a pixel hit first, guides the denoiser */
+struct PixelFeatures {
+  vec3 albedo;
+  /* 0 where the camera ray missed */
+  float depth;
+  vec3 normal;
+  uint padding;
+};
+
+/* the parts of HitInfo shade needs, the hit point follows from the ray */
+struct PathHit {
+  vec3 normal;
+  float dst;
+  uint materialIndex;
+  uint didHit;
+  uint sphereIndex;
+  /* rayConeLod of the cone at the hit */
+  float textureLod;
+  vec2 uv;
+  uvec2 padding;
+};
+
+/* a light sample waiting for its visibility, contribution already carries
+ * the path throughput and MIS weight */
+struct ShadowRay {
+  vec3 origin;
+  /* the emissive sphere that was sampled, NO_SPHERE for the environment */
+  uint lightSphere;
+  vec3 dir;
+  uint pixel;
+  vec3 contribution;
+  /* cache cell of the vertex the shadow ray left from */
+  uint cacheCell;
+  /* contribution without the path throughput, what the cell gets */
+  vec3 cacheContribution;
+  uint padding;
+};
+
+layout(push_constant) uniform WavefrontPushConstants {
+  uint sampleIndex;
+  uint bounce;
+  /* queue extend and shade read from, shade appends to the other one */
+  uint readQueue;
+  /* paths per queue, one per pixel */
+  uint pathCapacity;
+  uint sortMode;
+  /* counts the distinct spheres and materials every group touches */
+  uint coherenceStats;
+  /* samples the environment and emissive spheres at every diffuse hit */
+  uint nextEventEstimation;
+  /* how next event estimation picks among the emissive spheres */
+  uint lightSelection;
+  /* counts the cost and second moment of the light samples */
+  uint lightStats;
+  /* where the random numbers come from, see sampler.glsl */
+  uint sequence;
+  /* sums the squared error against the reference in resolve */
+  uint errorStats;
+  /* bounces before Russian roulette starts, 0xFFFFFFFF keeps every path
+   * going to the bounce limit */
+  uint rouletteDepth;
+  /* the a-trous iteration the denoise pass runs, its step is 2^iteration */
+  uint denoiseIteration;
+  uint denoiseIterationCount;
+  /* RADIANCE_CACHE_* bits */
+  uint radianceCache;
+  /* shows the cached radiance at the first hits instead of the image */
+  uint cacheDebug;
+  /* GUIDING_* bits */
+  uint guiding;
+  /* draws the light of the first hits from reservoirs, see
+   * light_resampling.glsl */
+  uint reservoirResampling;
+  uint reservoirBias;
+}
+pushConstants;
+
+/* both queues, pathCapacity paths each */
+layout(std430, set = 3, binding = 0) buffer Paths {
+  PathState paths[];
+};
+
+/* one per path of the read queue, in queue order */
+layout(std430, set = 3, binding = 1) buffer PathHits {
+  PathHit pathHits[];
+};
+
+layout(std430, set = 3, binding = 2) buffer QueueState {
+  uint queueCounts[2];
+  /* shadow rays shade queued this bounce, at most one per path */
+  uint shadowCount;
+  /* pixels compact put on the work list this frame */
+  uint activePixelCount;
+  /* group counts of the indirect extend and shade dispatches */
+  uvec4 dispatchArgs;
+  /* group count of the indirect generate dispatch */
+  uvec4 generateDispatchArgs;
+};
+
+/* xyz - radiance summed over the samples of this frame */
+layout(std430, set = 3, binding = 3) buffer Radiance {
+  vec4 radiance[];
+};
+
+/* pathCapacity shadow rays */
+layout(std430, set = 3, binding = 7) buffer ShadowRays {
+  ShadowRay shadowRays[];
+};
+
+/* counting sort of the read queue. the paths stay where they are and only
+ * their indices get reordered, which keeps the sort to 4 bytes per ray */
+layout(std430, set = 3, binding = 4) buffer SortBins {
+  uint sortBins[SORT_BIN_COUNT];
+};
+
+layout(std430, set = 3, binding = 5) buffer SortKeys {
+  uint sortKeys[];
+};
+
+/* read queue indices in key order */
+layout(std430, set = 3, binding = 6) buffer PathOrder {
+  uint pathOrder[];
+};
+
+/* x - frames accumulated, y - mean of their luminance, z - sum of squared
+ * differences from it, w - 1 once the pixel is converged */
+layout(std430, set = 3, binding = 8) buffer PixelStats {
+  vec4 pixelStats[];
+};
+
+/* pixels generate starts paths for, activePixelCount of them */
+layout(std430, set = 3, binding = 9) buffer ActivePixels {
+  uint activePixels[];
+};
+
+/* xyz - linear radiance summed over every frame since the last reset, w - the
+ * samples in it. the result image only ever gets the average, so nothing is
+ * lost to its 8 bits */
+layout(std430, set = 3, binding = 10) buffer Accumulation {
+  vec4 accumulation[];
+};
+
+/* an accumulation copied aside to measure the error of later ones against */
+layout(std430, set = 3, binding = 11) buffer Reference {
+  vec4 reference[];
+};
+
+layout(std430, set = 3, binding = 12) buffer Features {
+  PixelFeatures features[];
+};
+
+/* two images of pathCapacity texels the denoise iterations ping-pong
+ * between, xyz - radiance with the albedo divided out */
+layout(std430, set = 3, binding = 13) buffer Denoised {
+  vec4 denoised[];
+};
+
+/* the accumulation and features as the last frame left them, copied before
+ * a frame whose camera moved */
+layout(std430, set = 3, binding = 14) buffer HistoryAccumulation {
+  vec4 historyAccumulation[];
+};
+
+layout(std430, set = 3, binding = 15) buffer HistoryFeatures {
+  PixelFeatures historyFeatures[];
+};
+
+bool reprojectsHistory() { return ubo.reprojectionSettings.x != 0.0; }
+
+#include "sampler.glsl"
+#include "radiance_cache.glsl"
+#include "path_guiding.glsl"
+#include "light_resampling.glsl"
+
+uint queueOffset(uint queue) { return queue * pushConstants.pathCapacity; }
+
+/* direction sorting runs before extend so neighbouring invocations walk the
+ * same part of the BVH, material sorting after it so they shade alike */
+bool sortsBeforeExtend() { return pushConstants.sortMode == SORT_DIRECTION; }
+bool sortsBeforeShade() { return pushConstants.sortMode != SORT_NONE; }
+
+uint directionSortKey(PathState path) {
+  uint octant = uint(path.dir.x < 0.0) | uint(path.dir.y < 0.0) << 1 |
+                uint(path.dir.z < 0.0) << 2;
+
+  /* origins outside the scene bounds clamp to the border cells */
+  vec3 extent =
+      max(ubo.sceneBoundsMax.xyz - ubo.sceneBoundsMin.xyz, vec3(1e-6));
+  uvec3 cell =
+      uvec3(clamp((path.origin - ubo.sceneBoundsMin.xyz) / extent * 4.0,
+                  vec3(0.0), vec3(3.0)));
+  return octant << 6 | cell.z << 4 | cell.y << 2 | cell.x;
+}
+
+/* misses all share bin 0 */
+uint materialSortKey(PathHit hit) {
+  if (hit.didHit == 0) {
+    return 0;
+  }
+  return 1 + hit.materialIndex % (SORT_BIN_COUNT - 1);
+}
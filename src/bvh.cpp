@@ -0,0 +1,1141 @@
+#include "bvh.h"
+
+#include "logger.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <float.h>
+#include <math.h>
+#include <mutex>
+#include <numeric>
+#include <string.h>
+
+static const float traversal_cost = 1.0f;
+static const float intersection_cost = 1.0f;
+static const uint32_t max_leaf_size = 8;
+
+static const uint32_t bin_count = 32;
+static const uint32_t lbvh_leaf_size = 4;
+/* the 3 bits a compressed leaf code has for its count */
+static const uint32_t compressed_bvh_max_leaf_size = 8;
+/* nodes and subtrees above these sizes are worth handing to the pool */
+static const uint32_t parallel_node_size = 1 << 16;
+static const uint32_t parallel_subtree_size = 1 << 12;
+static const uint32_t parallel_chunk_size = 1 << 14;
+
+static const char *bvh_builder_names[BVH_BUILDER_COUNT] = {"sweep", "binned",
+                                                           "lbvh"};
+
+static float surfaceArea(glm::vec3 bounds_min, glm::vec3 bounds_max) {
+  glm::vec3 extent = glm::max(bounds_max - bounds_min, glm::vec3(0.0f));
+  return 2.0f * (extent.x * extent.y + extent.y * extent.z +
+                 extent.z * extent.x);
+}
+
+static void updateNodeBounds(const std::vector<BVHPrimitive> &primitives,
+                             const std::vector<uint32_t> &primitive_indices,
+                             BVHNode *node) {
+  node->bounds_min = glm::vec3(FLT_MAX);
+  node->bounds_max = glm::vec3(-FLT_MAX);
+  for (uint32_t i = 0; i < node->count; ++i) {
+    const BVHPrimitive &primitive =
+        primitives[primitive_indices[node->left_first + i]];
+    node->bounds_min = glm::min(node->bounds_min, primitive.bounds_min);
+    node->bounds_max = glm::max(node->bounds_max, primitive.bounds_max);
+  }
+}
+
+static void buildBVHSweep(const std::vector<BVHPrimitive> &primitives,
+                          BVH *out_bvh) {
+  const uint32_t primitive_count = primitives.size();
+
+  out_bvh->primitive_indices.resize(primitive_count);
+  std::iota(out_bvh->primitive_indices.begin(),
+            out_bvh->primitive_indices.end(), 0);
+
+  out_bvh->nodes.clear();
+  out_bvh->nodes.reserve(primitive_count * 2 - 1);
+
+  BVHNode root = {};
+  root.left_first = 0;
+  root.count = primitive_count;
+  updateNodeBounds(primitives, out_bvh->primitive_indices, &root);
+  out_bvh->nodes.emplace_back(root);
+
+  std::vector<uint32_t> sorted_indices;
+  std::vector<float> right_areas;
+  std::vector<uint32_t> node_stack;
+  node_stack.emplace_back(0);
+
+  while (!node_stack.empty()) {
+    uint32_t node_index = node_stack.back();
+    node_stack.pop_back();
+    BVHNode node = out_bvh->nodes[node_index];
+    if (node.count <= 1) {
+      continue;
+    }
+
+    uint32_t *first = &out_bvh->primitive_indices[node.left_first];
+    sorted_indices.resize(node.count);
+    right_areas.resize(node.count);
+
+    /* full sweep over every axis: sort the centroids, then evaluate every split
+     * position with prefix/suffix bounds */
+    float best_cost = FLT_MAX;
+    int best_axis = -1;
+    uint32_t best_split = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+      std::copy(first, first + node.count, sorted_indices.begin());
+      std::sort(sorted_indices.begin(), sorted_indices.end(),
+                [&](uint32_t a, uint32_t b) {
+                  return primitives[a].centroid[axis] <
+                         primitives[b].centroid[axis];
+                });
+
+      glm::vec3 bounds_min = glm::vec3(FLT_MAX);
+      glm::vec3 bounds_max = glm::vec3(-FLT_MAX);
+      for (uint32_t i = node.count - 1; i > 0; --i) {
+        const BVHPrimitive &primitive = primitives[sorted_indices[i]];
+        bounds_min = glm::min(bounds_min, primitive.bounds_min);
+        bounds_max = glm::max(bounds_max, primitive.bounds_max);
+        right_areas[i] = surfaceArea(bounds_min, bounds_max);
+      }
+
+      bounds_min = glm::vec3(FLT_MAX);
+      bounds_max = glm::vec3(-FLT_MAX);
+      for (uint32_t i = 1; i < node.count; ++i) {
+        const BVHPrimitive &primitive = primitives[sorted_indices[i - 1]];
+        bounds_min = glm::min(bounds_min, primitive.bounds_min);
+        bounds_max = glm::max(bounds_max, primitive.bounds_max);
+
+        float cost = surfaceArea(bounds_min, bounds_max) * i +
+                     right_areas[i] * (node.count - i);
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = axis;
+          best_split = i;
+        }
+      }
+    }
+
+    float parent_area = surfaceArea(node.bounds_min, node.bounds_max);
+    float leaf_cost = node.count * intersection_cost;
+    float split_cost = traversal_cost;
+    if (parent_area > 0.0f) {
+      split_cost += intersection_cost * best_cost / parent_area;
+    }
+    if (split_cost >= leaf_cost && node.count <= max_leaf_size) {
+      continue;
+    }
+
+    std::sort(first, first + node.count, [&](uint32_t a, uint32_t b) {
+      return primitives[a].centroid[best_axis] <
+             primitives[b].centroid[best_axis];
+    });
+
+    BVHNode left = {};
+    left.left_first = node.left_first;
+    left.count = best_split;
+    updateNodeBounds(primitives, out_bvh->primitive_indices, &left);
+
+    BVHNode right = {};
+    right.left_first = node.left_first + best_split;
+    right.count = node.count - best_split;
+    updateNodeBounds(primitives, out_bvh->primitive_indices, &right);
+
+    uint32_t left_index = out_bvh->nodes.size();
+    out_bvh->nodes.emplace_back(left);
+    out_bvh->nodes.emplace_back(right);
+
+    out_bvh->nodes[node_index].left_first = left_index;
+    out_bvh->nodes[node_index].count = 0;
+
+    node_stack.emplace_back(left_index);
+    node_stack.emplace_back(left_index + 1);
+  }
+}
+
+struct BVHBin {
+  glm::vec3 bounds_min;
+  glm::vec3 bounds_max;
+  uint32_t count;
+};
+
+/* bins along each axis over the centroid bounds of a node, small nodes use
+ * fewer bins since the fixed cost of evaluating them dominates there */
+struct BVHBins {
+  BVHBin bins[3][bin_count];
+  uint32_t count;
+  glm::vec3 centroid_min;
+  glm::vec3 bin_scale;
+};
+
+struct BinnedBuild {
+  const std::vector<BVHPrimitive> *primitives;
+  BVH *bvh;
+  std::atomic<uint32_t> node_count;
+  ThreadPoolGroup group;
+};
+
+static void emptyBin(BVHBin *bin) {
+  bin->bounds_min = glm::vec3(FLT_MAX);
+  bin->bounds_max = glm::vec3(-FLT_MAX);
+  bin->count = 0;
+}
+
+static void growBin(BVHBin *bin, const BVHBin &other) {
+  bin->bounds_min = glm::min(bin->bounds_min, other.bounds_min);
+  bin->bounds_max = glm::max(bin->bounds_max, other.bounds_max);
+  bin->count += other.count;
+}
+
+static void emptyBins(BVHBins *bins) {
+  for (int axis = 0; axis < 3; ++axis) {
+    for (uint32_t i = 0; i < bins->count; ++i) {
+      emptyBin(&bins->bins[axis][i]);
+    }
+  }
+}
+
+static uint32_t binIndex(const BVHBins &bins, const BVHPrimitive &primitive,
+                         int axis) {
+  uint32_t bin = (primitive.centroid[axis] - bins.centroid_min[axis]) *
+                 bins.bin_scale[axis];
+  return std::min(bin, bins.count - 1);
+}
+
+static void fillBins(const std::vector<BVHPrimitive> &primitives,
+                     const uint32_t *indices, uint32_t begin, uint32_t end,
+                     BVHBins *bins) {
+  for (uint32_t i = begin; i < end; ++i) {
+    const BVHPrimitive &primitive = primitives[indices[i]];
+    for (int axis = 0; axis < 3; ++axis) {
+      BVHBin &bin = bins->bins[axis][binIndex(*bins, primitive, axis)];
+      bin.bounds_min = glm::min(bin.bounds_min, primitive.bounds_min);
+      bin.bounds_max = glm::max(bin.bounds_max, primitive.bounds_max);
+      bin.count++;
+    }
+  }
+}
+
+/* splits a node in two along the cheapest bin boundary, returns false when
+ * it stays a leaf */
+static bool splitBinnedNode(BinnedBuild *build, uint32_t node_index,
+                            uint32_t *out_left_index) {
+  const std::vector<BVHPrimitive> &primitives = *build->primitives;
+  BVHNode node = build->bvh->nodes[node_index];
+  if (node.count <= 1) {
+    return false;
+  }
+
+  uint32_t *first = &build->bvh->primitive_indices[node.left_first];
+  bool is_parallel = node.count >= parallel_node_size;
+  std::mutex mutex;
+
+  /* bins are placed over the centroid bounds, not the node bounds */
+  glm::vec3 centroid_min = glm::vec3(FLT_MAX);
+  glm::vec3 centroid_max = glm::vec3(-FLT_MAX);
+  if (is_parallel) {
+    parallelFor(node.count, parallel_chunk_size,
+                [&](uint32_t begin, uint32_t end) {
+                  glm::vec3 chunk_min = glm::vec3(FLT_MAX);
+                  glm::vec3 chunk_max = glm::vec3(-FLT_MAX);
+                  for (uint32_t i = begin; i < end; ++i) {
+                    const glm::vec3 &centroid = primitives[first[i]].centroid;
+                    chunk_min = glm::min(chunk_min, centroid);
+                    chunk_max = glm::max(chunk_max, centroid);
+                  }
+                  std::lock_guard<std::mutex> lock(mutex);
+                  centroid_min = glm::min(centroid_min, chunk_min);
+                  centroid_max = glm::max(centroid_max, chunk_max);
+                });
+  } else {
+    for (uint32_t i = 0; i < node.count; ++i) {
+      centroid_min = glm::min(centroid_min, primitives[first[i]].centroid);
+      centroid_max = glm::max(centroid_max, primitives[first[i]].centroid);
+    }
+  }
+
+  BVHBins bins;
+  bins.count = std::min(bin_count, node.count);
+  bins.centroid_min = centroid_min;
+  glm::vec3 extent = centroid_max - centroid_min;
+  for (int axis = 0; axis < 3; ++axis) {
+    bins.bin_scale[axis] =
+        extent[axis] > 0.0f ? bins.count / extent[axis] : 0.0f;
+  }
+  emptyBins(&bins);
+
+  if (is_parallel) {
+    parallelFor(node.count, parallel_chunk_size,
+                [&](uint32_t begin, uint32_t end) {
+                  BVHBins chunk_bins = bins;
+                  fillBins(primitives, first, begin, end, &chunk_bins);
+                  std::lock_guard<std::mutex> lock(mutex);
+                  for (int axis = 0; axis < 3; ++axis) {
+                    for (uint32_t i = 0; i < bins.count; ++i) {
+                      growBin(&bins.bins[axis][i], chunk_bins.bins[axis][i]);
+                    }
+                  }
+                });
+  } else {
+    fillBins(primitives, first, 0, node.count, &bins);
+  }
+
+  float best_cost = FLT_MAX;
+  int best_axis = -1;
+  uint32_t best_split = 0;
+  for (int axis = 0; axis < 3; ++axis) {
+    if (extent[axis] <= 0.0f) {
+      continue;
+    }
+
+    float right_costs[bin_count];
+    BVHBin right;
+    emptyBin(&right);
+    for (uint32_t i = bins.count - 1; i > 0; --i) {
+      growBin(&right, bins.bins[axis][i]);
+      right_costs[i] = right.count > 0
+                           ? surfaceArea(right.bounds_min, right.bounds_max) *
+                                 right.count
+                           : FLT_MAX;
+    }
+
+    BVHBin left;
+    emptyBin(&left);
+    for (uint32_t i = 1; i < bins.count; ++i) {
+      growBin(&left, bins.bins[axis][i - 1]);
+      if (left.count == 0 || right_costs[i] == FLT_MAX) {
+        continue;
+      }
+
+      float cost =
+          surfaceArea(left.bounds_min, left.bounds_max) * left.count +
+          right_costs[i];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_split = i;
+      }
+    }
+  }
+
+  uint32_t left_count = 0;
+  if (best_axis == -1) {
+    /* every centroid is the same, split in the middle only to respect the
+     * leaf size */
+    if (node.count <= max_leaf_size) {
+      return false;
+    }
+    left_count = node.count / 2;
+  } else {
+    float parent_area = surfaceArea(node.bounds_min, node.bounds_max);
+    float leaf_cost = node.count * intersection_cost;
+    float split_cost = traversal_cost;
+    if (parent_area > 0.0f) {
+      split_cost += intersection_cost * best_cost / parent_area;
+    }
+    if (split_cost >= leaf_cost && node.count <= max_leaf_size) {
+      return false;
+    }
+
+    uint32_t *middle =
+        std::partition(first, first + node.count, [&](uint32_t index) {
+          return binIndex(bins, primitives[index], best_axis) < best_split;
+        });
+    left_count = middle - first;
+  }
+
+  BVHNode left = {};
+  left.left_first = node.left_first;
+  left.count = left_count;
+  BVHNode right = {};
+  right.left_first = node.left_first + left_count;
+  right.count = node.count - left_count;
+  if (best_axis == -1) {
+    updateNodeBounds(primitives, build->bvh->primitive_indices, &left);
+    updateNodeBounds(primitives, build->bvh->primitive_indices, &right);
+  } else {
+    BVHBin left_bin;
+    emptyBin(&left_bin);
+    BVHBin right_bin;
+    emptyBin(&right_bin);
+    for (uint32_t i = 0; i < bins.count; ++i) {
+      growBin(i < best_split ? &left_bin : &right_bin,
+              bins.bins[best_axis][i]);
+    }
+    left.bounds_min = left_bin.bounds_min;
+    left.bounds_max = left_bin.bounds_max;
+    right.bounds_min = right_bin.bounds_min;
+    right.bounds_max = right_bin.bounds_max;
+  }
+
+  uint32_t left_index = build->node_count.fetch_add(2);
+  build->bvh->nodes[left_index] = left;
+  build->bvh->nodes[left_index + 1] = right;
+  build->bvh->nodes[node_index].left_first = left_index;
+  build->bvh->nodes[node_index].count = 0;
+
+  *out_left_index = left_index;
+
+  return true;
+}
+
+static void buildBinnedSubtree(BinnedBuild *build, uint32_t root_index) {
+  std::vector<uint32_t> node_stack;
+  node_stack.emplace_back(root_index);
+
+  while (!node_stack.empty()) {
+    uint32_t node_index = node_stack.back();
+    node_stack.pop_back();
+
+    uint32_t left_index;
+    if (!splitBinnedNode(build, node_index, &left_index)) {
+      continue;
+    }
+
+    for (uint32_t child = left_index; child < left_index + 2; ++child) {
+      if (build->bvh->nodes[child].count >= parallel_subtree_size) {
+        submitThreadPoolTask(&build->group, [build, child] {
+          buildBinnedSubtree(build, child);
+        });
+      } else {
+        node_stack.emplace_back(child);
+      }
+    }
+  }
+}
+
+static void buildBVHBinned(const std::vector<BVHPrimitive> &primitives,
+                           BVH *out_bvh) {
+  const uint32_t primitive_count = primitives.size();
+
+  out_bvh->primitive_indices.resize(primitive_count);
+  std::iota(out_bvh->primitive_indices.begin(),
+            out_bvh->primitive_indices.end(), 0);
+  out_bvh->nodes.resize(primitive_count * 2 - 1);
+
+  BVHNode &root = out_bvh->nodes[0];
+  root.left_first = 0;
+  root.count = primitive_count;
+  updateNodeBounds(primitives, out_bvh->primitive_indices, &root);
+
+  BinnedBuild build;
+  build.primitives = &primitives;
+  build.bvh = out_bvh;
+  build.node_count = 1;
+
+  buildBinnedSubtree(&build, 0);
+  waitThreadPoolGroup(&build.group);
+
+  out_bvh->nodes.resize(build.node_count);
+}
+
+/* spreads the low 10 bits of v so there are two zero bits between each */
+static uint32_t expandMortonBits(uint32_t v) {
+  v &= 0x3ff;
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+static uint32_t mortonCode(glm::vec3 position) {
+  uint32_t x = glm::clamp(position.x * 1024.0f, 0.0f, 1023.0f);
+  uint32_t y = glm::clamp(position.y * 1024.0f, 0.0f, 1023.0f);
+  uint32_t z = glm::clamp(position.z * 1024.0f, 0.0f, 1023.0f);
+  return (expandMortonBits(x) << 2) | (expandMortonBits(y) << 1) |
+         expandMortonBits(z);
+}
+
+/* LSD radix sort on the upper 32 bits, stable so equal codes keep their
+ * primitive order */
+static void sortMortonKeys(std::vector<uint64_t> *keys) {
+  const uint32_t radix_bits = 8;
+  const uint32_t radix_size = 1 << radix_bits;
+  const uint32_t count = keys->size();
+  const uint32_t chunk_count =
+      (count + parallel_chunk_size - 1) / parallel_chunk_size;
+
+  std::vector<uint64_t> temp_keys;
+  temp_keys.resize(count);
+  std::vector<uint32_t> offsets;
+  offsets.resize(chunk_count * radix_size);
+
+  uint64_t *source = keys->data();
+  uint64_t *dest = temp_keys.data();
+  for (uint32_t shift = 32; shift < 64; shift += radix_bits) {
+    std::fill(offsets.begin(), offsets.end(), 0);
+    parallelFor(count, parallel_chunk_size, [&](uint32_t begin, uint32_t end) {
+      uint32_t *histogram = &offsets[(begin / parallel_chunk_size) * radix_size];
+      for (uint32_t i = begin; i < end; ++i) {
+        histogram[(source[i] >> shift) & (radix_size - 1)]++;
+      }
+    });
+
+    /* exclusive scan by digit first, then chunk, to keep the sort stable */
+    uint32_t sum = 0;
+    for (uint32_t digit = 0; digit < radix_size; ++digit) {
+      for (uint32_t chunk = 0; chunk < chunk_count; ++chunk) {
+        uint32_t &offset = offsets[chunk * radix_size + digit];
+        uint32_t digit_count = offset;
+        offset = sum;
+        sum += digit_count;
+      }
+    }
+
+    parallelFor(count, parallel_chunk_size, [&](uint32_t begin, uint32_t end) {
+      uint32_t *offset = &offsets[(begin / parallel_chunk_size) * radix_size];
+      for (uint32_t i = begin; i < end; ++i) {
+        dest[offset[(source[i] >> shift) & (radix_size - 1)]++] = source[i];
+      }
+    });
+
+    std::swap(source, dest);
+  }
+
+  /* an even number of passes leaves the result back in keys */
+}
+
+struct LBVHBuild {
+  const std::vector<BVHPrimitive> *primitives;
+  std::vector<uint32_t> codes;
+  BVH *bvh;
+  std::atomic<uint32_t> node_count;
+};
+
+/* returns the last index of the left half, Karras 2012 */
+static uint32_t findLBVHSplit(const std::vector<uint32_t> &codes,
+                              uint32_t first, uint32_t last) {
+  uint32_t first_code = codes[first];
+  uint32_t last_code = codes[last];
+  if (first_code == last_code) {
+    return (first + last) / 2;
+  }
+
+  uint32_t common_prefix = __builtin_clz(first_code ^ last_code);
+
+  /* binary search for the last code sharing more than the common prefix */
+  uint32_t split = first;
+  uint32_t step = last - first;
+  do {
+    step = (step + 1) / 2;
+    uint32_t new_split = split + step;
+    if (new_split < last &&
+        __builtin_clz(first_code ^ codes[new_split]) > common_prefix) {
+      split = new_split;
+    }
+  } while (step > 1);
+
+  return split;
+}
+
+static void buildLBVHNode(LBVHBuild *build, uint32_t node_index,
+                          uint32_t first, uint32_t count) {
+  BVHNode &node = build->bvh->nodes[node_index];
+  if (count <= lbvh_leaf_size) {
+    node.left_first = first;
+    node.count = count;
+    updateNodeBounds(*build->primitives, build->bvh->primitive_indices, &node);
+    return;
+  }
+
+  uint32_t split = findLBVHSplit(build->codes, first, first + count - 1);
+  uint32_t left_count = split - first + 1;
+  uint32_t left_index = build->node_count.fetch_add(2);
+
+  /* children are finished before the parent takes their bounds */
+  if (count >= parallel_subtree_size) {
+    ThreadPoolGroup group;
+    submitThreadPoolTask(&group, [build, left_index, first, left_count] {
+      buildLBVHNode(build, left_index, first, left_count);
+    });
+    buildLBVHNode(build, left_index + 1, split + 1, count - left_count);
+    waitThreadPoolGroup(&group);
+  } else {
+    buildLBVHNode(build, left_index, first, left_count);
+    buildLBVHNode(build, left_index + 1, split + 1, count - left_count);
+  }
+
+  const BVHNode &left = build->bvh->nodes[left_index];
+  const BVHNode &right = build->bvh->nodes[left_index + 1];
+  node.left_first = left_index;
+  node.count = 0;
+  node.bounds_min = glm::min(left.bounds_min, right.bounds_min);
+  node.bounds_max = glm::max(left.bounds_max, right.bounds_max);
+}
+
+void calculateMortonQuantization(const std::vector<BVHPrimitive> &primitives,
+                                 glm::vec3 *out_origin,
+                                 glm::vec3 *out_inv_extent) {
+  std::mutex mutex;
+  glm::vec3 centroid_min = glm::vec3(FLT_MAX);
+  glm::vec3 centroid_max = glm::vec3(-FLT_MAX);
+  parallelFor(primitives.size(), parallel_chunk_size,
+              [&](uint32_t begin, uint32_t end) {
+                glm::vec3 chunk_min = glm::vec3(FLT_MAX);
+                glm::vec3 chunk_max = glm::vec3(-FLT_MAX);
+                for (uint32_t i = begin; i < end; ++i) {
+                  chunk_min = glm::min(chunk_min, primitives[i].centroid);
+                  chunk_max = glm::max(chunk_max, primitives[i].centroid);
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                centroid_min = glm::min(centroid_min, chunk_min);
+                centroid_max = glm::max(centroid_max, chunk_max);
+              });
+
+  glm::vec3 extent = centroid_max - centroid_min;
+  glm::vec3 inv_extent = glm::vec3(0.0f);
+  for (int axis = 0; axis < 3; ++axis) {
+    if (extent[axis] > 0.0f) {
+      inv_extent[axis] = 1.0f / extent[axis];
+    }
+  }
+
+  *out_origin = centroid_min;
+  *out_inv_extent = inv_extent;
+}
+
+/* sorts the primitives along a Morton curve over their centroid bounds,
+ * equal codes keep their primitive order */
+static void sortLBVHPrimitives(const std::vector<BVHPrimitive> &primitives,
+                               std::vector<uint32_t> *out_codes,
+                               std::vector<uint32_t> *out_primitive_indices) {
+  const uint32_t primitive_count = primitives.size();
+
+  glm::vec3 centroid_min;
+  glm::vec3 inv_extent;
+  calculateMortonQuantization(primitives, &centroid_min, &inv_extent);
+
+  /* the code goes in the upper half so sorting the keys sorts the indices
+   * along with it */
+  std::vector<uint64_t> keys;
+  keys.resize(primitive_count);
+  parallelFor(primitive_count, parallel_chunk_size,
+              [&](uint32_t begin, uint32_t end) {
+                for (uint32_t i = begin; i < end; ++i) {
+                  glm::vec3 position =
+                      (primitives[i].centroid - centroid_min) * inv_extent;
+                  keys[i] = ((uint64_t)mortonCode(position) << 32) | i;
+                }
+              });
+  sortMortonKeys(&keys);
+
+  out_codes->resize(primitive_count);
+  out_primitive_indices->resize(primitive_count);
+  parallelFor(primitive_count, parallel_chunk_size,
+              [&](uint32_t begin, uint32_t end) {
+                for (uint32_t i = begin; i < end; ++i) {
+                  (*out_codes)[i] = keys[i] >> 32;
+                  (*out_primitive_indices)[i] = (uint32_t)keys[i];
+                }
+              });
+}
+
+static void buildBVHLBVH(const std::vector<BVHPrimitive> &primitives,
+                         BVH *out_bvh) {
+  const uint32_t primitive_count = primitives.size();
+
+  LBVHBuild build;
+  build.primitives = &primitives;
+  build.bvh = out_bvh;
+  build.node_count = 1;
+  sortLBVHPrimitives(primitives, &build.codes, &out_bvh->primitive_indices);
+
+  out_bvh->nodes.resize(primitive_count * 2 - 1);
+  buildLBVHNode(&build, 0, 0, primitive_count);
+  out_bvh->nodes.resize(build.node_count);
+}
+
+/* length of the common prefix of the sorted codes at i and j, ties are broken
+ * by the indices so every code is unique. -1 when j is out of range */
+static int lbvhDelta(const std::vector<uint32_t> &codes, uint32_t i, int j) {
+  if (j < 0 || j >= (int)codes.size()) {
+    return -1;
+  }
+  if (codes[i] == codes[j]) {
+    return 32 + __builtin_clz(i ^ (uint32_t)j);
+  }
+
+  return __builtin_clz(codes[i] ^ codes[j]);
+}
+
+void buildLBVHReference(const std::vector<BVHPrimitive> &primitives,
+                        BVH *out_bvh) {
+  const uint32_t primitive_count = primitives.size();
+
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<uint32_t> codes;
+  sortLBVHPrimitives(primitives, &codes, &out_bvh->primitive_indices);
+
+  out_bvh->nodes.clear();
+  out_bvh->nodes.resize(primitive_count * 2 - 1);
+
+  /* Karras 2012, internal node i covers a range that starts or ends at i and
+   * splits after gamma. the children of the split gamma go to slots
+   * 2 * gamma + 1 and 2 * gamma + 2, so a node that ends at i is the left
+   * child of the split at i and one that starts at i the right child of the
+   * split at i - 1 */
+  for (uint32_t i = 0; i + 1 < primitive_count; ++i) {
+    int d = lbvhDelta(codes, i, i + 1) > lbvhDelta(codes, i, i - 1) ? 1 : -1;
+    int delta_min = lbvhDelta(codes, i, i - d);
+
+    uint32_t max_length = 2;
+    while (lbvhDelta(codes, i, i + max_length * d) > delta_min) {
+      max_length *= 2;
+    }
+    uint32_t length = 0;
+    for (uint32_t step = max_length / 2; step > 0; step /= 2) {
+      if (lbvhDelta(codes, i, i + (length + step) * d) > delta_min) {
+        length += step;
+      }
+    }
+
+    int delta_node = lbvhDelta(codes, i, i + length * d);
+    uint32_t split = 0;
+    uint32_t step = length;
+    do {
+      step = (step + 1) / 2;
+      if (lbvhDelta(codes, i, i + (split + step) * d) > delta_node) {
+        split += step;
+      }
+    } while (step > 1);
+    uint32_t gamma = i + split * d + std::min(d, 0);
+
+    uint32_t slot = i == 0 ? 0 : (d > 0 ? 2 * i : 2 * i + 1);
+    out_bvh->nodes[slot].left_first = 2 * gamma + 1;
+    out_bvh->nodes[slot].count = 0;
+  }
+
+  /* leaf j hangs off whichever neighbouring split is deeper in the tree,
+   * it keeps the primitive index so nothing has to be reordered */
+  for (uint32_t j = 0; j < primitive_count; ++j) {
+    uint32_t slot = lbvhDelta(codes, j, j + 1) > lbvhDelta(codes, j, j - 1)
+                        ? 2 * j + 1
+                        : 2 * j;
+    out_bvh->nodes[slot].left_first = out_bvh->primitive_indices[j];
+    out_bvh->nodes[slot].count = 1;
+  }
+
+  std::vector<uint32_t> dirty_nodes;
+  refitBVH(primitives, out_bvh, &dirty_nodes);
+
+  out_bvh->build_time_ms = std::chrono::duration<float, std::milli>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+  out_bvh->build_cost = calculateBVHCost(out_bvh);
+}
+
+uint32_t compareBVHNodes(const std::vector<BVHNode> &nodes,
+                         const std::vector<BVHNode> &reference_nodes,
+                         uint32_t *out_first_mismatch) {
+  uint32_t mismatch_count = 0;
+  *out_first_mismatch = UINT32_MAX;
+  for (uint32_t i = 0; i < std::max(nodes.size(), reference_nodes.size());
+       ++i) {
+    if (i < nodes.size() && i < reference_nodes.size()) {
+      const BVHNode &node = nodes[i];
+      const BVHNode &reference = reference_nodes[i];
+      if (node.left_first == reference.left_first &&
+          node.count == reference.count &&
+          node.bounds_min == reference.bounds_min &&
+          node.bounds_max == reference.bounds_max) {
+        continue;
+      }
+    }
+
+    if (mismatch_count == 0) {
+      *out_first_mismatch = i;
+    }
+    mismatch_count++;
+  }
+
+  return mismatch_count;
+}
+
+const char *getBVHBuilderName(BVHBuilder builder) {
+  return bvh_builder_names[builder];
+}
+
+bool findBVHBuilder(const char *name, BVHBuilder *out_builder) {
+  for (uint32_t i = 0; i < BVH_BUILDER_COUNT; ++i) {
+    if (strcmp(name, bvh_builder_names[i]) == 0) {
+      *out_builder = (BVHBuilder)i;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static uint32_t calculateBVHDepth(const std::vector<BVHNode> &nodes) {
+  uint32_t max_depth = 0;
+  std::vector<std::pair<uint32_t, uint32_t>> node_stack;
+  node_stack.emplace_back(0, 0);
+  while (!node_stack.empty()) {
+    uint32_t node_index = node_stack.back().first;
+    uint32_t depth = node_stack.back().second;
+    node_stack.pop_back();
+    max_depth = std::max(max_depth, depth);
+
+    const BVHNode &node = nodes[node_index];
+    if (node.count == 0) {
+      node_stack.emplace_back(node.left_first, depth + 1);
+      node_stack.emplace_back(node.left_first + 1, depth + 1);
+    }
+  }
+
+  return max_depth;
+}
+
+bool buildBVH(const std::vector<BVHPrimitive> &primitives, BVHBuilder builder,
+              BVH *out_bvh) {
+  if (primitives.empty()) {
+    ERROR("Can't build a BVH without primitives!");
+    return false;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  switch (builder) {
+  case BVH_BUILDER_SWEEP_SAH: {
+    buildBVHSweep(primitives, out_bvh);
+  } break;
+  case BVH_BUILDER_BINNED_SAH: {
+    buildBVHBinned(primitives, out_bvh);
+  } break;
+  case BVH_BUILDER_LBVH: {
+    buildBVHLBVH(primitives, out_bvh);
+  } break;
+  default: {
+    ERROR("Unknown BVH builder %d!", builder);
+    return false;
+  } break;
+  }
+
+  out_bvh->build_time_ms = std::chrono::duration<float, std::milli>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+  out_bvh->build_cost = calculateBVHCost(out_bvh);
+  out_bvh->max_depth = calculateBVHDepth(out_bvh->nodes);
+
+  /* traversal leaves at most the far sibling of every level on its stack,
+   * plus both children of the deepest interior node */
+  if (out_bvh->max_depth + 1 > bvh_stack_size) {
+    ERROR("A BVH %u levels deep overflows the traversal stack of %u!",
+          out_bvh->max_depth, bvh_stack_size);
+    return false;
+  }
+
+  return true;
+}
+
+void refitBVH(const std::vector<BVHPrimitive> &primitives, BVH *bvh,
+              std::vector<uint32_t> *out_dirty_nodes) {
+  if (bvh->nodes.empty()) {
+    return;
+  }
+
+  /* a reversed pre-order visits every child before its parent */
+  std::vector<uint32_t> order;
+  order.reserve(bvh->nodes.size());
+  std::vector<uint32_t> node_stack;
+  node_stack.emplace_back(0);
+  while (!node_stack.empty()) {
+    uint32_t node_index = node_stack.back();
+    node_stack.pop_back();
+    order.emplace_back(node_index);
+
+    const BVHNode &node = bvh->nodes[node_index];
+    if (node.count == 0) {
+      node_stack.emplace_back(node.left_first);
+      node_stack.emplace_back(node.left_first + 1);
+    }
+  }
+
+  for (uint32_t i = order.size(); i > 0; --i) {
+    uint32_t node_index = order[i - 1];
+    BVHNode &node = bvh->nodes[node_index];
+
+    glm::vec3 bounds_min = glm::vec3(FLT_MAX);
+    glm::vec3 bounds_max = glm::vec3(-FLT_MAX);
+    if (node.count > 0) {
+      for (uint32_t j = 0; j < node.count; ++j) {
+        const BVHPrimitive &primitive = primitives[node.left_first + j];
+        bounds_min = glm::min(bounds_min, primitive.bounds_min);
+        bounds_max = glm::max(bounds_max, primitive.bounds_max);
+      }
+    } else {
+      const BVHNode &left = bvh->nodes[node.left_first];
+      const BVHNode &right = bvh->nodes[node.left_first + 1];
+      bounds_min = glm::min(left.bounds_min, right.bounds_min);
+      bounds_max = glm::max(left.bounds_max, right.bounds_max);
+    }
+
+    if (bounds_min != node.bounds_min || bounds_max != node.bounds_max) {
+      node.bounds_min = bounds_min;
+      node.bounds_max = bounds_max;
+      out_dirty_nodes->emplace_back(node_index);
+    }
+  }
+}
+
+float calculateBVHCost(BVH *bvh) {
+  if (bvh->nodes.empty()) {
+    return 0.0f;
+  }
+
+  const BVHNode &root = bvh->nodes[0];
+  float root_area = surfaceArea(root.bounds_min, root.bounds_max);
+  if (root_area <= 0.0f) {
+    return 0.0f;
+  }
+
+  float cost = 0.0f;
+  for (uint32_t i = 0; i < bvh->nodes.size(); ++i) {
+    const BVHNode &node = bvh->nodes[i];
+    float area = surfaceArea(node.bounds_min, node.bounds_max) / root_area;
+    if (node.count == 0) {
+      cost += area * traversal_cost;
+    } else {
+      cost += area * node.count * intersection_cost;
+    }
+  }
+
+  return cost;
+}
+
+/* opening the largest interior child first keeps the children of a wide node
+ * close in size */
+static void collapseBVHNode(const BVH &bvh, uint32_t node_index,
+                            uint32_t *out_children,
+                            uint32_t *out_child_count) {
+  const BVHNode &node = bvh.nodes[node_index];
+  if (node.count > 0) {
+    out_children[0] = node_index;
+    *out_child_count = 1;
+    return;
+  }
+
+  out_children[0] = node.left_first;
+  out_children[1] = node.left_first + 1;
+  uint32_t child_count = 2;
+  while (child_count < compressed_bvh_width) {
+    int best_child = -1;
+    float best_area = -1.0f;
+    for (uint32_t i = 0; i < child_count; ++i) {
+      const BVHNode &child = bvh.nodes[out_children[i]];
+      if (child.count > 0) {
+        continue;
+      }
+
+      float area = surfaceArea(child.bounds_min, child.bounds_max);
+      if (area > best_area) {
+        best_area = area;
+        best_child = i;
+      }
+    }
+    if (best_child == -1) {
+      break;
+    }
+
+    uint32_t left = bvh.nodes[out_children[best_child]].left_first;
+    out_children[best_child] = left;
+    out_children[child_count++] = left + 1;
+  }
+
+  *out_child_count = child_count;
+}
+
+/* the GPU decodes origin + q * scale, which rounds once more, so the steps
+ * are moved outwards until they cover the child */
+static bool quantizeBounds(float origin, float scale, float bounds_min,
+                           float bounds_max, uint32_t *out_min,
+                           uint32_t *out_max) {
+  float quantized_min = floorf((bounds_min - origin) / scale);
+  float quantized_max = ceilf((bounds_max - origin) / scale);
+  quantized_min = std::max(quantized_min, 0.0f);
+  while (quantized_min > 0.0f && origin + quantized_min * scale > bounds_min) {
+    quantized_min -= 1.0f;
+  }
+  while (quantized_max <= 255.0f &&
+         origin + quantized_max * scale < bounds_max) {
+    quantized_max += 1.0f;
+  }
+  if (quantized_max > 255.0f) {
+    return false;
+  }
+
+  *out_min = (uint32_t)quantized_min;
+  *out_max = (uint32_t)quantized_max;
+  return true;
+}
+
+static void quantizeCompressedBVHNode(const std::vector<BVHNode> &nodes,
+                                      const uint32_t *source_nodes,
+                                      CompressedBVHNode *node) {
+  glm::vec3 bounds_min = glm::vec3(FLT_MAX);
+  glm::vec3 bounds_max = glm::vec3(-FLT_MAX);
+  for (uint32_t i = 0; i < compressed_bvh_width; ++i) {
+    if (source_nodes[i] == UINT32_MAX) {
+      continue;
+    }
+    bounds_min = glm::min(bounds_min, nodes[source_nodes[i]].bounds_min);
+    bounds_max = glm::max(bounds_max, nodes[source_nodes[i]].bounds_max);
+  }
+  node->origin = bounds_min;
+
+  uint32_t exponents = 0;
+  for (uint32_t axis = 0; axis < 3; ++axis) {
+    /* the smallest power of two that spans the node in 255 steps, denormal
+     * scales are skipped so the shader can build them from the bits */
+    int exponent = 0;
+    frexpf((bounds_max[axis] - bounds_min[axis]) / 255.0f, &exponent);
+    uint32_t biased_exponent = std::clamp(exponent + 127, 1, 254);
+
+    for (;; ++biased_exponent) {
+      float scale = ldexpf(1.0f, (int)biased_exponent - 127);
+      node->quantized_min[axis] = 0;
+      node->quantized_max[axis] = 0;
+
+      bool fits = true;
+      for (uint32_t i = 0; i < compressed_bvh_width && fits; ++i) {
+        /* empty children get inverted bounds so they can never be hit */
+        uint32_t child_min = 0xFF;
+        uint32_t child_max = 0;
+        if (source_nodes[i] != UINT32_MAX) {
+          const BVHNode &child = nodes[source_nodes[i]];
+          fits = quantizeBounds(bounds_min[axis], scale,
+                                child.bounds_min[axis],
+                                child.bounds_max[axis], &child_min,
+                                &child_max);
+        }
+        node->quantized_min[axis] |= child_min << (i * 8);
+        node->quantized_max[axis] |= child_max << (i * 8);
+      }
+      if (fits || biased_exponent == 254) {
+        break;
+      }
+    }
+
+    exponents |= biased_exponent << (axis * 8);
+  }
+
+  node->exponents_codes = (node->exponents_codes & 0xFF000000) | exponents;
+}
+
+bool buildCompressedBVH(BVH *bvh, CompressedBVH *out_compressed_bvh) {
+  out_compressed_bvh->nodes.clear();
+  out_compressed_bvh->source_nodes.clear();
+  out_compressed_bvh->max_depth = 0;
+  if (bvh->nodes.empty()) {
+    return true;
+  }
+
+  std::vector<uint32_t> primitive_indices;
+  primitive_indices.reserve(bvh->primitive_indices.size());
+
+  /* wide nodes are laid out breadth first, so the internal children of each
+   * one can be reserved as a block when it is visited. every entry is the
+   * wide node and the binary node it collapses */
+  std::vector<std::pair<uint32_t, uint32_t>> queue;
+  queue.emplace_back(0, 0);
+  /* the depth of every queued wide node */
+  std::vector<uint32_t> depths;
+  depths.emplace_back(0);
+  out_compressed_bvh->nodes.resize(1);
+  out_compressed_bvh->source_nodes.resize(compressed_bvh_width);
+
+  for (uint32_t head = 0; head < queue.size(); ++head) {
+    uint32_t wide_index = queue[head].first;
+    uint32_t children[compressed_bvh_width];
+    uint32_t child_count = 0;
+    collapseBVHNode(*bvh, queue[head].second, children, &child_count);
+
+    CompressedBVHNode node = {};
+    uint32_t child_base = out_compressed_bvh->nodes.size();
+    if (child_base + child_count > (1 << 24)) {
+      ERROR("Too many nodes for a compressed BVH!");
+      return false;
+    }
+    node.primitive_base = primitive_indices.size();
+
+    uint32_t codes = 0;
+    uint32_t internal_count = 0;
+    uint32_t *source_nodes =
+        &out_compressed_bvh->source_nodes[wide_index * compressed_bvh_width];
+    for (uint32_t i = 0; i < compressed_bvh_width; ++i) {
+      uint32_t code = COMPRESSED_BVH_CHILD_EMPTY;
+      source_nodes[i] = UINT32_MAX;
+      if (i < child_count) {
+        BVHNode &child = bvh->nodes[children[i]];
+        source_nodes[i] = children[i];
+        if (child.count == 0) {
+          code = COMPRESSED_BVH_CHILD_INTERNAL;
+          queue.emplace_back(child_base + internal_count++, children[i]);
+          depths.emplace_back(depths[head] + 1);
+        } else if (child.count <= compressed_bvh_max_leaf_size) {
+          code = child.count - 1;
+          uint32_t left_first = primitive_indices.size();
+          for (uint32_t j = 0; j < child.count; ++j) {
+            primitive_indices.emplace_back(
+                bvh->primitive_indices[child.left_first + j]);
+          }
+          child.left_first = left_first;
+        } else {
+          ERROR("A compressed BVH leaf holds at most %u primitives!",
+                compressed_bvh_max_leaf_size);
+          return false;
+        }
+      }
+      codes |= code << (i * 4);
+    }
+
+    node.exponents_codes = (codes & 0xFF) << 24;
+    node.child_base_codes = child_base | (codes >> 8) << 24;
+    quantizeCompressedBVHNode(bvh->nodes, source_nodes, &node);
+
+    out_compressed_bvh->nodes.resize(child_base + internal_count);
+    out_compressed_bvh->source_nodes.resize(
+        (child_base + internal_count) * compressed_bvh_width);
+    out_compressed_bvh->nodes[wide_index] = node;
+  }
+
+  bvh->primitive_indices = primitive_indices;
+
+  /* breadth first, so the last node queued is one of the deepest. traversal
+   * leaves at most 3 siblings of every level on its stack, plus the 4
+   * children of the deepest node that has internal ones */
+  out_compressed_bvh->max_depth = depths.back();
+  if (3 * out_compressed_bvh->max_depth + 1 > bvh_stack_size) {
+    ERROR("A compressed BVH %u levels deep overflows the traversal stack of "
+          "%u!",
+          out_compressed_bvh->max_depth, bvh_stack_size);
+    return false;
+  }
+
+  return true;
+}
+
+void refitCompressedBVH(const BVH &bvh, CompressedBVH *compressed_bvh,
+                        std::vector<uint32_t> *out_dirty_nodes) {
+  for (uint32_t i = 0; i < compressed_bvh->nodes.size(); ++i) {
+    CompressedBVHNode node = compressed_bvh->nodes[i];
+    quantizeCompressedBVHNode(
+        bvh.nodes, &compressed_bvh->source_nodes[i * compressed_bvh_width],
+        &node);
+    if (memcmp(&node, &compressed_bvh->nodes[i], sizeof(node)) != 0) {
+      compressed_bvh->nodes[i] = node;
+      out_dirty_nodes->emplace_back(i);
+    }
+  }
+}
+
+uint32_t getCompressedBVHNodeCapacity(uint32_t primitive_count) {
+  /* every node absorbs at least one binary interior node and only full nodes
+   * have internal children, which bounds them to a third of the 2n - 1 */
+  return std::max((2 * primitive_count + 1) / 3, 1u);
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include <stdint.h>
+#include <vector>
+
+/* matches the std430 layout of BVHNode in ray_tracing.glsl. interior nodes
+ * have count == 0 and their children are stored next to each other at
+ * left_first and left_first + 1, leaves reference count primitives starting
+ * at left_first */
+struct BVHNode {
+  glm::vec3 bounds_min;
+  uint32_t left_first;
+  glm::vec3 bounds_max;
+  uint32_t count;
+};
+
+/* matches the std430 layout of CompressedBVHNode in ray_tracing.glsl. a 4
+ * wide node that stores the bounds of its children as 8-bit steps of
+ * 2^exponent away from origin, rounded outwards. internal children are stored
+ * next to each other from child_base and the primitives of leaf children next
+ * to each other from primitive_base, both in child order. every child has a 4
+ * bit code, see CompressedBVHChildCode */
+struct CompressedBVHNode {
+  glm::vec3 origin;
+  /* biased exponents of x, y and z, the codes of children 0 and 1 on top */
+  uint32_t exponents_codes;
+  /* first internal child in the low 24 bits, the codes of children 2 and 3 on
+   * top */
+  uint32_t child_base_codes;
+  uint32_t primitive_base;
+  /* one byte per child, child 0 in the lowest */
+  uint32_t quantized_min[3];
+  uint32_t quantized_max[3];
+};
+
+const uint32_t compressed_bvh_width = 4;
+
+/* matches BVH_STACK_SIZE in ray_tracing.glsl. buildBVH and
+ * buildCompressedBVH fail on trees whose traversal would need a deeper stack
+ * instead of leaving the shaders to drop nodes */
+const uint32_t bvh_stack_size = 64;
+
+/* leaf children store their primitive count - 1 instead */
+enum CompressedBVHChildCode {
+  COMPRESSED_BVH_CHILD_INTERNAL = 0x8,
+  COMPRESSED_BVH_CHILD_EMPTY = 0xF
+};
+
+struct BVHPrimitive {
+  glm::vec3 bounds_min;
+  glm::vec3 bounds_max;
+  glm::vec3 centroid;
+};
+
+enum BVHBuilder {
+  /* sorts every axis and evaluates every split, best trees but slowest */
+  BVH_BUILDER_SWEEP_SAH,
+  /* SAH over centroid bins, large nodes and subtrees go to the thread pool */
+  BVH_BUILDER_BINNED_SAH,
+  /* sorted Morton codes split at their highest differing bit */
+  BVH_BUILDER_LBVH,
+  BVH_BUILDER_COUNT
+};
+
+struct BVH {
+  std::vector<BVHNode> nodes;
+  /* primitive order the leaves refer to */
+  std::vector<uint32_t> primitive_indices;
+  /* SAH cost right after the last full build, refits are compared to it */
+  float build_cost;
+  float build_time_ms;
+  /* edges from the root to the deepest leaf */
+  uint32_t max_depth;
+};
+
+struct CompressedBVH {
+  std::vector<CompressedBVHNode> nodes;
+  /* the binary node behind every child slot, UINT32_MAX for empty ones. lets
+   * a refit of the binary BVH be requantized without collapsing again */
+  std::vector<uint32_t> source_nodes;
+  /* edges from the root to the deepest wide node */
+  uint32_t max_depth;
+};
+
+const char *getBVHBuilderName(BVHBuilder builder);
+bool findBVHBuilder(const char *name, BVHBuilder *out_builder);
+
+bool buildBVH(const std::vector<BVHPrimitive> &primitives, BVHBuilder builder,
+              BVH *out_bvh);
+/* recomputes the bounds bottom-up while keeping the topology. primitives are
+ * expected in leaf order, the indices of nodes whose bounds changed are
+ * appended to out_dirty_nodes */
+void refitBVH(const std::vector<BVHPrimitive> &primitives, BVH *bvh,
+              std::vector<uint32_t> *out_dirty_nodes);
+float calculateBVHCost(BVH *bvh);
+
+/* collapses a binary BVH into 4 wide quantized nodes. the primitives of the
+ * leaves under each wide node are made contiguous by reordering
+ * bvh->primitive_indices and the left_first of its leaves, so both layouts
+ * keep working on the same primitive order */
+bool buildCompressedBVH(BVH *bvh, CompressedBVH *out_compressed_bvh);
+/* requantizes every node from the bounds of a refitted binary BVH, appending
+ * the indices of nodes that changed */
+void refitCompressedBVH(const BVH &bvh, CompressedBVH *compressed_bvh,
+                        std::vector<uint32_t> *out_dirty_nodes);
+/* the most nodes a collapse over primitive_count primitives can produce, a
+ * wide node with fewer than 4 children only has leaves under it */
+uint32_t getCompressedBVHNodeCapacity(uint32_t primitive_count);
+
+/* CPU version of the lbvh_*.comp build in the same node layout. every leaf
+ * holds one primitive and refers to it by its original index, the children
+ * of the split after sorted primitive i sit at 2 * i + 1 and 2 * i + 2 */
+void buildLBVHReference(const std::vector<BVHPrimitive> &primitives,
+                        BVH *out_bvh);
+/* the centroid bounds minimum and reciprocal extent Morton codes are
+ * quantized over. the GPU build takes them from here, a reciprocal computed
+ * in GLSL may be off by an ulp and move a centroid into the next cell */
+void calculateMortonQuantization(const std::vector<BVHPrimitive> &primitives,
+                                 glm::vec3 *out_origin,
+                                 glm::vec3 *out_inv_extent);
+/* returns how many nodes differ, a size difference counts every missing
+ * node */
+uint32_t compareBVHNodes(const std::vector<BVHNode> &nodes,
+                         const std::vector<BVHNode> &reference_nodes,
+                         uint32_t *out_first_mismatch);
@@ -0,0 +1,221 @@
+#include "environment_map.h"
+
+#include "logger.h"
+#include "thread_pool.h"
+
+#include "glm/gtc/constants.hpp"
+#include "stb/stb_image.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+/* bumped whenever the layout of the tables changes */
+static const uint32_t cache_version = 1;
+static const uint32_t cache_magic = 0x46444345; /* "ECDF" */
+/* rows per thread pool task */
+static const uint32_t row_chunk_size = 16;
+
+/* starts the cache file, the texel pdfs and the CDF follow */
+struct EnvironmentCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t hash;
+  uint32_t width;
+  uint32_t height;
+};
+
+static uint64_t hashBytes(const std::vector<uint8_t> &bytes) {
+  /* FNV-1a */
+  uint64_t hash = 14695981039346656037ull;
+  for (uint8_t byte : bytes) {
+    hash = (hash ^ byte) * 1099511628211ull;
+  }
+  return hash;
+}
+
+static bool readFile(const char *path, std::vector<uint8_t> *out_bytes) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return false;
+  }
+
+  fseek(file, 0, SEEK_END);
+  int64_t file_size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  out_bytes->resize(file_size);
+  bool read = file_size > 0 &&
+              fread(out_bytes->data(), file_size, 1, file) == 1;
+  fclose(file);
+  return read;
+}
+
+static uint64_t getCDFSize(uint32_t width, uint32_t height) {
+  return height + 1 + (uint64_t)height * (width + 1);
+}
+
+static float getLuminance(glm::vec4 texel) {
+  return glm::dot(glm::vec3(texel), glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+/* the solid angle of a texel shrinks toward the poles with sin(theta), so
+ * that weighs its luminance */
+static float getRowWeight(uint32_t row, uint32_t height) {
+  return sinf(glm::pi<float>() * (row + 0.5f) / height);
+}
+
+/* a sum of 0 leaves the values uniform */
+static void normalizeCDF(float *cdf, uint32_t count, double sum) {
+  for (uint32_t i = 1; i < count; ++i) {
+    cdf[i] = sum > 0.0 ? (float)(cdf[i] / sum) : (float)i / count;
+  }
+  cdf[count] = 1.0f;
+}
+
+static void buildEnvironmentTables(EnvironmentMap *map) {
+  const uint32_t width = map->width;
+  const uint32_t height = map->height;
+  map->cdf.resize(getCDFSize(width, height));
+  float *marginal = map->cdf.data();
+  float *conditionals = marginal + height + 1;
+
+  std::vector<double> row_sums(height);
+  parallelFor(height, row_chunk_size, [&](uint32_t begin, uint32_t end) {
+    for (uint32_t y = begin; y < end; ++y) {
+      const float row_weight = getRowWeight(y, height);
+      float *conditional = conditionals + (uint64_t)y * (width + 1);
+      double sum = 0.0;
+      conditional[0] = 0.0f;
+      for (uint32_t x = 0; x < width; ++x) {
+        sum += getLuminance(map->texels[y * width + x]) * row_weight;
+        conditional[x + 1] = (float)sum;
+      }
+      row_sums[y] = sum;
+      normalizeCDF(conditional, width, sum);
+    }
+  });
+
+  double total = 0.0;
+  marginal[0] = 0.0f;
+  for (uint32_t y = 0; y < height; ++y) {
+    total += row_sums[y];
+    marginal[y + 1] = (float)total;
+  }
+  normalizeCDF(marginal, height, total);
+
+  /* the chance of a texel times the texels in the unit square, an image
+   * without light is sampled uniformly */
+  const double texel_count = (double)width * height;
+  parallelFor(height, row_chunk_size, [&](uint32_t begin, uint32_t end) {
+    for (uint32_t y = begin; y < end; ++y) {
+      const float row_weight = getRowWeight(y, height);
+      for (uint32_t x = 0; x < width; ++x) {
+        glm::vec4 *texel = &map->texels[y * width + x];
+        texel->w = total > 0.0 ? (float)(getLuminance(*texel) * row_weight /
+                                         total * texel_count)
+                               : 1.0f;
+      }
+    }
+  });
+}
+
+static bool readEnvironmentCache(const char *path, uint64_t hash,
+                                 EnvironmentMap *map) {
+  std::vector<uint8_t> bytes;
+  if (!readFile(path, &bytes) ||
+      bytes.size() < sizeof(EnvironmentCacheHeader)) {
+    return false;
+  }
+
+  EnvironmentCacheHeader header;
+  memcpy(&header, bytes.data(), sizeof(EnvironmentCacheHeader));
+  const uint64_t texel_count = (uint64_t)map->width * map->height;
+  const uint64_t cdf_size = getCDFSize(map->width, map->height);
+  if (header.magic != cache_magic || header.version != cache_version ||
+      header.hash != hash || header.width != map->width ||
+      header.height != map->height ||
+      bytes.size() != sizeof(EnvironmentCacheHeader) +
+                          (texel_count + cdf_size) * sizeof(float)) {
+    return false;
+  }
+
+  const float *pdfs =
+      (const float *)(bytes.data() + sizeof(EnvironmentCacheHeader));
+  for (uint64_t i = 0; i < texel_count; ++i) {
+    map->texels[i].w = pdfs[i];
+  }
+  map->cdf.assign(pdfs + texel_count, pdfs + texel_count + cdf_size);
+  return true;
+}
+
+static bool writeEnvironmentCache(const char *path, uint64_t hash,
+                                  const EnvironmentMap *map) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    return false;
+  }
+
+  EnvironmentCacheHeader header = {};
+  header.magic = cache_magic;
+  header.version = cache_version;
+  header.hash = hash;
+  header.width = map->width;
+  header.height = map->height;
+
+  std::vector<float> pdfs(map->texels.size());
+  for (uint64_t i = 0; i < map->texels.size(); ++i) {
+    pdfs[i] = map->texels[i].w;
+  }
+
+  bool written =
+      fwrite(&header, sizeof(EnvironmentCacheHeader), 1, file) == 1 &&
+      fwrite(pdfs.data(), sizeof(float), pdfs.size(), file) == pdfs.size() &&
+      fwrite(map->cdf.data(), sizeof(float), map->cdf.size(), file) ==
+          map->cdf.size();
+  fclose(file);
+  return written;
+}
+
+bool loadEnvironmentMap(const char *path, EnvironmentMap *out_map) {
+  std::vector<uint8_t> bytes;
+  if (!readFile(path, &bytes)) {
+    ERROR("Failed to read environment map %s!", path);
+    return false;
+  }
+
+  int width, height, channel_count;
+  float *data = stbi_loadf_from_memory(bytes.data(), bytes.size(), &width,
+                                       &height, &channel_count, STBI_rgb);
+  if (!data) {
+    ERROR("Failed to decode environment map %s!", path);
+    return false;
+  }
+
+  out_map->width = width;
+  out_map->height = height;
+  out_map->texels.resize((uint64_t)width * height);
+  for (uint64_t i = 0; i < out_map->texels.size(); ++i) {
+    out_map->texels[i] =
+        glm::vec4(data[i * 3], data[i * 3 + 1], data[i * 3 + 2], 0.0f);
+  }
+  stbi_image_free(data);
+
+  /* the tables only depend on the image, so its hash is all the cache
+   * needs to be trusted */
+  const uint64_t hash = hashBytes(bytes);
+  const std::string cache_path = std::string(path) + ".cdf";
+  if (readEnvironmentCache(cache_path.c_str(), hash, out_map)) {
+    INFO("Environment map %s: %dx%d, tables read from %s", path, width,
+         height, cache_path.c_str());
+    return true;
+  }
+
+  buildEnvironmentTables(out_map);
+  if (!writeEnvironmentCache(cache_path.c_str(), hash, out_map)) {
+    WARN("Failed to write the environment map cache %s",
+         cache_path.c_str());
+  }
+  INFO("Environment map %s: %dx%d, tables built", path, width, height);
+  return true;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include <stdint.h>
+#include <vector>
+
+/* an equirectangular HDR image that replaces the sky and sun, with the
+ * tables next event estimation importance samples it by. row 0 looks
+ * straight up and the columns go around the vertical axis */
+struct EnvironmentMap {
+  uint32_t width;
+  uint32_t height;
+  /* matches EnvironmentTexels in ray_tracing.glsl. xyz - radiance, w - pdf
+   * of the texel over the unit square of the mapping */
+  std::vector<glm::vec4> texels;
+  /* matches EnvironmentCDF in ray_tracing.glsl. the marginal CDF over the
+   * rows, height + 1 values, then the conditional CDF of every row, width + 1
+   * values each */
+  std::vector<float> cdf;
+};
+
+/* loads a .hdr image and builds its tables, or reads them from the cache
+ * file next to it when that was built from the same bytes */
+bool loadEnvironmentMap(const char *path, EnvironmentMap *out_map);
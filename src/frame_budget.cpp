@@ -0,0 +1,126 @@
+#include "frame_budget.h"
+
+#include "logger.h"
+
+#include "glm/glm.hpp"
+#include <vector>
+
+/* how much a frame moves the estimate of the cost of a sample */
+static const float sample_cost_smoothing = 0.25f;
+
+bool createFrameBudget(VulkanDevice *device, uint32_t compute_family_index,
+                       FrameBudget *out_budget) {
+  out_budget->query_pool = VK_NULL_HANDLE;
+  out_budget->timestamp_period = 0.0f;
+  out_budget->timestamp_mask = 0;
+  out_budget->enabled = true;
+  out_budget->interactive_budget_ms = 16.0f;
+  out_budget->idle_budget_ms = 50.0f;
+  out_budget->idle_delay_ms = 500;
+  out_budget->gpu_time_ms = 0.0f;
+  out_budget->ms_per_sample = 0.0f;
+  out_budget->sample_count = 1;
+
+  uint32_t family_count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(device->physical_device,
+                                           &family_count, 0);
+  std::vector<VkQueueFamilyProperties> families(family_count);
+  vkGetPhysicalDeviceQueueFamilyProperties(device->physical_device,
+                                           &family_count, families.data());
+
+  uint32_t valid_bits = families[compute_family_index].timestampValidBits;
+  if (valid_bits == 0 || device->properties.limits.timestampPeriod == 0.0f) {
+    WARN("The compute queue can't write timestamps, frames are timed on the "
+         "CPU.");
+    return true;
+  }
+  out_budget->timestamp_period = device->properties.limits.timestampPeriod;
+  out_budget->timestamp_mask =
+      valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+
+  VkQueryPoolCreateInfo query_pool_create_info = {};
+  query_pool_create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  query_pool_create_info.pNext = 0;
+  query_pool_create_info.flags = 0;
+  query_pool_create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  query_pool_create_info.queryCount = 2;
+  query_pool_create_info.pipelineStatistics = 0;
+
+  if (vkCreateQueryPool(device->logical_device, &query_pool_create_info, 0,
+                        &out_budget->query_pool) != VK_SUCCESS) {
+    ERROR("Failed to create the frame timestamp query pool!");
+    return false;
+  }
+
+  return true;
+}
+
+void destroyFrameBudget(FrameBudget *budget, VulkanDevice *device) {
+  if (budget->query_pool != VK_NULL_HANDLE) {
+    vkDestroyQueryPool(device->logical_device, budget->query_pool, 0);
+  }
+}
+
+void recordFrameBudgetBegin(FrameBudget *budget,
+                            VkCommandBuffer command_buffer) {
+  if (budget->query_pool == VK_NULL_HANDLE) {
+    return;
+  }
+  vkCmdResetQueryPool(command_buffer, budget->query_pool, 0, 2);
+  vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      budget->query_pool, 0);
+}
+
+void recordFrameBudgetEnd(FrameBudget *budget, VkCommandBuffer command_buffer) {
+  if (budget->query_pool == VK_NULL_HANDLE) {
+    return;
+  }
+  vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      budget->query_pool, 1);
+}
+
+void updateFrameBudget(FrameBudget *budget, VulkanDevice *device,
+                       uint32_t frame_sample_count, float cpu_time_ms,
+                       bool idle) {
+  budget->gpu_time_ms = cpu_time_ms;
+  if (budget->query_pool != VK_NULL_HANDLE) {
+    uint64_t timestamps[2];
+    if (vkGetQueryPoolResults(device->logical_device, budget->query_pool, 0, 2,
+                              sizeof(timestamps), timestamps,
+                              sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT |
+                                  VK_QUERY_RESULT_WAIT_BIT) == VK_SUCCESS) {
+      uint64_t ticks =
+          (timestamps[1] - timestamps[0]) & budget->timestamp_mask;
+      budget->gpu_time_ms = ticks * budget->timestamp_period / 1000000.0f;
+    }
+  }
+
+  if (frame_sample_count == 0 || budget->gpu_time_ms <= 0.0f) {
+    return;
+  }
+
+  /* what the frame spends besides its samples counts toward them, which
+   * overestimates the cost of a sample while there are few of them and errs
+   * on the side of the budget */
+  float ms_per_sample = budget->gpu_time_ms / frame_sample_count;
+  budget->ms_per_sample =
+      budget->ms_per_sample > 0.0f
+          ? glm::mix(budget->ms_per_sample, ms_per_sample,
+                     sample_cost_smoothing)
+          : ms_per_sample;
+
+  if (!budget->enabled) {
+    budget->sample_count = frame_sample_count;
+    return;
+  }
+
+  /* dropping back to the interactive budget takes effect at once, growing
+   * is held to doubling a frame so a bad estimate can't stall the UI */
+  float budget_ms =
+      idle ? budget->idle_budget_ms : budget->interactive_budget_ms;
+  float samples = glm::floor(budget_ms / budget->ms_per_sample);
+  samples = glm::min(samples, 2.0f * frame_sample_count);
+  budget->sample_count = (uint32_t)glm::clamp(
+      samples, 1.0f, (float)frame_budget_max_samples);
+}
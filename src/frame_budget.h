@@ -0,0 +1,52 @@
+#pragma once
+
+#include "vulkan_device.h"
+
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+/* the samples per pixel a frame may take at most, so a cheap scene doesn't
+ * make a single frame of the whole accumulation */
+const uint32_t frame_budget_max_samples = 256;
+
+/* picks the samples per pixel of the next frame so the wavefront frame takes
+ * about budget_ms of GPU time. the frame is timed with a pair of timestamps
+ * around it on the compute queue, or on the CPU around the wait for it when
+ * the queue can't write timestamps */
+struct FrameBudget {
+  VkQueryPool query_pool;
+  /* nanoseconds per timestamp tick, 0 without timestamps */
+  float timestamp_period;
+  /* the bits a timestamp keeps, the rest is masked off */
+  uint64_t timestamp_mask;
+
+  bool enabled;
+  /* while the view changes, and once it has been still for idle_delay_ms
+   * for as much throughput as a frame rate the UI can still take */
+  float interactive_budget_ms;
+  float idle_budget_ms;
+  uint32_t idle_delay_ms;
+
+  /* the last measured frame, and the running estimate of what a sample costs
+   * that the count is picked from */
+  float gpu_time_ms;
+  float ms_per_sample;
+  uint32_t sample_count;
+};
+
+bool createFrameBudget(VulkanDevice *device, uint32_t compute_family_index,
+                       FrameBudget *out_budget);
+void destroyFrameBudget(FrameBudget *budget, VulkanDevice *device);
+
+/* record around the work that is timed, the frame has to be waited for
+ * before the next one is recorded */
+void recordFrameBudgetBegin(FrameBudget *budget,
+                            VkCommandBuffer command_buffer);
+void recordFrameBudgetEnd(FrameBudget *budget, VkCommandBuffer command_buffer);
+
+/* reads the time of the finished frame, cpu_time_ms standing in for it
+ * without timestamps, and picks the samples of the next from the budget the
+ * idleness calls for */
+void updateFrameBudget(FrameBudget *budget, VulkanDevice *device,
+                       uint32_t frame_sample_count, float cpu_time_ms,
+                       bool idle);
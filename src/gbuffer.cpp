@@ -0,0 +1,314 @@
+#include "gbuffer.h"
+
+#include "logger.h"
+#include "vulkan_common.h"
+
+static const char *gbuffer_pass_shader_paths[GBUFFER_PASS_COUNT][2] = {
+    {"assets/shaders/gbuffer_sphere.vert.spv",
+     "assets/shaders/gbuffer_sphere.frag.spv"},
+    {"assets/shaders/gbuffer_mesh.vert.spv",
+     "assets/shaders/gbuffer_mesh.frag.spv"}};
+
+/* the colour attachments in the order of the fragment shader outputs */
+static const uint32_t color_attachment_count = 3;
+
+const char *getGBufferPassShaderPath(GBufferPass pass,
+                                     VkShaderStageFlagBits stage) {
+  return gbuffer_pass_shader_paths[pass]
+                                  [stage == VK_SHADER_STAGE_FRAGMENT_BIT];
+}
+
+static VulkanTexture *getGBufferColorTexture(GBuffer *gbuffer,
+                                             uint32_t index) {
+  VulkanTexture *textures[color_attachment_count] = {
+      &gbuffer->position, &gbuffer->normal, &gbuffer->material};
+  return textures[index];
+}
+
+/* the colour attachments end up in the general layout the compute kernel
+ * reads them in, nothing of the last frame is kept */
+static bool createGBufferRenderPass(GBuffer *gbuffer, VulkanDevice *device) {
+  VkAttachmentDescription attachment_descriptions[color_attachment_count + 1] =
+      {};
+  VkAttachmentReference color_attachment_references[color_attachment_count] =
+      {};
+  for (uint32_t i = 0; i < color_attachment_count + 1; ++i) {
+    VkAttachmentDescription *description = &attachment_descriptions[i];
+    description->flags = 0;
+    description->samples = VK_SAMPLE_COUNT_1_BIT;
+    description->loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    description->storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    description->stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    description->stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    description->initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    description->finalLayout = VK_IMAGE_LAYOUT_GENERAL;
+    if (i < color_attachment_count) {
+      description->format = getGBufferColorTexture(gbuffer, i)->format;
+      color_attachment_references[i].attachment = i;
+      color_attachment_references[i].layout =
+          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
+  }
+
+  VkAttachmentDescription *depth_description =
+      &attachment_descriptions[color_attachment_count];
+  depth_description->format = gbuffer->depth.format;
+  depth_description->storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depth_description->finalLayout =
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  VkAttachmentReference depth_attachment_reference = {};
+  depth_attachment_reference.attachment = color_attachment_count;
+  depth_attachment_reference.layout =
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  VkSubpassDescription subpass_description = {};
+  subpass_description.flags = 0;
+  subpass_description.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass_description.inputAttachmentCount = 0;
+  subpass_description.pInputAttachments = 0;
+  subpass_description.colorAttachmentCount = color_attachment_count;
+  subpass_description.pColorAttachments = color_attachment_references;
+  subpass_description.pResolveAttachments = 0;
+  subpass_description.pDepthStencilAttachment = &depth_attachment_reference;
+  subpass_description.preserveAttachmentCount = 0;
+  subpass_description.pPreserveAttachments = 0;
+
+  /* the kernel of the last frame is done reading before the pass writes,
+   * and the writes are visible to the kernel of this one */
+  VkSubpassDependency subpass_dependencies[2] = {};
+  subpass_dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  subpass_dependencies[0].dstSubpass = 0;
+  subpass_dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  subpass_dependencies[0].srcAccessMask = 0;
+  subpass_dependencies[0].dstStageMask =
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+      VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+  subpass_dependencies[0].dstAccessMask =
+      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  subpass_dependencies[0].dependencyFlags = 0;
+  subpass_dependencies[1].srcSubpass = 0;
+  subpass_dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+  subpass_dependencies[1].srcStageMask =
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  subpass_dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  subpass_dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  subpass_dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  subpass_dependencies[1].dependencyFlags = 0;
+
+  VkRenderPassCreateInfo render_pass_create_info = {};
+  render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  render_pass_create_info.pNext = 0;
+  render_pass_create_info.flags = 0;
+  render_pass_create_info.attachmentCount = color_attachment_count + 1;
+  render_pass_create_info.pAttachments = attachment_descriptions;
+  render_pass_create_info.subpassCount = 1;
+  render_pass_create_info.pSubpasses = &subpass_description;
+  render_pass_create_info.dependencyCount = 2;
+  render_pass_create_info.pDependencies = subpass_dependencies;
+
+  VK_CHECK(vkCreateRenderPass(device->logical_device, &render_pass_create_info,
+                              0, &gbuffer->render_pass));
+
+  return true;
+}
+
+bool createGBuffer(VulkanDevice *device, VmaAllocator vma_allocator,
+                   uint32_t width, uint32_t height, GBuffer *out_gbuffer) {
+  out_gbuffer->width = width;
+  out_gbuffer->height = height;
+
+  const VkImageUsageFlags color_usage =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+  if (!createTexture(device, vma_allocator, VK_FORMAT_R32G32B32A32_SFLOAT,
+                     width, height, 1, color_usage, &out_gbuffer->position) ||
+      !createTexture(device, vma_allocator, VK_FORMAT_R32G32B32A32_SFLOAT,
+                     width, height, 1, color_usage, &out_gbuffer->normal) ||
+      !createTexture(device, vma_allocator, VK_FORMAT_R32G32B32A32_UINT,
+                     width, height, 1, color_usage, &out_gbuffer->material) ||
+      !createTexture(device, vma_allocator, VK_FORMAT_D32_SFLOAT, width,
+                     height, 1, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+                     &out_gbuffer->depth)) {
+    ERROR("Failed to create the G-buffer images!");
+    return false;
+  }
+
+  if (!createGBufferRenderPass(out_gbuffer, device)) {
+    ERROR("Failed to create the G-buffer render pass!");
+    return false;
+  }
+
+  VkImageView attachments[color_attachment_count + 1] = {
+      out_gbuffer->position.view, out_gbuffer->normal.view,
+      out_gbuffer->material.view, out_gbuffer->depth.view};
+
+  VkFramebufferCreateInfo framebuffer_create_info = {};
+  framebuffer_create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebuffer_create_info.pNext = 0;
+  framebuffer_create_info.flags = 0;
+  framebuffer_create_info.renderPass = out_gbuffer->render_pass;
+  framebuffer_create_info.attachmentCount = color_attachment_count + 1;
+  framebuffer_create_info.pAttachments = attachments;
+  framebuffer_create_info.width = width;
+  framebuffer_create_info.height = height;
+  framebuffer_create_info.layers = 1;
+
+  VK_CHECK(vkCreateFramebuffer(device->logical_device, &framebuffer_create_info,
+                               0, &out_gbuffer->framebuffer));
+
+  return true;
+}
+
+void destroyGBuffer(GBuffer *gbuffer, VulkanDevice *device,
+                    VmaAllocator vma_allocator) {
+  for (uint32_t i = 0; i < GBUFFER_PASS_COUNT; ++i) {
+    destroyPipeline(&gbuffer->pipelines[i], device);
+  }
+  vkDestroyFramebuffer(device->logical_device, gbuffer->framebuffer, 0);
+  vkDestroyRenderPass(device->logical_device, gbuffer->render_pass, 0);
+  destroyTexture(&gbuffer->position, device, vma_allocator);
+  destroyTexture(&gbuffer->normal, device, vma_allocator);
+  destroyTexture(&gbuffer->material, device, vma_allocator);
+  destroyTexture(&gbuffer->depth, device, vma_allocator);
+}
+
+static float getHaltonValue(uint32_t index, uint32_t base) {
+  float value = 0.0f;
+  float scale = 1.0f;
+  while (index > 0) {
+    scale /= base;
+    value += scale * (index % base);
+    index /= base;
+  }
+  return value;
+}
+
+glm::vec2 getGBufferJitter(uint32_t frame) {
+  /* the sequence starts at 1, index 0 would be the pixel corner */
+  uint32_t index = frame % 1024 + 1;
+  return glm::vec2(getHaltonValue(index, 2), getHaltonValue(index, 3)) -
+         0.5f;
+}
+
+/* hands the colour images between the queue families, the release half on
+ * the graphics queue and the acquire half on the compute queue */
+static void recordGBufferOwnershipBarrier(
+    GBuffer *gbuffer, VkCommandBuffer command_buffer,
+    VkPipelineStageFlags src_stage_mask, VkAccessFlags src_access_mask,
+    VkPipelineStageFlags dst_stage_mask, VkAccessFlags dst_access_mask,
+    uint32_t graphics_family_index, uint32_t compute_family_index) {
+  VkImageMemoryBarrier barriers[color_attachment_count] = {};
+  for (uint32_t i = 0; i < color_attachment_count; ++i) {
+    barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barriers[i].pNext = 0;
+    barriers[i].srcAccessMask = src_access_mask;
+    barriers[i].dstAccessMask = dst_access_mask;
+    barriers[i].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barriers[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barriers[i].srcQueueFamilyIndex = graphics_family_index;
+    barriers[i].dstQueueFamilyIndex = compute_family_index;
+    barriers[i].image = getGBufferColorTexture(gbuffer, i)->handle;
+    barriers[i].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barriers[i].subresourceRange.baseMipLevel = 0;
+    barriers[i].subresourceRange.levelCount = 1;
+    barriers[i].subresourceRange.baseArrayLayer = 0;
+    barriers[i].subresourceRange.layerCount = 1;
+  }
+
+  vkCmdPipelineBarrier(command_buffer, src_stage_mask, dst_stage_mask, 0, 0, 0,
+                       0, 0, color_attachment_count, barriers);
+}
+
+void recordGBufferPass(GBuffer *gbuffer, VkCommandBuffer command_buffer,
+                       glm::vec2 jitter, uint32_t sphere_count,
+                       const std::vector<InstanceInfo> &instances,
+                       const std::vector<MeshInfo> &meshes,
+                       uint32_t graphics_family_index,
+                       uint32_t compute_family_index) {
+  /* w of normal stays 0 where nothing was hit */
+  VkClearValue clear_values[color_attachment_count + 1] = {};
+  clear_values[color_attachment_count].depthStencil.depth = 1.0f;
+
+  VkRenderPassBeginInfo render_pass_begin_info = {};
+  render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  render_pass_begin_info.pNext = 0;
+  render_pass_begin_info.renderPass = gbuffer->render_pass;
+  render_pass_begin_info.framebuffer = gbuffer->framebuffer;
+  render_pass_begin_info.renderArea.offset.x = 0;
+  render_pass_begin_info.renderArea.offset.y = 0;
+  render_pass_begin_info.renderArea.extent.width = gbuffer->width;
+  render_pass_begin_info.renderArea.extent.height = gbuffer->height;
+  render_pass_begin_info.clearValueCount = color_attachment_count + 1;
+  render_pass_begin_info.pClearValues = clear_values;
+
+  vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info,
+                       VK_SUBPASS_CONTENTS_INLINE);
+
+  /* not flipped, row 0 of the images is the bottom of the view like it is
+   * for the camera rays */
+  VkViewport viewport;
+  viewport.x = 0.0f;
+  viewport.y = 0.0f;
+  viewport.width = gbuffer->width;
+  viewport.height = gbuffer->height;
+  viewport.minDepth = 0.0f;
+  viewport.maxDepth = 1.0f;
+  vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+
+  VkRect2D scissor;
+  scissor.offset.x = scissor.offset.y = 0;
+  scissor.extent.width = gbuffer->width;
+  scissor.extent.height = gbuffer->height;
+  vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+  GBufferPushConstants push_constants = {};
+  push_constants.jitter = jitter;
+  push_constants.target_size = glm::vec2(gbuffer->width, gbuffer->height);
+
+  /* both pipelines share the layout */
+  VkPipelineLayout layout = gbuffer->pipelines[GBUFFER_PASS_SPHERES].layout;
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          layout, 0, 1, &gbuffer->descriptor_set, 0, 0);
+  vkCmdPushConstants(command_buffer, layout,
+                     VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                     0, sizeof(GBufferPushConstants), &push_constants);
+
+  if (sphere_count > 0) {
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      gbuffer->pipelines[GBUFFER_PASS_SPHERES].handle);
+    vkCmdDraw(command_buffer, 6, sphere_count, 0, 0);
+  }
+
+  /* one draw per instance, the instance index picks its transform */
+  if (!instances.empty()) {
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      gbuffer->pipelines[GBUFFER_PASS_MESHES].handle);
+    for (uint32_t i = 0; i < instances.size(); ++i) {
+      const MeshInfo &mesh = meshes[instances[i].mesh_index];
+      vkCmdDraw(command_buffer, mesh.triangle_count * 3, 1,
+                mesh.first_triangle * 3, i);
+    }
+  }
+
+  vkCmdEndRenderPass(command_buffer);
+
+  if (graphics_family_index != compute_family_index) {
+    recordGBufferOwnershipBarrier(
+        gbuffer, command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, graphics_family_index,
+        compute_family_index);
+  }
+}
+
+void recordGBufferAcquire(GBuffer *gbuffer, VkCommandBuffer command_buffer,
+                          uint32_t graphics_family_index,
+                          uint32_t compute_family_index) {
+  if (graphics_family_index != compute_family_index) {
+    recordGBufferOwnershipBarrier(
+        gbuffer, command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+        graphics_family_index, compute_family_index);
+  }
+}
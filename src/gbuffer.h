@@ -0,0 +1,84 @@
+#pragma once
+
+#include "mesh.h"
+#include "scene.h"
+#include "vulkan_device.h"
+#include "vulkan_pipeline.h"
+#include "vulkan_texture.h"
+
+#include "glm/glm.hpp"
+#include "vk_mem_alloc.h"
+#include <stdint.h>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+/* the gbuffer_*.vert and gbuffer_*.frag pipelines in draw order. spheres are
+ * drawn as camera facing quads and intersected per fragment, meshes as
+ * their triangles */
+enum GBufferPass {
+  GBUFFER_PASS_SPHERES,
+  GBUFFER_PASS_MESHES,
+  GBUFFER_PASS_COUNT
+};
+
+/* matches GBufferPushConstants in gbuffer_common.glsl */
+struct GBufferPushConstants {
+  /* where in its pixel the frame samples, -0.5 to 0.5 */
+  glm::vec2 jitter;
+  glm::vec2 target_size;
+};
+
+/* UBO, spheres, sphere material indices, mesh vertices, mesh indices, mesh
+ * infos, instances */
+const uint32_t gbuffer_binding_count = 7;
+
+/* the first hits of the camera rays, rasterized on the graphics queue for
+ * wavefront_gbuffer_hits.comp to read in place of tracing them. a texel
+ * belongs to the pixel of the result image at the same coordinates */
+struct GBuffer {
+  VulkanPipeline pipelines[GBUFFER_PASS_COUNT];
+  VkDescriptorSet descriptor_set;
+  VkRenderPass render_pass;
+  VkFramebuffer framebuffer;
+
+  /* xyz - world position of the hit, w - uvDensity */
+  VulkanTexture position;
+  /* xyz - normal facing the camera, w - 1 where something was hit */
+  VulkanTexture normal;
+  /* x - material index, y - sphere index or NO_SPHERE, zw - uv as float
+   * bits */
+  VulkanTexture material;
+  VulkanTexture depth;
+
+  uint32_t width;
+  uint32_t height;
+};
+
+const char *getGBufferPassShaderPath(GBufferPass pass,
+                                     VkShaderStageFlagBits stage);
+
+/* the images, the render pass the pipelines are created against and its
+ * framebuffer */
+bool createGBuffer(VulkanDevice *device, VmaAllocator vma_allocator,
+                   uint32_t width, uint32_t height, GBuffer *out_gbuffer);
+void destroyGBuffer(GBuffer *gbuffer, VulkanDevice *device,
+                    VmaAllocator vma_allocator);
+
+/* the Halton (2, 3) point of the frame, so the pixels antialias over the
+ * frames the accumulation averages */
+glm::vec2 getGBufferJitter(uint32_t frame);
+
+/* records the raster pass on a graphics command buffer, ending with the
+ * release of the images to the compute queue family when it is another
+ * one */
+void recordGBufferPass(GBuffer *gbuffer, VkCommandBuffer command_buffer,
+                       glm::vec2 jitter, uint32_t sphere_count,
+                       const std::vector<InstanceInfo> &instances,
+                       const std::vector<MeshInfo> &meshes,
+                       uint32_t graphics_family_index,
+                       uint32_t compute_family_index);
+/* the acquire matching the release of recordGBufferPass, recorded on the
+ * compute command buffer that reads the images */
+void recordGBufferAcquire(GBuffer *gbuffer, VkCommandBuffer command_buffer,
+                          uint32_t graphics_family_index,
+                          uint32_t compute_family_index);
@@ -0,0 +1,228 @@
+#include "gpu_bvh.h"
+
+#include "logger.h"
+#include "vulkan_resources.h"
+
+#include <string.h>
+
+/* match LBVH_GROUP_SIZE and LBVH_RADIX_BITS in lbvh_common.glsl */
+static const uint32_t group_size = 256;
+static const uint32_t radix_bits = 4;
+static const uint32_t radix_size = 1 << radix_bits;
+
+static const char *gpu_bvh_pass_shader_paths[GPU_BVH_PASS_COUNT] = {
+    "assets/shaders/lbvh_morton.comp.spv",
+    "assets/shaders/lbvh_radix_histogram.comp.spv",
+    "assets/shaders/lbvh_radix_scan.comp.spv",
+    "assets/shaders/lbvh_radix_scatter.comp.spv",
+    "assets/shaders/lbvh_hierarchy.comp.spv",
+    "assets/shaders/lbvh_fit.comp.spv"};
+
+const char *getGPUBVHPassShaderPath(GPUBVHPass pass) {
+  return gpu_bvh_pass_shader_paths[pass];
+}
+
+static bool createScratchBuffer(VmaAllocator vma_allocator, uint64_t size,
+                                VulkanBuffer *out_buffer) {
+  return createBuffer(vma_allocator, size,
+                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                      VMA_MEMORY_USAGE_GPU_ONLY, out_buffer);
+}
+
+bool createGPUBVHBuffers(VmaAllocator vma_allocator, uint32_t sphere_count,
+                         GPUBVHBuilder *out_builder) {
+  if (sphere_count == 0) {
+    ERROR("Can't build a GPU BVH without spheres!");
+    return false;
+  }
+
+  const uint32_t node_count = sphere_count * 2 - 1;
+  const uint32_t group_count = (sphere_count + group_size - 1) / group_size;
+
+  out_builder->sphere_count = sphere_count;
+
+  /* the radix passes ping-pong between the two halves of keys and values */
+  if (!createScratchBuffer(vma_allocator, sphere_count * 2 * sizeof(uint32_t),
+                           &out_builder->keys) ||
+      !createScratchBuffer(vma_allocator, sphere_count * 2 * sizeof(uint32_t),
+                           &out_builder->values) ||
+      !createScratchBuffer(vma_allocator,
+                           group_count * radix_size * sizeof(uint32_t),
+                           &out_builder->histograms) ||
+      !createScratchBuffer(vma_allocator, node_count * sizeof(uint32_t),
+                           &out_builder->parents) ||
+      !createScratchBuffer(vma_allocator, node_count * sizeof(uint32_t),
+                           &out_builder->flags) ||
+      !createScratchBuffer(vma_allocator, sizeof(GPUBVHBuildState),
+                           &out_builder->state)) {
+    ERROR("Failed to create GPU BVH buffers!");
+    return false;
+  }
+
+  return true;
+}
+
+void destroyGPUBVHBuilder(GPUBVHBuilder *builder, VulkanDevice *device,
+                          VmaAllocator vma_allocator) {
+  for (uint32_t i = 0; i < GPU_BVH_PASS_COUNT; ++i) {
+    destroyPipeline(&builder->pipelines[i], device);
+  }
+
+  destroyBuffer(&builder->keys, vma_allocator);
+  destroyBuffer(&builder->values, vma_allocator);
+  destroyBuffer(&builder->histograms, vma_allocator);
+  destroyBuffer(&builder->parents, vma_allocator);
+  destroyBuffer(&builder->flags, vma_allocator);
+  destroyBuffer(&builder->state, vma_allocator);
+}
+
+static void computeBarrier(VkCommandBuffer command_buffer,
+                           VkPipelineStageFlags src_stage,
+                           VkAccessFlags src_access) {
+  VkMemoryBarrier memory_barrier = {};
+  memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memory_barrier.pNext = 0;
+  memory_barrier.srcAccessMask = src_access;
+  memory_barrier.dstAccessMask =
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(command_buffer, src_stage,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                       &memory_barrier, 0, 0, 0, 0);
+}
+
+static void dispatchPass(GPUBVHBuilder *builder, VkCommandBuffer command_buffer,
+                         GPUBVHPass pass, GPUBVHPushConstants push_constants,
+                         uint32_t group_count) {
+  VulkanPipeline *pipeline = &builder->pipelines[pass];
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    pipeline->handle);
+  vkCmdPushConstants(command_buffer, pipeline->layout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                     sizeof(GPUBVHPushConstants), &push_constants);
+  vkCmdDispatch(command_buffer, group_count, 1, 1);
+
+  computeBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                 VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+void recordGPUBVHBuild(GPUBVHBuilder *builder,
+                       VkCommandBuffer command_buffer) {
+  const uint32_t sphere_count = builder->sphere_count;
+  const uint32_t group_count = (sphere_count + group_size - 1) / group_size;
+
+  GPUBVHBuildState state = {};
+  state.morton_origin = builder->morton_origin;
+  state.morton_inv_extent = builder->morton_inv_extent;
+  vkCmdUpdateBuffer(command_buffer, builder->state.handle, 0, sizeof(state),
+                    &state);
+  vkCmdFillBuffer(command_buffer, builder->flags.handle, 0, VK_WHOLE_SIZE, 0);
+  computeBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                 VK_ACCESS_TRANSFER_WRITE_BIT);
+
+  /* every pass shares the descriptor set layout and push constant range, so
+   * the set stays bound across pipelines */
+  vkCmdBindDescriptorSets(
+      command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+      builder->pipelines[GPU_BVH_PASS_MORTON].layout, 0, 1,
+      &builder->descriptor_set, 0, 0);
+
+  GPUBVHPushConstants push_constants = {};
+  push_constants.count = sphere_count;
+
+  dispatchPass(builder, command_buffer, GPU_BVH_PASS_MORTON, push_constants,
+               group_count);
+
+  /* an even number of passes leaves the sorted keys in the first half */
+  push_constants.read_offset = 0;
+  push_constants.write_offset = sphere_count;
+  for (uint32_t shift = 0; shift < 32; shift += radix_bits) {
+    push_constants.shift = shift;
+    dispatchPass(builder, command_buffer, GPU_BVH_PASS_RADIX_HISTOGRAM,
+                 push_constants, group_count);
+    dispatchPass(builder, command_buffer, GPU_BVH_PASS_RADIX_SCAN,
+                 push_constants, 1);
+    dispatchPass(builder, command_buffer, GPU_BVH_PASS_RADIX_SCATTER,
+                 push_constants, group_count);
+
+    uint32_t temp_offset = push_constants.read_offset;
+    push_constants.read_offset = push_constants.write_offset;
+    push_constants.write_offset = temp_offset;
+  }
+
+  push_constants.shift = 0;
+  push_constants.read_offset = 0;
+  push_constants.write_offset = 0;
+  if (sphere_count > 1) {
+    dispatchPass(builder, command_buffer, GPU_BVH_PASS_HIERARCHY,
+                 push_constants,
+                 (sphere_count - 1 + group_size - 1) / group_size);
+  }
+  dispatchPass(builder, command_buffer, GPU_BVH_PASS_FIT, push_constants,
+               group_count);
+}
+
+bool readGPUBVHNodes(GPUBVHBuilder *builder, VulkanDevice *device,
+                     VmaAllocator vma_allocator, VulkanBuffer *node_buffer,
+                     VkQueue queue, VkCommandPool command_pool,
+                     std::vector<BVHNode> *out_nodes) {
+  const uint32_t node_count = builder->sphere_count * 2 - 1;
+
+  VulkanBuffer readback_buffer;
+  if (!createBuffer(vma_allocator, node_count * sizeof(BVHNode),
+                    VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    VMA_MEMORY_USAGE_GPU_TO_CPU, &readback_buffer)) {
+    ERROR("Failed to create a readback buffer!");
+    return false;
+  }
+
+  vkQueueWaitIdle(queue);
+
+  VkCommandBuffer temp_command_buffer;
+  if (!allocateAndBeginSingleUseCommandBuffer(device, command_pool,
+                                              &temp_command_buffer)) {
+    ERROR("Failed to allocate a temp command buffer!");
+    destroyBuffer(&readback_buffer, vma_allocator);
+    return false;
+  }
+
+  recordGPUBVHBuild(builder, temp_command_buffer);
+
+  VkMemoryBarrier memory_barrier = {};
+  memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memory_barrier.pNext = 0;
+  memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  vkCmdPipelineBarrier(temp_command_buffer,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memory_barrier, 0,
+                       0, 0, 0);
+
+  VkBufferCopy copy_region = {};
+  copy_region.srcOffset = 0;
+  copy_region.dstOffset = 0;
+  copy_region.size = readback_buffer.size;
+  vkCmdCopyBuffer(temp_command_buffer, node_buffer->handle,
+                  readback_buffer.handle, 1, &copy_region);
+
+  memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  memory_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(temp_command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memory_barrier, 0, 0,
+                       0, 0);
+
+  endAndFreeSingleUseCommandBuffer(temp_command_buffer, device, command_pool,
+                                   queue);
+
+  out_nodes->resize(node_count);
+  memcpy(out_nodes->data(), lockBuffer(&readback_buffer, vma_allocator),
+         node_count * sizeof(BVHNode));
+  unlockBuffer(&readback_buffer, vma_allocator);
+
+  destroyBuffer(&readback_buffer, vma_allocator);
+
+  return true;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "bvh.h"
+#include "vulkan_buffer.h"
+#include "vulkan_device.h"
+#include "vulkan_pipeline.h"
+
+#include "vk_mem_alloc.h"
+#include <stdint.h>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+/* the lbvh_*.comp passes in dispatch order. the radix passes run once per 4
+ * bit digit of the Morton codes. the bounds the codes are quantized over come
+ * from the host */
+enum GPUBVHPass {
+  GPU_BVH_PASS_MORTON,
+  GPU_BVH_PASS_RADIX_HISTOGRAM,
+  GPU_BVH_PASS_RADIX_SCAN,
+  GPU_BVH_PASS_RADIX_SCATTER,
+  GPU_BVH_PASS_HIERARCHY,
+  GPU_BVH_PASS_FIT,
+  GPU_BVH_PASS_COUNT
+};
+
+/* matches LBVHPushConstants in lbvh_common.glsl */
+struct GPUBVHPushConstants {
+  uint32_t count;
+  uint32_t shift;
+  uint32_t read_offset;
+  uint32_t write_offset;
+};
+
+/* matches BuildState in lbvh_common.glsl */
+struct GPUBVHBuildState {
+  glm::vec3 morton_origin;
+  float padding;
+  glm::vec3 morton_inv_extent;
+  float padding2;
+};
+
+/* spheres, nodes, Morton keys, Morton values, radix histograms, parents,
+ * flags, build state */
+const uint32_t gpu_bvh_binding_count = 8;
+
+/* builds the sphere BVH in the layout of buildLBVHReference straight from the
+ * sphere SSBO into the node SSBO, both owned by the caller. every level splits
+ * at a longer common prefix of the 30 bit Morton codes and the indices that
+ * break their ties, so the tree is at most 30 + ceil(log2(sphere_count))
+ * levels deep and always fits bvh_stack_size */
+struct GPUBVHBuilder {
+  VulkanPipeline pipelines[GPU_BVH_PASS_COUNT];
+  VkDescriptorSet descriptor_set;
+
+  VulkanBuffer keys;
+  VulkanBuffer values;
+  VulkanBuffer histograms;
+  VulkanBuffer parents;
+  VulkanBuffer flags;
+  VulkanBuffer state;
+
+  uint32_t sphere_count;
+  /* from calculateMortonQuantization over the spheres, read at record time
+   * so the codes match the CPU reference bit for bit */
+  glm::vec3 morton_origin;
+  glm::vec3 morton_inv_extent;
+};
+
+const char *getGPUBVHPassShaderPath(GPUBVHPass pass);
+
+/* the scratch buffers in the order of the descriptor set bindings 2 to 7 */
+bool createGPUBVHBuffers(VmaAllocator vma_allocator, uint32_t sphere_count,
+                         GPUBVHBuilder *out_builder);
+void destroyGPUBVHBuilder(GPUBVHBuilder *builder, VulkanDevice *device,
+                          VmaAllocator vma_allocator);
+
+/* records every pass, ending with a barrier so later compute work can read
+ * the nodes */
+void recordGPUBVHBuild(GPUBVHBuilder *builder, VkCommandBuffer command_buffer);
+/* builds once and copies the nodes back, the node buffer needs to allow
+ * transfers from it */
+bool readGPUBVHNodes(GPUBVHBuilder *builder, VulkanDevice *device,
+                     VmaAllocator vma_allocator, VulkanBuffer *node_buffer,
+                     VkQueue queue, VkCommandPool command_pool,
+                     std::vector<BVHNode> *out_nodes);
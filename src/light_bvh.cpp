@@ -0,0 +1,85 @@
+#include "light_bvh.h"
+
+#include "logger.h"
+
+static void copyLightBVHBounds(LightBVH *light_bvh) {
+  for (uint32_t i = 0; i < light_bvh->nodes.size(); ++i) {
+    light_bvh->nodes[i].bounds_min = light_bvh->bvh.nodes[i].bounds_min;
+    light_bvh->nodes[i].bounds_max = light_bvh->bvh.nodes[i].bounds_max;
+  }
+}
+
+bool buildLightBVH(const std::vector<BVHPrimitive> &lights,
+                   const std::vector<float> &fluxes, LightBVH *out_light_bvh) {
+  out_light_bvh->nodes.clear();
+  out_light_bvh->light_leaves.clear();
+  if (lights.empty()) {
+    out_light_bvh->bvh = {};
+    return true;
+  }
+  if (fluxes.size() != lights.size()) {
+    ERROR("Every light needs a flux!");
+    return false;
+  }
+
+  /* single light leaves let the traversal weigh every light on its own */
+  buildLBVHReference(lights, &out_light_bvh->bvh);
+
+  const std::vector<BVHNode> &bvh_nodes = out_light_bvh->bvh.nodes;
+  out_light_bvh->nodes.resize(bvh_nodes.size());
+  out_light_bvh->light_leaves.resize(lights.size());
+  for (uint32_t i = 0; i < bvh_nodes.size(); ++i) {
+    LightBVHNode &node = out_light_bvh->nodes[i];
+    node.left_first = bvh_nodes[i].left_first;
+    node.count = bvh_nodes[i].count;
+    node.flux = 0.0f;
+    node.parent = UINT32_MAX;
+    node.padding[0] = 0;
+    node.padding[1] = 0;
+  }
+  copyLightBVHBounds(out_light_bvh);
+
+  /* a reversed pre-order visits every child before its parent */
+  std::vector<uint32_t> order;
+  order.reserve(bvh_nodes.size());
+  std::vector<uint32_t> node_stack;
+  node_stack.emplace_back(0);
+  while (!node_stack.empty()) {
+    uint32_t node_index = node_stack.back();
+    node_stack.pop_back();
+    order.emplace_back(node_index);
+
+    LightBVHNode &node = out_light_bvh->nodes[node_index];
+    if (node.count == 0) {
+      out_light_bvh->nodes[node.left_first].parent = node_index;
+      out_light_bvh->nodes[node.left_first + 1].parent = node_index;
+      node_stack.emplace_back(node.left_first);
+      node_stack.emplace_back(node.left_first + 1);
+    }
+  }
+
+  for (uint32_t i = order.size(); i > 0; --i) {
+    uint32_t node_index = order[i - 1];
+    LightBVHNode &node = out_light_bvh->nodes[node_index];
+    if (node.count > 0) {
+      node.flux = fluxes[node.left_first];
+      out_light_bvh->light_leaves[node.left_first] = node_index;
+    } else {
+      node.flux = out_light_bvh->nodes[node.left_first].flux +
+                  out_light_bvh->nodes[node.left_first + 1].flux;
+    }
+  }
+
+  return true;
+}
+
+void refitLightBVH(const std::vector<BVHPrimitive> &lights,
+                   LightBVH *light_bvh) {
+  if (light_bvh->nodes.empty()) {
+    return;
+  }
+
+  std::vector<uint32_t> dirty_nodes;
+  refitBVH(lights, &light_bvh->bvh, &dirty_nodes);
+  copyLightBVHBounds(light_bvh);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "bvh.h"
+
+#include "glm/glm.hpp"
+#include <stdint.h>
+#include <vector>
+
+/* matches the std430 layout of LightBVHNode in ray_tracing.glsl. the topology
+ * of a BVHNode with one light per leaf, left_first of a leaf being its index
+ * in the light list. flux is the power emitted by the lights below, parent
+ * lets the shader walk up from a leaf to find how likely its light was to be
+ * picked */
+struct LightBVHNode {
+  glm::vec3 bounds_min;
+  uint32_t left_first;
+  glm::vec3 bounds_max;
+  uint32_t count;
+  float flux;
+  uint32_t parent;
+  uint32_t padding[2];
+};
+
+struct LightBVH {
+  /* the LBVH the nodes are built from, kept for refits */
+  BVH bvh;
+  std::vector<LightBVHNode> nodes;
+  /* the leaf of every light */
+  std::vector<uint32_t> light_leaves;
+};
+
+/* one light per primitive, the lights emit in every direction so the nodes
+ * only bound their positions. fluxes are in light order */
+bool buildLightBVH(const std::vector<BVHPrimitive> &lights,
+                   const std::vector<float> &fluxes, LightBVH *out_light_bvh);
+/* moves the bounds to the current light positions, the flux of a light
+ * doesn't change when it moves */
+void refitLightBVH(const std::vector<BVHPrimitive> &lights,
+                   LightBVH *light_bvh);
@@ -1,7 +1,15 @@
 #include "camera.h"
+#include "environment_map.h"
+#include "frame_budget.h"
+#include "gbuffer.h"
+#include "gpu_bvh.h"
 #include "input.h"
 #include "logger.h"
+#include "mesh.h"
 #include "platform.h"
+#include "ray_stats.h"
+#include "scene.h"
+#include "thread_pool.h"
 #include "vulkan_buffer.h"
 #include "vulkan_common.h"
 #include "vulkan_descriptor_allocator.h"
@@ -12,15 +20,20 @@
 #include "vulkan_resources.h"
 #include "vulkan_swapchain.h"
 #include "vulkan_texture.h"
+#include "wavefront.h"
 
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_vulkan.h>
+#include <algorithm>
 #include <assert.h>
+#include <float.h>
 #include <set>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 #include <vulkan/vulkan.h>
@@ -42,7 +55,12 @@ struct UniformBufferObject {
   glm::vec4 viewport_size;
   glm::vec4 camera_position;
   glm::vec4 render_settings;
-  glm::vec4 frame;
+  /* x - frames accumulated since the last reset, y - frames rendered since
+   * the start, which ages the radiance cache, z - samples accumulated since
+   * the last reset, where the samples of the frame start as the samples per
+   * frame change. counted in integers, a float sum of sample counts starts
+   * rounding past 2^24 and would repeat sample indices */
+  glm::uvec4 frame;
   glm::vec4 ground_colour;
   glm::vec4 sky_colour_horizon;
   glm::vec4 sky_colour_zenith;
@@ -51,19 +69,35 @@ struct UniformBufferObject {
   float sun_intensity;
   float defocus_strenght;
   float diverge_strength;
+  /* x - instance count, y - emissive sphere count, z, w - size of the
+   * environment map, 0 without one */
+  glm::uvec4 scene_counts;
+  /* x - relative noise threshold, 0 samples every pixel, y - frames before a
+   * pixel may converge */
+  glm::vec4 adaptive_settings;
+  /* the camera of the last frame, which the history gets reprojected from */
+  glm::mat4 previous_view;
+  glm::mat4 previous_projection;
+  glm::vec4 previous_camera_position;
+  /* x - 1 when the camera moved since the last frame and the history gets
+   * reprojected, y - samples a pixel keeps at most */
+  glm::vec4 reprojection_settings;
+  /* bounds of the spheres and instances, the direction sort key quantizes
+   * ray origins over them */
+  glm::vec4 scene_bounds_min;
+  glm::vec4 scene_bounds_max;
 };
 
-struct RayTracingMaterial {
-  glm::vec4 colour;
-  glm::vec4 emission_colour;
-  glm::vec4 specular_colour;
+/* render_settings.z, matches TRAVERSAL_* in ray_tracing.glsl */
+enum SphereTraversal {
+  SPHERE_TRAVERSAL_BRUTE_FORCE,
+  SPHERE_TRAVERSAL_BVH,
+  SPHERE_TRAVERSAL_COMPRESSED_BVH,
+  SPHERE_TRAVERSAL_COUNT
 };
 
-struct Sphere {
-  glm::vec3 position;
-  float radius;
-  RayTracingMaterial material;
-};
+static const char *sphere_traversal_names[SPHERE_TRAVERSAL_COUNT] = {
+    "Brute force", "Binary BVH", "Compressed BVH"};
 
 VKAPI_ATTR VkBool32 VKAPI_CALL vulkanDebugCallback(
     VkDebugUtilsMessageSeverityFlagBitsEXT message_severity,
@@ -91,12 +125,127 @@ descriptorSetLayoutBinding(uint32_t binding, VkDescriptorType descriptor_type,
 VkPipelineShaderStageCreateInfo
 pipelineShaderStageCreateInfo(VkShaderStageFlagBits stage_flag,
                               VkShaderModule shader_module);
-bool loadTexture(const char *path, VulkanDevice *device,
+bool loadTexture(const char *path, VkFormat format, VulkanDevice *device,
                  VmaAllocator vma_allocator, VkQueue queue,
                  VkCommandPool command_pool, uint32_t queue_family_index,
                  VulkanTexture *out_texture);
+bool createStorageBuffer(VulkanDevice *device, VmaAllocator vma_allocator,
+                         void *data, uint64_t size, VkQueue queue,
+                         VkCommandPool command_pool, VulkanBuffer *out_buffer);
 
 int main(int argc, char **argv) {
+  uint32_t random_sphere_count = 0;
+  uint32_t instances_per_model = 1;
+  uint32_t benchmark_sphere_count = 0;
+  BVHBuilder bvh_builder = BVH_BUILDER_BINNED_SAH;
+  bool use_gpu_bvh = false;
+  bool validate_gpu_bvh = false;
+  SphereTraversal sphere_traversal = SPHERE_TRAVERSAL_BVH;
+  WavefrontSortMode ray_sort_mode = WAVEFRONT_SORT_NONE;
+  WavefrontLightSelection light_selection = WAVEFRONT_LIGHT_SELECTION_BVH;
+  WavefrontSequence sequence = WAVEFRONT_SEQUENCE_SOBOL;
+  uint32_t light_count = 0;
+  bool closed_room = false;
+  const char *environment_path = 0;
+  bool raster_primary = false;
+  /* 0 traces the image at the size of the window */
+  uint32_t render_width = 0;
+  uint32_t render_height = 0;
+  std::vector<const char *> model_paths;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--spheres") == 0 && i + 1 < argc) {
+      random_sphere_count = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+      model_paths.emplace_back(argv[++i]);
+    } else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+      instances_per_model = std::max(atoi(argv[++i]), 1);
+    } else if (strcmp(argv[i], "--bvh-builder") == 0 && i + 1 < argc) {
+      if (!findBVHBuilder(argv[++i], &bvh_builder)) {
+        FATAL("Unknown BVH builder %s!", argv[i]);
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--bvh-benchmark") == 0 && i + 1 < argc) {
+      benchmark_sphere_count = std::max(atoi(argv[++i]), 1);
+    } else if (strcmp(argv[i], "--gpu-bvh") == 0) {
+      use_gpu_bvh = true;
+    } else if (strcmp(argv[i], "--validate-gpu-bvh") == 0) {
+      validate_gpu_bvh = true;
+    } else if (strcmp(argv[i], "--bvh-layout") == 0 && i + 1 < argc) {
+      ++i;
+      if (strcmp(argv[i], "binary") == 0) {
+        sphere_traversal = SPHERE_TRAVERSAL_BVH;
+      } else if (strcmp(argv[i], "compressed") == 0) {
+        sphere_traversal = SPHERE_TRAVERSAL_COMPRESSED_BVH;
+      } else {
+        FATAL("Unknown BVH layout %s!", argv[i]);
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--ray-sort") == 0 && i + 1 < argc) {
+      ++i;
+      if (strcmp(argv[i], "none") == 0) {
+        ray_sort_mode = WAVEFRONT_SORT_NONE;
+      } else if (strcmp(argv[i], "direction") == 0) {
+        ray_sort_mode = WAVEFRONT_SORT_DIRECTION;
+      } else if (strcmp(argv[i], "material") == 0) {
+        ray_sort_mode = WAVEFRONT_SORT_MATERIAL;
+      } else {
+        FATAL("Unknown ray sort mode %s!", argv[i]);
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--light-selection") == 0 && i + 1 < argc) {
+      ++i;
+      if (strcmp(argv[i], "uniform") == 0) {
+        light_selection = WAVEFRONT_LIGHT_SELECTION_UNIFORM;
+      } else if (strcmp(argv[i], "bvh") == 0) {
+        light_selection = WAVEFRONT_LIGHT_SELECTION_BVH;
+      } else {
+        FATAL("Unknown light selection %s!", argv[i]);
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--sampler") == 0 && i + 1 < argc) {
+      ++i;
+      if (strcmp(argv[i], "pcg") == 0) {
+        sequence = WAVEFRONT_SEQUENCE_PCG;
+      } else if (strcmp(argv[i], "sobol") == 0) {
+        sequence = WAVEFRONT_SEQUENCE_SOBOL;
+      } else {
+        FATAL("Unknown sampler %s!", argv[i]);
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+      light_count = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--room") == 0) {
+      closed_room = true;
+    } else if (strcmp(argv[i], "--environment") == 0 && i + 1 < argc) {
+      environment_path = argv[++i];
+    } else if (strcmp(argv[i], "--raster-primary") == 0) {
+      raster_primary = true;
+    } else if (strcmp(argv[i], "--resolution") == 0 && i + 1 < argc) {
+      ++i;
+      if (sscanf(argv[i], "%ux%u", &render_width, &render_height) != 2 ||
+          render_width == 0 || render_height == 0) {
+        FATAL("Unknown resolution %s, expected WIDTHxHEIGHT!", argv[i]);
+        exit(1);
+      }
+    }
+  }
+
+  /* the main thread helps while waiting, so it is left out of the count */
+  uint32_t worker_count =
+      std::max((int)std::thread::hardware_concurrency() - 1, 0);
+  if (!initializeThreadPool(worker_count)) {
+    FATAL("Failed to initialize a thread pool!");
+    exit(1);
+  }
+
+  if (benchmark_sphere_count > 0) {
+    Scene benchmark_scene;
+    createRandomSpheresScene(benchmark_sphere_count, 0, &benchmark_scene);
+    benchmarkSceneBVH(&benchmark_scene);
+    shutdownThreadPool();
+    return 0;
+  }
+
   SDL_Window *window;
   if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
     FATAL("Failed to initialize SDL!");
@@ -105,6 +254,12 @@ int main(int argc, char **argv) {
 
   const uint32_t window_width = 800;
   const uint32_t window_height = 608;
+  /* the image is traced at its own size and scaled to the window, so the
+   * cost of large images can be measured with a window of any size */
+  if (render_width == 0) {
+    render_width = window_width;
+    render_height = window_height;
+  }
 
   window = SDL_CreateWindow(
       "Ray tracer", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
@@ -202,6 +357,12 @@ int main(int argc, char **argv) {
   vkGetDeviceQueue(device.logical_device, present_family_index, 0,
                    &present_queue);
 
+  FrameBudget frame_budget;
+  if (!createFrameBudget(&device, compute_family_index, &frame_budget)) {
+    FATAL("Failed to create the frame budget!");
+    exit(1);
+  }
+
   VkCommandPool graphics_command_pool;
   if (!createCommandPool(&device, graphics_family_index,
                          &graphics_command_pool)) {
@@ -224,6 +385,15 @@ int main(int argc, char **argv) {
       exit(1);
     }
   }
+  std::vector<VkCommandBuffer> gbuffer_command_buffers;
+  gbuffer_command_buffers.resize(swapchain.images.size());
+  for (uint32_t i = 0; i < gbuffer_command_buffers.size(); ++i) {
+    if (!allocateCommandBuffer(&device, graphics_command_pool,
+                               &gbuffer_command_buffers[i])) {
+      FATAL("Failed to allocate a command buffer!");
+      exit(1);
+    }
+  }
   std::vector<VkCommandBuffer> compute_command_buffers;
   compute_command_buffers.resize(swapchain.images.size());
   for (uint32_t i = 0; i < compute_command_buffers.size(); ++i) {
@@ -244,6 +414,8 @@ int main(int argc, char **argv) {
   compute_finished_semaphores.resize(swapchain.max_frames_in_flight);
   std::vector<VkFence> compute_in_flight_fences;
   compute_in_flight_fences.resize(swapchain.max_frames_in_flight);
+  std::vector<VkSemaphore> gbuffer_finished_semaphores;
+  gbuffer_finished_semaphores.resize(swapchain.max_frames_in_flight);
   for (uint32_t i = 0; i < swapchain.max_frames_in_flight; ++i) {
     if (!createSemaphore(&device, &image_available_semaphores[i])) {
       FATAL("Failed to create a semaphore!");
@@ -266,6 +438,11 @@ int main(int argc, char **argv) {
       FATAL("Failed to create a fence!");
       exit(1);
     }
+
+    if (!createSemaphore(&device, &gbuffer_finished_semaphores[i])) {
+      FATAL("Failed to create a semaphore!");
+      exit(1);
+    }
   }
 
   if (!initializeDescriptorAllocator()) {
@@ -313,7 +490,7 @@ int main(int argc, char **argv) {
   if (!createGraphicsPipeline(
           &device, render_pass,
           std::vector<VkDescriptorSetLayout>{descriptor_set_layout},
-          graphics_pipeline_stages, &graphics_pipeline)) {
+          graphics_pipeline_stages, 1, true, false, 0, &graphics_pipeline)) {
     FATAL("Failed to create a graphics pipeline!");
     exit(1);
   }
@@ -322,23 +499,24 @@ int main(int argc, char **argv) {
   vkDestroyShaderModule(device.logical_device, texture_fragment_shader_module,
                         0);
 
-  VkShaderModule compute_shader_module;
-  if (!createShaderModule(&device, "assets/shaders/ray_tracing.comp.spv",
-                          &compute_shader_module)) {
-    FATAL("Failed to create a compute shader module!");
-    exit(1);
+  /* the result image, then the G-buffer position, normal and material */
+  const uint32_t compute_image_binding_count = 4;
+  std::vector<VkDescriptorSetLayoutBinding>
+      compute_descriptor_set_layout_bindings;
+  for (uint32_t i = 0; i < compute_image_binding_count; ++i) {
+    compute_descriptor_set_layout_bindings.emplace_back(
+        descriptorSetLayoutBinding(i, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                   VK_SHADER_STAGE_COMPUTE_BIT));
   }
-
-  VkDescriptorSetLayoutBinding compute_descriptor_set_layout_binding =
-      descriptorSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-                                 VK_SHADER_STAGE_COMPUTE_BIT);
   VkDescriptorSetLayoutCreateInfo compute_layout_create_info = {};
   compute_layout_create_info.sType =
       VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
   compute_layout_create_info.pNext = 0;
   compute_layout_create_info.flags = 0;
-  compute_layout_create_info.bindingCount = 1;
-  compute_layout_create_info.pBindings = &compute_descriptor_set_layout_binding;
+  compute_layout_create_info.bindingCount =
+      compute_descriptor_set_layout_bindings.size();
+  compute_layout_create_info.pBindings =
+      compute_descriptor_set_layout_bindings.data();
   VkDescriptorSetLayout compute_descriptor_set_layout =
       createDescriptorLayoutFromCache(&device, &compute_layout_create_info);
 
@@ -357,43 +535,218 @@ int main(int argc, char **argv) {
   VkDescriptorSetLayout compute_descriptor_set_layout_ubo =
       createDescriptorLayoutFromCache(&device, &compute_ubo_layout_create_info);
 
-  VkPipelineShaderStageCreateInfo compute_stage_create_info =
-      pipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT,
-                                    compute_shader_module);
-
-  VkDescriptorSetLayoutBinding compute_ssbo_descriptor_set_layout_binding =
-      descriptorSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                                 VK_SHADER_STAGE_COMPUTE_BIT);
+  /* spheres, sphere BVH, mesh vertices, mesh indices, mesh BVHs, mesh infos,
+   * instances, instance BVH, sphere material indices, materials, ray stats,
+   * compressed sphere BVH, emissive spheres, light BVH, sphere light leaves,
+   * environment texels, environment CDF */
+  const uint32_t compute_ssbo_binding_count = 17;
+  std::vector<VkDescriptorSetLayoutBinding>
+      compute_ssbo_descriptor_set_layout_bindings;
+  for (uint32_t i = 0; i < compute_ssbo_binding_count; ++i) {
+    compute_ssbo_descriptor_set_layout_bindings.emplace_back(
+        descriptorSetLayoutBinding(i, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                   VK_SHADER_STAGE_COMPUTE_BIT));
+  }
   VkDescriptorSetLayoutCreateInfo compute_ssbo_layout_create_info = {};
   compute_ssbo_layout_create_info.sType =
       VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
   compute_ssbo_layout_create_info.pNext = 0;
   compute_ssbo_layout_create_info.flags = 0;
-  compute_ssbo_layout_create_info.bindingCount = 1;
+  compute_ssbo_layout_create_info.bindingCount =
+      compute_ssbo_descriptor_set_layout_bindings.size();
   compute_ssbo_layout_create_info.pBindings =
-      &compute_ssbo_descriptor_set_layout_binding;
+      compute_ssbo_descriptor_set_layout_bindings.data();
 
   VkDescriptorSetLayout compute_descriptor_set_layout_ssbo =
       createDescriptorLayoutFromCache(&device,
                                       &compute_ssbo_layout_create_info);
 
-  VulkanPipeline compute_pipeline;
-  if (!createComputePipeline(&device,
-                             std::vector<VkDescriptorSetLayout>{
-                                 compute_descriptor_set_layout,
-                                 compute_descriptor_set_layout_ubo,
-                                 compute_descriptor_set_layout_ssbo},
-                             compute_stage_create_info, &compute_pipeline)) {
-    FATAL("Failed to create a compute pipeline!");
+  std::vector<VkDescriptorSetLayoutBinding>
+      wavefront_descriptor_set_layout_bindings;
+  for (uint32_t i = 0; i < wavefront_binding_count; ++i) {
+    wavefront_descriptor_set_layout_bindings.emplace_back(
+        descriptorSetLayoutBinding(i, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                   VK_SHADER_STAGE_COMPUTE_BIT));
+  }
+  VkDescriptorSetLayoutCreateInfo wavefront_layout_create_info = {};
+  wavefront_layout_create_info.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  wavefront_layout_create_info.pNext = 0;
+  wavefront_layout_create_info.flags = 0;
+  wavefront_layout_create_info.bindingCount =
+      wavefront_descriptor_set_layout_bindings.size();
+  wavefront_layout_create_info.pBindings =
+      wavefront_descriptor_set_layout_bindings.data();
+
+  VkDescriptorSetLayout compute_descriptor_set_layout_wavefront =
+      createDescriptorLayoutFromCache(&device, &wavefront_layout_create_info);
+
+  /* matches MAX_MATERIAL_TEXTURES in ray_tracing.glsl, the slots the scene
+   * leaves empty hold a placeholder */
+  const uint32_t max_material_textures = 64;
+  VkDescriptorSetLayoutBinding material_texture_layout_binding =
+      descriptorSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                 VK_SHADER_STAGE_COMPUTE_BIT);
+  material_texture_layout_binding.descriptorCount = max_material_textures;
+  VkDescriptorSetLayoutCreateInfo material_texture_layout_create_info = {};
+  material_texture_layout_create_info.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  material_texture_layout_create_info.pNext = 0;
+  material_texture_layout_create_info.flags = 0;
+  material_texture_layout_create_info.bindingCount = 1;
+  material_texture_layout_create_info.pBindings =
+      &material_texture_layout_binding;
+
+  VkDescriptorSetLayout compute_descriptor_set_layout_textures =
+      createDescriptorLayoutFromCache(&device,
+                                      &material_texture_layout_create_info);
+
+  /* the path tracing kernels, see wavefront.h */
+  WavefrontRenderer wavefront = {};
+  for (uint32_t i = 0; i < WAVEFRONT_PASS_COUNT; ++i) {
+    VkShaderModule wavefront_shader_module;
+    if (!createShaderModule(&device,
+                            getWavefrontPassShaderPath((WavefrontPass)i),
+                            &wavefront_shader_module)) {
+      FATAL("Failed to create a compute shader module!");
+      exit(1);
+    }
+
+    if (!createComputePipeline(&device,
+                               std::vector<VkDescriptorSetLayout>{
+                                   compute_descriptor_set_layout,
+                                   compute_descriptor_set_layout_ubo,
+                                   compute_descriptor_set_layout_ssbo,
+                                   compute_descriptor_set_layout_wavefront,
+                                   compute_descriptor_set_layout_textures},
+                               pipelineShaderStageCreateInfo(
+                                   VK_SHADER_STAGE_COMPUTE_BIT,
+                                   wavefront_shader_module),
+                               sizeof(WavefrontPushConstants),
+                               &wavefront.pipelines[i])) {
+      FATAL("Failed to create a compute pipeline!");
+      exit(1);
+    }
+
+    vkDestroyShaderModule(device.logical_device, wavefront_shader_module, 0);
+  }
+
+  std::vector<VkDescriptorSetLayoutBinding>
+      gpu_bvh_descriptor_set_layout_bindings;
+  for (uint32_t i = 0; i < gpu_bvh_binding_count; ++i) {
+    gpu_bvh_descriptor_set_layout_bindings.emplace_back(
+        descriptorSetLayoutBinding(i, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                   VK_SHADER_STAGE_COMPUTE_BIT));
+  }
+  VkDescriptorSetLayoutCreateInfo gpu_bvh_layout_create_info = {};
+  gpu_bvh_layout_create_info.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  gpu_bvh_layout_create_info.pNext = 0;
+  gpu_bvh_layout_create_info.flags = 0;
+  gpu_bvh_layout_create_info.bindingCount =
+      gpu_bvh_descriptor_set_layout_bindings.size();
+  gpu_bvh_layout_create_info.pBindings =
+      gpu_bvh_descriptor_set_layout_bindings.data();
+
+  VkDescriptorSetLayout gpu_bvh_descriptor_set_layout =
+      createDescriptorLayoutFromCache(&device, &gpu_bvh_layout_create_info);
+
+  /* the passes that build the sphere BVH on the GPU, see gpu_bvh.h */
+  GPUBVHBuilder gpu_bvh = {};
+  for (uint32_t i = 0; i < GPU_BVH_PASS_COUNT; ++i) {
+    VkShaderModule gpu_bvh_shader_module;
+    if (!createShaderModule(&device, getGPUBVHPassShaderPath((GPUBVHPass)i),
+                            &gpu_bvh_shader_module)) {
+      FATAL("Failed to create a compute shader module!");
+      exit(1);
+    }
+
+    if (!createComputePipeline(
+            &device,
+            std::vector<VkDescriptorSetLayout>{gpu_bvh_descriptor_set_layout},
+            pipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT,
+                                          gpu_bvh_shader_module),
+            sizeof(GPUBVHPushConstants), &gpu_bvh.pipelines[i])) {
+      FATAL("Failed to create a compute pipeline!");
+      exit(1);
+    }
+
+    vkDestroyShaderModule(device.logical_device, gpu_bvh_shader_module, 0);
+  }
+
+  GBuffer gbuffer = {};
+  if (!createGBuffer(&device, vma_allocator, render_width, render_height,
+                     &gbuffer)) {
+    FATAL("Failed to create a G-buffer!");
     exit(1);
   }
 
-  vkDestroyShaderModule(device.logical_device, compute_shader_module, 0);
+  std::vector<VkDescriptorSetLayoutBinding>
+      gbuffer_descriptor_set_layout_bindings;
+  gbuffer_descriptor_set_layout_bindings.emplace_back(
+      descriptorSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                                 VK_SHADER_STAGE_VERTEX_BIT |
+                                     VK_SHADER_STAGE_FRAGMENT_BIT));
+  for (uint32_t i = 1; i < gbuffer_binding_count; ++i) {
+    gbuffer_descriptor_set_layout_bindings.emplace_back(
+        descriptorSetLayoutBinding(i, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                   VK_SHADER_STAGE_VERTEX_BIT |
+                                       VK_SHADER_STAGE_FRAGMENT_BIT));
+  }
+  VkDescriptorSetLayoutCreateInfo gbuffer_layout_create_info = {};
+  gbuffer_layout_create_info.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  gbuffer_layout_create_info.pNext = 0;
+  gbuffer_layout_create_info.flags = 0;
+  gbuffer_layout_create_info.bindingCount =
+      gbuffer_descriptor_set_layout_bindings.size();
+  gbuffer_layout_create_info.pBindings =
+      gbuffer_descriptor_set_layout_bindings.data();
+
+  VkDescriptorSetLayout gbuffer_descriptor_set_layout =
+      createDescriptorLayoutFromCache(&device, &gbuffer_layout_create_info);
+
+  /* the raster passes of the first hits, see gbuffer.h */
+  for (uint32_t i = 0; i < GBUFFER_PASS_COUNT; ++i) {
+    VkShaderModule gbuffer_vertex_shader_module;
+    VkShaderModule gbuffer_fragment_shader_module;
+    if (!createShaderModule(&device,
+                            getGBufferPassShaderPath(
+                                (GBufferPass)i, VK_SHADER_STAGE_VERTEX_BIT),
+                            &gbuffer_vertex_shader_module) ||
+        !createShaderModule(&device,
+                            getGBufferPassShaderPath(
+                                (GBufferPass)i, VK_SHADER_STAGE_FRAGMENT_BIT),
+                            &gbuffer_fragment_shader_module)) {
+      FATAL("Failed to load a shader!");
+      exit(1);
+    }
+
+    std::vector<VkPipelineShaderStageCreateInfo> gbuffer_pipeline_stages;
+    gbuffer_pipeline_stages.emplace_back(pipelineShaderStageCreateInfo(
+        VK_SHADER_STAGE_VERTEX_BIT, gbuffer_vertex_shader_module));
+    gbuffer_pipeline_stages.emplace_back(pipelineShaderStageCreateInfo(
+        VK_SHADER_STAGE_FRAGMENT_BIT, gbuffer_fragment_shader_module));
+
+    if (!createGraphicsPipeline(
+            &device, gbuffer.render_pass,
+            std::vector<VkDescriptorSetLayout>{gbuffer_descriptor_set_layout},
+            gbuffer_pipeline_stages, 3, false, true,
+            sizeof(GBufferPushConstants), &gbuffer.pipelines[i])) {
+      FATAL("Failed to create a graphics pipeline!");
+      exit(1);
+    }
+
+    vkDestroyShaderModule(device.logical_device, gbuffer_vertex_shader_module,
+                          0);
+    vkDestroyShaderModule(device.logical_device,
+                          gbuffer_fragment_shader_module, 0);
+  }
 
   VulkanTexture texture;
   if (!createTexture(
-          &device, vma_allocator, VK_FORMAT_R8G8B8A8_UNORM, window_width,
-          window_height,
+          &device, vma_allocator, VK_FORMAT_R8G8B8A8_UNORM, render_width,
+          render_height, 1,
           // VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
           VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
               VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
@@ -401,8 +754,8 @@ int main(int argc, char **argv) {
     FATAL("Failed to create a texture!")
     exit(1);
   }
-  void *pixels = malloc(window_width * window_height * 4);
-  memset(pixels, 0, window_width * window_height * 4);
+  void *pixels = malloc(render_width * render_height * 4);
+  memset(pixels, 0, render_width * render_height * 4);
   writeTextureData(&texture, &device, pixels, vma_allocator, graphics_queue,
                    graphics_command_pool, graphics_family_index);
   free(pixels);
@@ -470,14 +823,27 @@ int main(int argc, char **argv) {
 
   descriptor_builder = {};
 
+  VulkanTexture *compute_textures[] = {&texture, &gbuffer.position,
+                                       &gbuffer.normal, &gbuffer.material};
+  std::vector<VkDescriptorImageInfo> compute_image_infos(
+      compute_image_binding_count);
+  for (uint32_t i = 0; i < compute_image_binding_count; ++i) {
+    compute_image_infos[i].sampler = compute_textures[i]->sampler;
+    compute_image_infos[i].imageView = compute_textures[i]->view;
+    compute_image_infos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+  }
+
   VkDescriptorSet compute_texture_descriptor_set;
   if (!beginDescriptorBuilder(&descriptor_builder)) {
     FATAL("Failed to create a descriptor set!");
     exit(1);
   }
-  bindDescriptorBuilderImage(0, &descriptor_image_info,
-                             VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-                             VK_SHADER_STAGE_COMPUTE_BIT, &descriptor_builder);
+  for (uint32_t i = 0; i < compute_image_binding_count; ++i) {
+    bindDescriptorBuilderImage(i, &compute_image_infos[i],
+                               VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                               VK_SHADER_STAGE_COMPUTE_BIT,
+                               &descriptor_builder);
+  }
   if (!endDescriptorBuilder(&descriptor_builder, &device,
                             &compute_texture_descriptor_set)) {
     FATAL("Failed to create a descriptor set!");
@@ -514,65 +880,492 @@ int main(int argc, char **argv) {
     exit(1);
   }
 
-  std::vector<Sphere> spheres;
-  spheres.resize(3);
-  int index = 0;
-  spheres[index].position = glm::vec3(0, 0, -5);
-  spheres[index].radius = 1.0;
-  spheres[index].material.colour = glm::vec4(0.5, 0.5, 0.5, 1.0);
-  spheres[index].material.emission_colour = glm::vec4(0);
-  spheres[index].material.specular_colour = glm::vec4(1.0, 1.0, 1.0, 0.5);
-
-  index = 1;
-  spheres[index].position = glm::vec3(3, 0, -5);
-  spheres[index].radius = 1.0;
-  spheres[index].material.colour = glm::vec4(0.8, 0.2, 0.2, 0.5);
-  spheres[index].material.emission_colour = glm::vec4(0);
-  spheres[index].material.specular_colour = glm::vec4(1.0, 1.0, 1.0, 0.0);
-
-  index = 2;
-  spheres[index].position = glm::vec3(0, -101, -5);
-  spheres[index].radius = 100.0;
-  spheres[index].material.colour = glm::vec4(0.2, 0.8, 0.05, 0.0);
-  spheres[index].material.emission_colour = glm::vec4(0);
-  spheres[index].material.specular_colour = glm::vec4(1.0, 1.0, 1.0, 0.0);
+  Scene scene;
+  scene.bvh_builder = bvh_builder;
+  if (random_sphere_count > 0) {
+    createRandomSpheresScene(random_sphere_count, 0, &scene);
+  } else if (closed_room) {
+    createClosedRoomScene(&scene);
+  } else {
+    createDefaultScene(&scene);
+  }
+  addSceneLights(&scene, light_count, 1);
+  if (!buildSceneBVH(&scene)) {
+    FATAL("Failed to build a scene BVH!");
+    exit(1);
+  }
+
+  for (uint32_t i = 0; i < model_paths.size(); ++i) {
+    std::vector<Mesh> meshes;
+    if (!loadMesh(model_paths[i], &meshes)) {
+      FATAL("Failed to load a mesh!");
+      exit(1);
+    }
+
+    uint32_t first_mesh = scene.meshes.size();
+    glm::vec3 model_min = glm::vec3(FLT_MAX);
+    glm::vec3 model_max = glm::vec3(-FLT_MAX);
+    for (Mesh &mesh : meshes) {
+      if (!buildMeshBVH(&mesh, scene.bvh_builder)) {
+        FATAL("Failed to build a mesh BVH!");
+        exit(1);
+      }
+      if (!mesh.albedo_texture_path.empty()) {
+        mesh.material.albedo_texture =
+            addSceneTexture(&scene, mesh.albedo_texture_path.c_str());
+      }
+      if (!mesh.roughness_texture_path.empty()) {
+        mesh.material.roughness_texture =
+            addSceneTexture(&scene, mesh.roughness_texture_path.c_str());
+      }
+      mesh.material_index = addSceneMaterial(&scene, mesh.material);
+      model_min = glm::min(model_min, mesh.bvh.nodes[0].bounds_min);
+      model_max = glm::max(model_max, mesh.bvh.nodes[0].bounds_max);
+      scene.meshes.emplace_back(mesh);
+    }
+
+    /* copies are laid out on a grid, they all share the same mesh BVHs. every
+     * sub-mesh of a copy is its own instance with the copy's transform */
+    uint32_t grid_size = glm::ceil(glm::sqrt((float)instances_per_model));
+    glm::vec3 model_extent = model_max - model_min;
+    float spacing = glm::max(model_extent.x, model_extent.z) * 1.25f;
+    for (uint32_t j = 0; j < instances_per_model; ++j) {
+      glm::vec3 offset = glm::vec3((j % grid_size) * spacing, 0.0f,
+                                   -(float)(j / grid_size) * spacing);
+
+      for (uint32_t k = first_mesh; k < scene.meshes.size(); ++k) {
+        Instance instance;
+        instance.transform = glm::translate(glm::mat4(1.0f), offset);
+        instance.mesh_index = k;
+        scene.instances.emplace_back(instance);
+      }
+    }
+  }
+
+  MeshGeometry mesh_geometry;
+  packMeshGeometry(scene.meshes, &mesh_geometry);
+
+  if (!buildSceneTLAS(&scene)) {
+    FATAL("Failed to build a scene TLAS!");
+    exit(1);
+  }
+  std::vector<InstanceInfo> instance_infos;
+  packSceneInstances(&scene, &instance_infos);
+  /* the TLAS is rebuilt in place when instances move, so its buffer is sized
+   * for the largest tree the builder can produce */
+  std::vector<BVHNode> instance_bvh_nodes = scene.instance_bvh.nodes;
+  instance_bvh_nodes.resize(
+      scene.instances.empty() ? 0 : scene.instances.size() * 2 - 1);
+  /* same for the sphere BVH, which gets rebuilt once refitting degrades it */
+  std::vector<BVHNode> sphere_bvh_nodes = scene.sphere_bvh.nodes;
+  sphere_bvh_nodes.resize(scene.spheres.size() * 2 - 1);
+  std::vector<CompressedBVHNode> sphere_compressed_bvh_nodes =
+      scene.sphere_compressed_bvh.nodes;
+  sphere_compressed_bvh_nodes.resize(
+      getCompressedBVHNodeCapacity(scene.spheres.size()));
 
   VulkanBuffer compute_ssbo;
-  if (!createBuffer(vma_allocator, spheres.size() * sizeof(Sphere),
-                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-                        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                    VMA_MEMORY_USAGE_GPU_ONLY, &compute_ssbo)) {
+  if (!createStorageBuffer(&device, vma_allocator, scene.spheres.data(),
+                           scene.spheres.size() * sizeof(Sphere),
+                           graphics_queue, graphics_command_pool,
+                           &compute_ssbo)) {
+    FATAL("Failed to create a SSBO!");
+    exit(1);
+  }
+  VulkanBuffer bvh_ssbo;
+  if (!createStorageBuffer(&device, vma_allocator, sphere_bvh_nodes.data(),
+                           sphere_bvh_nodes.size() * sizeof(BVHNode),
+                           graphics_queue, graphics_command_pool, &bvh_ssbo)) {
+    FATAL("Failed to create a SSBO!");
+    exit(1);
+  }
+  VulkanBuffer compressed_bvh_ssbo;
+  if (!createStorageBuffer(
+          &device, vma_allocator, sphere_compressed_bvh_nodes.data(),
+          sphere_compressed_bvh_nodes.size() * sizeof(CompressedBVHNode),
+          graphics_queue, graphics_command_pool, &compressed_bvh_ssbo)) {
+    FATAL("Failed to create a SSBO!");
+    exit(1);
+  }
+  VulkanBuffer mesh_vertex_ssbo;
+  if (!createStorageBuffer(
+          &device, vma_allocator, mesh_geometry.vertices.data(),
+          mesh_geometry.vertices.size() * sizeof(MeshVertex), graphics_queue,
+          graphics_command_pool, &mesh_vertex_ssbo)) {
+    FATAL("Failed to create a SSBO!");
+    exit(1);
+  }
+  VulkanBuffer mesh_index_ssbo;
+  if (!createStorageBuffer(&device, vma_allocator,
+                           mesh_geometry.indices.data(),
+                           mesh_geometry.indices.size() * sizeof(uint32_t),
+                           graphics_queue, graphics_command_pool,
+                           &mesh_index_ssbo)) {
+    FATAL("Failed to create a SSBO!");
+    exit(1);
+  }
+  VulkanBuffer mesh_bvh_ssbo;
+  if (!createStorageBuffer(&device, vma_allocator, mesh_geometry.nodes.data(),
+                           mesh_geometry.nodes.size() * sizeof(BVHNode),
+                           graphics_queue, graphics_command_pool,
+                           &mesh_bvh_ssbo)) {
+    FATAL("Failed to create a SSBO!");
+    exit(1);
+  }
+  VulkanBuffer mesh_info_ssbo;
+  if (!createStorageBuffer(&device, vma_allocator, mesh_geometry.infos.data(),
+                           mesh_geometry.infos.size() * sizeof(MeshInfo),
+                           graphics_queue, graphics_command_pool,
+                           &mesh_info_ssbo)) {
+    FATAL("Failed to create a SSBO!");
+    exit(1);
+  }
+
+  VulkanBuffer instance_ssbo;
+  if (!createStorageBuffer(&device, vma_allocator, instance_infos.data(),
+                           instance_infos.size() * sizeof(InstanceInfo),
+                           graphics_queue, graphics_command_pool,
+                           &instance_ssbo)) {
     FATAL("Failed to create a SSBO!");
     exit(1);
   }
-  if (!loadBufferDataStaging(&compute_ssbo, &device, vma_allocator,
-                             spheres.data(), graphics_queue,
-                             graphics_command_pool)) {
-    FATAL("Failed to load SSBO data!");
+  VulkanBuffer instance_bvh_ssbo;
+  if (!createStorageBuffer(&device, vma_allocator, instance_bvh_nodes.data(),
+                           instance_bvh_nodes.size() * sizeof(BVHNode),
+                           graphics_queue, graphics_command_pool,
+                           &instance_bvh_ssbo)) {
+    FATAL("Failed to create a SSBO!");
     exit(1);
   }
 
+  VulkanBuffer sphere_material_ssbo;
+  if (!createStorageBuffer(
+          &device, vma_allocator, scene.sphere_material_indices.data(),
+          scene.sphere_material_indices.size() * sizeof(uint32_t),
+          graphics_queue, graphics_command_pool, &sphere_material_ssbo)) {
+    FATAL("Failed to create a SSBO!");
+    exit(1);
+  }
+  VulkanBuffer emissive_sphere_ssbo;
+  if (!createStorageBuffer(
+          &device, vma_allocator, scene.emissive_spheres.data(),
+          scene.emissive_spheres.size() * sizeof(uint32_t), graphics_queue,
+          graphics_command_pool, &emissive_sphere_ssbo)) {
+    FATAL("Failed to create a SSBO!");
+    exit(1);
+  }
+  VulkanBuffer light_bvh_ssbo;
+  if (!createStorageBuffer(
+          &device, vma_allocator, scene.light_bvh.nodes.data(),
+          scene.light_bvh.nodes.size() * sizeof(LightBVHNode), graphics_queue,
+          graphics_command_pool, &light_bvh_ssbo)) {
+    FATAL("Failed to create a SSBO!");
+    exit(1);
+  }
+  VulkanBuffer sphere_light_leaf_ssbo;
+  if (!createStorageBuffer(
+          &device, vma_allocator, scene.sphere_light_leaves.data(),
+          scene.sphere_light_leaves.size() * sizeof(uint32_t), graphics_queue,
+          graphics_command_pool, &sphere_light_leaf_ssbo)) {
+    FATAL("Failed to create a SSBO!");
+    exit(1);
+  }
+  VulkanBuffer material_ssbo;
+  if (!createStorageBuffer(&device, vma_allocator, scene.materials.data(),
+                           scene.materials.size() * sizeof(RayTracingMaterial),
+                           graphics_queue, graphics_command_pool,
+                           &material_ssbo)) {
+    FATAL("Failed to create a SSBO!");
+    exit(1);
+  }
+  /* left empty without a map, the shaders check its size first */
+  EnvironmentMap environment_map = {};
+  if (environment_path &&
+      !loadEnvironmentMap(environment_path, &environment_map)) {
+    FATAL("Failed to load an environment map!");
+    exit(1);
+  }
+  VulkanBuffer environment_texel_ssbo;
+  if (!createStorageBuffer(
+          &device, vma_allocator, environment_map.texels.data(),
+          environment_map.texels.size() * sizeof(glm::vec4), graphics_queue,
+          graphics_command_pool, &environment_texel_ssbo)) {
+    FATAL("Failed to create a SSBO!");
+    exit(1);
+  }
+  VulkanBuffer environment_cdf_ssbo;
+  if (!createStorageBuffer(&device, vma_allocator, environment_map.cdf.data(),
+                           environment_map.cdf.size() * sizeof(float),
+                           graphics_queue, graphics_command_pool,
+                           &environment_cdf_ssbo)) {
+    FATAL("Failed to create a SSBO!");
+    exit(1);
+  }
+
+  INFO("Scene materials: %u unique for %u spheres and %u meshes",
+       (uint32_t)scene.materials.size(), (uint32_t)scene.spheres.size(),
+       (uint32_t)scene.meshes.size());
+
+  if (scene.texture_paths.size() > max_material_textures) {
+    FATAL("The scene has %u material textures, at most %u are supported!",
+          (uint32_t)scene.texture_paths.size(), max_material_textures);
+    exit(1);
+  }
+  /* colours are stored in sRGB, roughness is linear */
+  std::vector<VkFormat> material_texture_formats(scene.texture_paths.size(),
+                                                 VK_FORMAT_R8G8B8A8_SRGB);
+  for (const RayTracingMaterial &material : scene.materials) {
+    if (material.roughness_texture > 0) {
+      material_texture_formats[material.roughness_texture - 1] =
+          VK_FORMAT_R8G8B8A8_UNORM;
+    }
+  }
+  std::vector<VulkanTexture> material_textures(scene.texture_paths.size());
+  for (uint32_t i = 0; i < material_textures.size(); ++i) {
+    if (!loadTexture(scene.texture_paths[i].c_str(),
+                     material_texture_formats[i], &device, vma_allocator,
+                     graphics_queue, graphics_command_pool,
+                     graphics_family_index, &material_textures[i])) {
+      FATAL("Failed to load a material texture!");
+      exit(1);
+    }
+  }
+  VulkanTexture placeholder_texture;
+  uint32_t placeholder_pixel = 0xFFFFFFFF;
+  if (!createTexture(&device, vma_allocator, VK_FORMAT_R8G8B8A8_UNORM, 1, 1, 1,
+                     VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                         VK_IMAGE_USAGE_SAMPLED_BIT,
+                     &placeholder_texture) ||
+      !writeTextureData(&placeholder_texture, &device, &placeholder_pixel,
+                        vma_allocator, graphics_queue, graphics_command_pool,
+                        graphics_family_index)) {
+    FATAL("Failed to create a texture!");
+    exit(1);
+  }
+  INFO("Material textures: %u", (uint32_t)material_textures.size());
+
+  std::vector<VkDescriptorImageInfo> material_texture_infos(
+      max_material_textures);
+  for (uint32_t i = 0; i < max_material_textures; ++i) {
+    VulkanTexture *material_texture = i < material_textures.size()
+                                          ? &material_textures[i]
+                                          : &placeholder_texture;
+    material_texture_infos[i].sampler = material_texture->sampler;
+    material_texture_infos[i].imageView = material_texture->view;
+    material_texture_infos[i].imageLayout =
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  }
+
   descriptor_builder = {};
 
-  VkDescriptorSet compute_ssbo_descriptor_set;
+  VkDescriptorSet material_texture_descriptor_set;
   if (!beginDescriptorBuilder(&descriptor_builder)) {
     FATAL("Failed to create a descriptor set!");
     exit(1);
   }
-  descriptor_buffer_info = {};
-  descriptor_buffer_info.buffer = compute_ssbo.handle;
-  descriptor_buffer_info.offset = 0;
-  descriptor_buffer_info.range = compute_ssbo.size;
-  bindDescriptorBuilderBuffer(0, &descriptor_buffer_info,
-                              VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+  bindDescriptorBuilderImages(0, material_texture_infos.data(),
+                              max_material_textures,
+                              VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
                               VK_SHADER_STAGE_COMPUTE_BIT, &descriptor_builder);
+  if (!endDescriptorBuilder(&descriptor_builder, &device,
+                            &material_texture_descriptor_set)) {
+    FATAL("Failed to create a descriptor set!");
+    exit(1);
+  }
+
+  /* cleared before every dispatch and read back once the frame is done */
+  VulkanBuffer ray_stats_buffer;
+  if (!createBuffer(vma_allocator, sizeof(RayStats),
+                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    VMA_MEMORY_USAGE_GPU_TO_CPU, &ray_stats_buffer)) {
+    FATAL("Failed to create a ray stats buffer!");
+    exit(1);
+  }
+  RayStats ray_stats = {};
+
+  std::vector<VulkanBuffer *> compute_ssbo_buffers = {
+      &compute_ssbo,           &bvh_ssbo,             &mesh_vertex_ssbo,
+      &mesh_index_ssbo,        &mesh_bvh_ssbo,        &mesh_info_ssbo,
+      &instance_ssbo,          &instance_bvh_ssbo,    &sphere_material_ssbo,
+      &material_ssbo,          &ray_stats_buffer,     &compressed_bvh_ssbo,
+      &emissive_sphere_ssbo,   &light_bvh_ssbo,       &sphere_light_leaf_ssbo,
+      &environment_texel_ssbo, &environment_cdf_ssbo};
+  assert(compute_ssbo_buffers.size() == compute_ssbo_binding_count);
+
+  descriptor_builder = {};
+
+  VkDescriptorSet compute_ssbo_descriptor_set;
+  if (!beginDescriptorBuilder(&descriptor_builder)) {
+    FATAL("Failed to create a descriptor set!");
+    exit(1);
+  }
+  std::vector<VkDescriptorBufferInfo> compute_ssbo_buffer_infos;
+  compute_ssbo_buffer_infos.resize(compute_ssbo_buffers.size());
+  for (uint32_t i = 0; i < compute_ssbo_buffers.size(); ++i) {
+    compute_ssbo_buffer_infos[i].buffer = compute_ssbo_buffers[i]->handle;
+    compute_ssbo_buffer_infos[i].offset = 0;
+    compute_ssbo_buffer_infos[i].range = compute_ssbo_buffers[i]->size;
+    bindDescriptorBuilderBuffer(i, &compute_ssbo_buffer_infos[i],
+                                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                VK_SHADER_STAGE_COMPUTE_BIT,
+                                &descriptor_builder);
+  }
   if (!endDescriptorBuilder(&descriptor_builder, &device,
                             &compute_ssbo_descriptor_set)) {
     FATAL("Failed to create a descriptor set!");
     exit(1);
   }
 
+  std::vector<VulkanBuffer *> gbuffer_buffers = {
+      &compute_ubo_buffer, &compute_ssbo,    &sphere_material_ssbo,
+      &mesh_vertex_ssbo,   &mesh_index_ssbo, &mesh_info_ssbo,
+      &instance_ssbo};
+  assert(gbuffer_buffers.size() == gbuffer_binding_count);
+
+  descriptor_builder = {};
+
+  if (!beginDescriptorBuilder(&descriptor_builder)) {
+    FATAL("Failed to create a descriptor set!");
+    exit(1);
+  }
+  std::vector<VkDescriptorBufferInfo> gbuffer_buffer_infos;
+  gbuffer_buffer_infos.resize(gbuffer_buffers.size());
+  for (uint32_t i = 0; i < gbuffer_buffers.size(); ++i) {
+    gbuffer_buffer_infos[i].buffer = gbuffer_buffers[i]->handle;
+    gbuffer_buffer_infos[i].offset = 0;
+    gbuffer_buffer_infos[i].range = gbuffer_buffers[i]->size;
+    bindDescriptorBuilderBuffer(
+        i, &gbuffer_buffer_infos[i],
+        i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+               : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+        &descriptor_builder);
+  }
+  if (!endDescriptorBuilder(&descriptor_builder, &device,
+                            &gbuffer.descriptor_set)) {
+    FATAL("Failed to create a descriptor set!");
+    exit(1);
+  }
+
+  if (!createWavefrontBuffers(vma_allocator, texture.width, texture.height,
+                              &wavefront)) {
+    FATAL("Failed to create wavefront buffers!");
+    exit(1);
+  }
+  wavefront.sort_mode = ray_sort_mode;
+  wavefront.light_selection = light_selection;
+  wavefront.sequence = sequence;
+  wavefront.raster_primary = raster_primary;
+  glm::vec3 scene_bounds_min;
+  glm::vec3 scene_bounds_max;
+  getSceneBounds(&scene, &scene_bounds_min, &scene_bounds_max);
+  resetWavefrontGuide(&wavefront, scene_bounds_min, scene_bounds_max);
+
+  std::vector<VulkanBuffer *> wavefront_buffers = {
+      &wavefront.paths,                &wavefront.hits,
+      &wavefront.queue_state,          &wavefront.radiance,
+      &wavefront.sort_bins,            &wavefront.sort_keys,
+      &wavefront.path_order,           &wavefront.shadow_rays,
+      &wavefront.pixel_stats,          &wavefront.active_pixels,
+      &wavefront.accumulation,         &wavefront.reference,
+      &wavefront.features,             &wavefront.denoised,
+      &wavefront.history_accumulation, &wavefront.history_features,
+      &wavefront.radiance_cache,       &wavefront.guide_spatial,
+      &wavefront.guide_directions,     &wavefront.guide_training,
+      &wavefront.guide_vertices,       &wavefront.reservoirs};
+  assert(wavefront_buffers.size() == wavefront_binding_count);
+
+  descriptor_builder = {};
+
+  if (!beginDescriptorBuilder(&descriptor_builder)) {
+    FATAL("Failed to create a descriptor set!");
+    exit(1);
+  }
+  std::vector<VkDescriptorBufferInfo> wavefront_buffer_infos;
+  wavefront_buffer_infos.resize(wavefront_buffers.size());
+  for (uint32_t i = 0; i < wavefront_buffers.size(); ++i) {
+    wavefront_buffer_infos[i].buffer = wavefront_buffers[i]->handle;
+    wavefront_buffer_infos[i].offset = 0;
+    wavefront_buffer_infos[i].range = wavefront_buffers[i]->size;
+    bindDescriptorBuilderBuffer(i, &wavefront_buffer_infos[i],
+                                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                VK_SHADER_STAGE_COMPUTE_BIT,
+                                &descriptor_builder);
+  }
+  if (!endDescriptorBuilder(&descriptor_builder, &device,
+                            &wavefront.descriptor_set)) {
+    FATAL("Failed to create a descriptor set!");
+    exit(1);
+  }
+
+  if (!createGPUBVHBuffers(vma_allocator, scene.spheres.size(), &gpu_bvh)) {
+    FATAL("Failed to create GPU BVH buffers!");
+    exit(1);
+  }
+
+  std::vector<VulkanBuffer *> gpu_bvh_buffers = {
+      &compute_ssbo,   &bvh_ssbo,           &gpu_bvh.keys,
+      &gpu_bvh.values, &gpu_bvh.histograms, &gpu_bvh.parents,
+      &gpu_bvh.flags,  &gpu_bvh.state};
+  assert(gpu_bvh_buffers.size() == gpu_bvh_binding_count);
+
+  descriptor_builder = {};
+
+  if (!beginDescriptorBuilder(&descriptor_builder)) {
+    FATAL("Failed to create a descriptor set!");
+    exit(1);
+  }
+  std::vector<VkDescriptorBufferInfo> gpu_bvh_buffer_infos;
+  gpu_bvh_buffer_infos.resize(gpu_bvh_buffers.size());
+  for (uint32_t i = 0; i < gpu_bvh_buffers.size(); ++i) {
+    gpu_bvh_buffer_infos[i].buffer = gpu_bvh_buffers[i]->handle;
+    gpu_bvh_buffer_infos[i].offset = 0;
+    gpu_bvh_buffer_infos[i].range = gpu_bvh_buffers[i]->size;
+    bindDescriptorBuilderBuffer(i, &gpu_bvh_buffer_infos[i],
+                                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                VK_SHADER_STAGE_COMPUTE_BIT,
+                                &descriptor_builder);
+  }
+  if (!endDescriptorBuilder(&descriptor_builder, &device,
+                            &gpu_bvh.descriptor_set)) {
+    FATAL("Failed to create a descriptor set!");
+    exit(1);
+  }
+
+  /* builds the BVH once on the GPU and compares it node by node with the CPU
+   * reference, the application exits with the result */
+  bool gpu_bvh_validation_failed = false;
+  if (validate_gpu_bvh) {
+    calculateSceneMortonQuantization(&scene, &gpu_bvh.morton_origin,
+                                     &gpu_bvh.morton_inv_extent);
+    std::vector<BVHNode> gpu_nodes;
+    if (!readGPUBVHNodes(&gpu_bvh, &device, vma_allocator, &bvh_ssbo,
+                         compute_queue, compute_command_pool, &gpu_nodes)) {
+      FATAL("Failed to read back the GPU BVH!");
+      exit(1);
+    }
+
+    BVH reference_bvh;
+    buildSceneLBVHReference(&scene, &reference_bvh);
+
+    uint32_t first_mismatch = 0;
+    uint32_t mismatch_count =
+        compareBVHNodes(gpu_nodes, reference_bvh.nodes, &first_mismatch);
+    if (mismatch_count > 0) {
+      ERROR("GPU BVH differs from the CPU reference in %u of %u nodes, "
+            "first at node %u!",
+            mismatch_count, (uint32_t)reference_bvh.nodes.size(),
+            first_mismatch);
+      gpu_bvh_validation_failed = true;
+    } else {
+      INFO("GPU BVH matches the CPU reference: %u nodes, SAH cost %.2f",
+           (uint32_t)gpu_nodes.size(), reference_bvh.build_cost);
+    }
+  }
+
   VkDescriptorPoolSize pool_sizes[] = {
       {VK_DESCRIPTOR_TYPE_SAMPLER, 1000},
       {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1000},
@@ -621,11 +1414,20 @@ int main(int argc, char **argv) {
   ImGui_ImplVulkan_CreateFontsTexture();
 
   Camera camera;
-  createCamera(90, window_width / window_height, 0.01f, 10000.0f, &camera);
+  createCamera(90, (float)render_width / render_height, 0.01f, 10000.0f,
+               &camera);
+  camera.viewport_width = render_width;
+  camera.viewport_height = render_height;
 
   UniformBufferObject ubo = {};
-  ubo.render_settings.x = 50;
+  ubo.render_settings.x = 1;
   ubo.render_settings.y = 25;
+  /* z - how the spheres are traversed, the compressed layout is only built on
+   * the CPU */
+  if (use_gpu_bvh && sphere_traversal == SPHERE_TRAVERSAL_COMPRESSED_BVH) {
+    sphere_traversal = SPHERE_TRAVERSAL_BVH;
+  }
+  ubo.render_settings.z = sphere_traversal;
   ubo.ground_colour = glm::vec4(0.35, 0.3, 0.35, 1.0);
   ubo.sky_colour_horizon = glm::vec4(1.0);
   ubo.sky_colour_zenith = glm::vec4(0.078, 0.36, 0.72, 1.0);
@@ -634,13 +1436,44 @@ int main(int argc, char **argv) {
   ubo.sun_intensity = 0;
   ubo.defocus_strenght = 0.0;
   ubo.diverge_strength = 1.0;
-
-  bool running = true;
+  ubo.scene_counts.x = scene.instances.size();
+  ubo.scene_counts.y = scene.emissive_spheres.size();
+  ubo.scene_counts.z = environment_map.width;
+  ubo.scene_counts.w = environment_map.height;
+  ubo.adaptive_settings = glm::vec4(0.0f, 8.0f, 0.0f, 0.0f);
+  ubo.reprojection_settings = glm::vec4(0.0f, 1024.0f, 0.0f, 0.0f);
+  bool temporal_reprojection = true;
+
+  bool running = !validate_gpu_bvh;
   glm::ivec2 previous_mouse = {0, 0};
   uint32_t last_update_time = SDL_GetTicks();
+  float frame_time_ms = 0.0f;
+  /* when the view or the UI was last touched, the frame budget stays
+   * interactive until it has been left alone for a while */
+  uint32_t last_interaction_ms = SDL_GetTicks();
+  /* the samples per pixel of the frame the ray stats were counted over */
+  uint32_t ray_stats_sample_count = 1;
+  /* time spent on the current accumulation, to compare samplers by the time
+   * they take to reach an error */
+  float accumulation_time_ms = 0.0f;
+  bool capture_reference = false;
+  /* RMSE of the accumulation sampled every rmse_step_ms, unguided and
+   * guided, so both can be compared against the same reference */
+  const float rmse_step_ms = 250.0f;
+  std::vector<float> rmse_curves[2];
+  int selected_instance = 0;
+  bool animate_spheres = false;
+  float animation_time = 0.0f;
+  float bvh_rebuild_threshold = 1.5f;
+  float bvh_cost_ratio = 1.0f;
+  uint32_t bvh_refit_count = 0;
+  uint32_t bvh_rebuild_count = 0;
+  uint64_t bvh_upload_bytes = 0;
+  bool gpu_bvh_dirty = use_gpu_bvh;
+  bool cpu_bvh_dirty = false;
 
   while (running) {
-    uint32_t start_time_ms = SDL_GetTicks();
+    uint64_t start_counter = SDL_GetPerformanceCounter();
     SDL_Event event;
     Input::Begin();
 
@@ -689,16 +1522,44 @@ int main(int argc, char **argv) {
     Input::GetWheelMovement(&wheel_movement.x, &wheel_movement.y);
 
     bool camera_is_dirty = false;
+    bool instances_are_dirty = false;
+    /* a moved camera reprojects what has been accumulated rather than
+     * starting over */
+    bool camera_moved = false;
+    /* the radiance cache is in world space and survives the camera turning,
+     * every other reset empties it */
+    bool camera_rotated = false;
     if (Input::WasMouseButtonHeld(SDL_BUTTON_MIDDLE)) {
+      camera_rotated = true;
       cameraRotate(&camera, mouse_delta);
-      camera_is_dirty = true;
+      if (temporal_reprojection && ubo.frame.x > 0) {
+        camera_moved = true;
+      } else {
+        camera_is_dirty = true;
+      }
     }
 
+    ubo.previous_view = ubo.view;
+    ubo.previous_projection = ubo.projection;
+    ubo.previous_camera_position = ubo.camera_position;
     ubo.view = cameraGetViewMatrix(&camera);
     ubo.projection = cameraGetProjectionMatrix(&camera);
     ubo.viewport_size =
         glm::vec4(camera.viewport_width, camera.viewport_height, 0.0, 0.0);
     ubo.camera_position = glm::vec4(glm::vec3(0.0), 0.0);
+    ubo.reprojection_settings.x = camera_moved ? 1.0f : 0.0f;
+    wavefront.reproject_history = camera_moved;
+    /* read before this frame's animation moves the spheres, which only
+     * shifts a few origins into neighbouring sort cells */
+    getSceneBounds(&scene, &scene_bounds_min, &scene_bounds_max);
+    ubo.scene_bounds_min = glm::vec4(scene_bounds_min, 0.0f);
+    ubo.scene_bounds_max = glm::vec4(scene_bounds_max, 0.0f);
+    if (frame_budget.enabled) {
+      ubo.render_settings.x = frame_budget.sample_count;
+    }
+    /* the UI may change the samples once the shaders have been handed this
+     * frame's */
+    const uint32_t frame_sample_count = (uint32_t)ubo.render_settings.x;
 
     if (!loadBufferData(&compute_ubo_buffer, vma_allocator, &ubo)) {
       FATAL("Failed to load a buffer data!");
@@ -710,11 +1571,272 @@ int main(int argc, char **argv) {
     ImGui::NewFrame();
 
     if (ImGui::Begin("Render settings")) {
-      int samples = ubo.render_settings.x;
-      if (ImGui::DragInt("Number of Samples", &samples, 1.0f, 1, INT_MAX)) {
-        ubo.render_settings.x = samples;
+      ImGui::Text("Frame time: %.2f ms, GPU: %.2f ms", frame_time_ms,
+                  frame_budget.gpu_time_ms);
+
+      uint64_t ray_count = getRayStat(&ray_stats, RAY_STAT_RAYS);
+      if (ray_count > 0) {
+        ImGui::Text("Bytes per ray: %.1f (inlined materials: %.1f)",
+                    (double)getRayStat(&ray_stats, RAY_STAT_BYTES_READ) /
+                        ray_count,
+                    (double)getRayStat(&ray_stats,
+                                       RAY_STAT_LEGACY_BYTES_READ) /
+                        ray_count);
+      }
+
+      /* sorting only changes the order rays are traced and shaded in, so
+       * the image keeps accumulating */
+      int sort_mode = wavefront.sort_mode;
+      if (ImGui::Combo("Ray Sorting", &sort_mode, wavefront_sort_mode_names,
+                       WAVEFRONT_SORT_COUNT)) {
+        wavefront.sort_mode = (WavefrontSortMode)sort_mode;
+      }
+      ImGui::Checkbox("Coherence Stats", &wavefront.coherence_stats);
+      uint64_t extend_group_count =
+          getRayStat(&ray_stats, RAY_STAT_EXTEND_GROUPS);
+      uint64_t shade_group_count =
+          getRayStat(&ray_stats, RAY_STAT_SHADE_GROUPS);
+      if (wavefront.coherence_stats && extend_group_count > 0 &&
+          shade_group_count > 0) {
+        ImGui::Text("Unique spheres per group: %.1f, materials: %.1f",
+                    (double)getRayStat(&ray_stats, RAY_STAT_UNIQUE_SPHERES) /
+                        extend_group_count,
+                    (double)getRayStat(&ray_stats, RAY_STAT_UNIQUE_MATERIALS) /
+                        shade_group_count);
+      }
+
+      if (ImGui::Checkbox("Next Event Estimation",
+                          &wavefront.next_event_estimation)) {
+        camera_is_dirty = true;
+      }
+      int selection = wavefront.light_selection;
+      if (ImGui::Combo("Light Selection", &selection,
+                       wavefront_light_selection_names,
+                       WAVEFRONT_LIGHT_SELECTION_COUNT)) {
+        wavefront.light_selection = (WavefrontLightSelection)selection;
+        camera_is_dirty = true;
+      }
+      /* reservoirs pick the light of the first hits from many candidates
+       * and the picks of their neighbours and of the last frames */
+      if (ImGui::Checkbox("ReSTIR", &wavefront.reservoir_resampling)) {
+        camera_is_dirty = true;
+      }
+      int reservoir_bias = wavefront.reservoir_bias;
+      if (ImGui::Combo("Bias Correction", &reservoir_bias,
+                       wavefront_reservoir_bias_names,
+                       WAVEFRONT_RESERVOIR_BIAS_COUNT)) {
+        wavefront.reservoir_bias = (WavefrontReservoirBias)reservoir_bias;
+        camera_is_dirty = true;
+      }
+      /* both selections estimate the same light, so the one with the lower
+       * second moment per sample has the lower variance */
+      ImGui::Checkbox("Light Stats", &wavefront.light_stats);
+      uint64_t light_pick_count = getRayStat(&ray_stats, RAY_STAT_LIGHT_PICKS);
+      if (wavefront.light_stats && light_pick_count > 0) {
+        double mean = getRayStat(&ray_stats, RAY_STAT_LIGHT_CONTRIBUTION) /
+                      16.0 / light_pick_count;
+        double second_moment =
+            getRayStat(&ray_stats, RAY_STAT_LIGHT_CONTRIBUTION_SQUARED) /
+            256.0 / light_pick_count;
+        ImGui::Text("Light BVH nodes per pick: %.1f",
+                    (double)getRayStat(&ray_stats, RAY_STAT_LIGHT_NODES) /
+                        light_pick_count);
+        ImGui::Text("Light sample variance: %.4f, relative: %.2f",
+                    second_moment - mean * mean,
+                    mean > 0.0 ? second_moment / (mean * mean) - 1.0 : 0.0);
+      }
+
+      int sampler = wavefront.sequence;
+      if (ImGui::Combo("Sampler", &sampler, wavefront_sequence_names,
+                       WAVEFRONT_SEQUENCE_COUNT)) {
+        wavefront.sequence = (WavefrontSequence)sampler;
+        camera_is_dirty = true;
+      }
+      /* the reference is meant to be a long accumulation of the same view,
+       * the error of every later one is measured against it */
+      if (ImGui::Button("Capture Reference")) {
+        capture_reference = true;
+      }
+      ImGui::SameLine();
+      ImGui::Checkbox("Error Stats", &wavefront.error_stats);
+      if (wavefront.error_stats && wavefront.has_reference) {
+        double mean_squared_error =
+            getRayStat(&ray_stats, RAY_STAT_SQUARED_ERROR) / 65536.0 /
+            (texture.width * texture.height);
+        ImGui::Text("RMSE: %.5f after %.2f s", glm::sqrt(mean_squared_error),
+                    accumulation_time_ms / 1000.0f);
+
+        std::vector<float> *rmse_curve = &rmse_curves[wavefront.path_guiding];
+        if (accumulation_time_ms >= rmse_curve->size() * rmse_step_ms) {
+          rmse_curve->emplace_back((float)glm::sqrt(mean_squared_error));
+        }
+        float rmse_max = 0.0f;
+        for (uint32_t i = 0; i < 2; ++i) {
+          for (float rmse : rmse_curves[i]) {
+            rmse_max = glm::max(rmse_max, rmse);
+          }
+        }
+        ImGui::PlotLines("Unguided RMSE", rmse_curves[0].data(),
+                         rmse_curves[0].size(), 0, 0, 0.0f, rmse_max,
+                         ImVec2(0.0f, 40.0f));
+        ImGui::PlotLines("Guided RMSE", rmse_curves[1].data(),
+                         rmse_curves[1].size(), 0, 0, 0.0f, rmse_max,
+                         ImVec2(0.0f, 40.0f));
+      }
+
+      /* history gets reprojected when the camera moves and rejected where
+       * the surface it saw is gone, pixels keep at most the history length
+       * in samples */
+      ImGui::Checkbox("Temporal Reprojection", &temporal_reprojection);
+      float history_length = ubo.reprojection_settings.y;
+      if (ImGui::DragFloat("History Length", &history_length, 1.0f, 1.0f,
+                           FLT_MAX, "%.0f")) {
+        ubo.reprojection_settings.y = history_length;
+      }
+
+      /* the denoiser only filters what gets displayed, the accumulation
+       * underneath stays as it is */
+      ImGui::Checkbox("Denoise", &wavefront.denoise);
+      int denoise_iterations = wavefront.denoise_iteration_count;
+      if (ImGui::SliderInt("Denoise Iterations", &denoise_iterations, 1, 5)) {
+        wavefront.denoise_iteration_count = denoise_iterations;
+      }
+
+      /* roulette keeps the estimate unbiased, so the image keeps
+       * accumulating */
+      ImGui::Checkbox("Russian Roulette", &wavefront.russian_roulette);
+      int roulette_depth = wavefront.roulette_depth;
+      if (ImGui::DragInt("Roulette Depth", &roulette_depth, 1.0f, 1,
+                         INT_MAX)) {
+        wavefront.roulette_depth = roulette_depth;
+      }
+
+      /* paths past their first diffuse vertex end at cache cells with
+       * enough samples, which shortens them at the cost of some bias */
+      if (ImGui::Checkbox("Radiance Cache", &wavefront.radiance_cache)) {
+        camera_is_dirty = true;
+      }
+      ImGui::SameLine();
+      ImGui::Checkbox("Cache Debug View", &wavefront.cache_debug);
+
+      uint64_t path_count = getRayStat(&ray_stats, RAY_STAT_ACTIVE_PIXELS) *
+                            (uint64_t)ray_stats_sample_count;
+      if (path_count > 0 && frame_time_ms > 0.0f) {
+        ImGui::Text("Path length: %.2f, rays: %.1f M/s",
+                    (double)getRayStat(&ray_stats, RAY_STAT_PATH_SEGMENTS) /
+                        path_count,
+                    getRayStat(&ray_stats, RAY_STAT_RAYS) / 1000.0 /
+                        frame_time_ms);
+      }
+      if (wavefront.radiance_cache && path_count > 0) {
+        ImGui::Text(
+            "Cache: %.1f%% of entries, %.1f%% of paths ended",
+            getRayStat(&ray_stats, RAY_STAT_CACHE_ENTRIES) * 100.0 /
+                wavefront_cache_entry_count,
+            getRayStat(&ray_stats, RAY_STAT_CACHE_TERMINATIONS) * 100.0 /
+                path_count);
+      }
+
+      /* the camera rays aren't traced, the first hits come from a G-buffer
+       * rasterized at a Halton jitter that changes every frame */
+      if (ImGui::Checkbox("Raster Primary Hits", &wavefront.raster_primary)) {
+        camera_is_dirty = true;
+      }
+
+      /* the guide learns over the first frames after every reset and only
+       * starts sampling once its first iteration is in */
+      if (ImGui::Checkbox("Path Guiding", &wavefront.path_guiding)) {
+        camera_is_dirty = true;
+      }
+      if (wavefront.path_guiding) {
+        ImGui::Text("Guide: iteration %u/%u, %zu leaves, %zu nodes",
+                    wavefront.guide.iteration, guide_iteration_count,
+                    (wavefront.guide.spatial_nodes.size() + 1) / 2,
+                    wavefront.guide.direction_nodes.size());
+      }
+
+      /* converged pixels stop being traced until the accumulation restarts,
+       * which a changed threshold forces */
+      float noise_threshold = ubo.adaptive_settings.x;
+      if (ImGui::DragFloat("Noise Threshold", &noise_threshold, 0.001f, 0.0f,
+                           1.0f, "%.3f")) {
+        ubo.adaptive_settings.x = noise_threshold;
         camera_is_dirty = true;
       }
+      uint32_t pixel_count = texture.width * texture.height;
+      if (ubo.adaptive_settings.x > 0.0f) {
+        ImGui::Text("Active pixels: %.1f%%",
+                    100.0 * getRayStat(&ray_stats, RAY_STAT_ACTIVE_PIXELS) /
+                        pixel_count);
+      }
+
+      int traversal = sphere_traversal;
+      if (ImGui::Combo("Sphere Traversal", &traversal, sphere_traversal_names,
+                       SPHERE_TRAVERSAL_COUNT)) {
+        sphere_traversal = (SphereTraversal)traversal;
+        if (use_gpu_bvh &&
+            sphere_traversal == SPHERE_TRAVERSAL_COMPRESSED_BVH) {
+          use_gpu_bvh = false;
+          cpu_bvh_dirty = true;
+        }
+        camera_is_dirty = true;
+      }
+
+      /* the GPU builds from the spheres as they are, switching back has the
+       * CPU catch up with the positions it missed. it only builds the binary
+       * layout */
+      if (ImGui::Checkbox("Build BVH on GPU", &use_gpu_bvh)) {
+        gpu_bvh_dirty = use_gpu_bvh;
+        cpu_bvh_dirty = !use_gpu_bvh;
+        if (use_gpu_bvh &&
+            sphere_traversal == SPHERE_TRAVERSAL_COMPRESSED_BVH) {
+          sphere_traversal = SPHERE_TRAVERSAL_BVH;
+        }
+        camera_is_dirty = true;
+      }
+      ubo.render_settings.z = sphere_traversal;
+
+      if (use_gpu_bvh) {
+        ImGui::Text("BVH (gpu lbvh): %u nodes, rebuilt with the spheres",
+                    gpu_bvh.sphere_count * 2 - 1);
+      } else {
+        ImGui::Text("BVH (%s): %u nodes, SAH cost %.2f, built in %.2f ms",
+                    getBVHBuilderName(scene.bvh_builder),
+                    (uint32_t)scene.sphere_bvh.nodes.size(),
+                    scene.sphere_bvh.build_cost,
+                    scene.sphere_bvh.build_time_ms);
+        ImGui::Text("BVH memory: %.2f KB binary, %.2f KB compressed",
+                    scene.sphere_bvh.nodes.size() * sizeof(BVHNode) / 1024.0f,
+                    scene.sphere_compressed_bvh.nodes.size() *
+                        sizeof(CompressedBVHNode) / 1024.0f);
+      }
+
+      ImGui::Checkbox("Animate Spheres", &animate_spheres);
+      ImGui::DragFloat("BVH Rebuild Threshold", &bvh_rebuild_threshold, 0.01f,
+                       1.0f, FLT_MAX);
+      ImGui::Text("BVH refits: %u, rebuilds: %u", bvh_refit_count,
+                  bvh_rebuild_count);
+      ImGui::Text("BVH SAH cost ratio: %.3f, upload: %.2f KB", bvh_cost_ratio,
+                  bvh_upload_bytes / 1024.0f);
+
+      /* the samples of a frame follow the GPU time it took, so the frame
+       * rate holds while the view changes and the accumulation runs at the
+       * throughput of the idle budget once it stops */
+      ImGui::Checkbox("Frame Budget", &frame_budget.enabled);
+      if (frame_budget.enabled) {
+        ImGui::DragFloat("Interactive Budget (ms)",
+                         &frame_budget.interactive_budget_ms, 0.5f, 1.0f,
+                         1000.0f);
+        ImGui::DragFloat("Idle Budget (ms)", &frame_budget.idle_budget_ms,
+                         0.5f, 1.0f, 1000.0f);
+        ImGui::Text("Samples per frame: %u, %.3f ms per sample",
+                    frame_budget.sample_count, frame_budget.ms_per_sample);
+      } else {
+        int samples = ubo.render_settings.x;
+        if (ImGui::DragInt("Number of Samples", &samples, 1.0f, 1, INT_MAX)) {
+          ubo.render_settings.x = samples;
+        }
+      }
       int bounce_count = ubo.render_settings.y;
       if (ImGui::DragInt("Bounce Count", &bounce_count, 1.0f, 1, INT_MAX)) {
         ubo.render_settings.y = bounce_count;
@@ -777,16 +1899,235 @@ int main(int argc, char **argv) {
       ImGui::End();
     }
 
+    if (!scene.instances.empty() && ImGui::Begin("Instances")) {
+      ImGui::SliderInt("Instance", &selected_instance, 0,
+                       scene.instances.size() - 1);
+
+      Instance &instance = scene.instances[selected_instance];
+      glm::vec3 translation = glm::vec3(instance.transform[3]);
+      if (ImGui::DragFloat3("Translation", &translation.x, 0.1f)) {
+        instance.transform[3] = glm::vec4(translation, 1.0f);
+        instances_are_dirty = true;
+        camera_is_dirty = true;
+      }
+
+      ImGui::End();
+    }
+
     ImGui::Render();
 
     vkDeviceWaitIdle(device.logical_device);
 
+    /* moving an instance only touches the top level, the mesh BVHs stay */
+    if (instances_are_dirty) {
+      if (!buildSceneTLAS(&scene)) {
+        FATAL("Failed to build a scene TLAS!");
+        exit(1);
+      }
+      packSceneInstances(&scene, &instance_infos);
+      instance_bvh_nodes = scene.instance_bvh.nodes;
+      instance_bvh_nodes.resize(scene.instances.size() * 2 - 1);
+
+      if (!loadBufferDataStaging(&instance_ssbo, &device, vma_allocator,
+                                 instance_infos.data(), graphics_queue,
+                                 graphics_command_pool)) {
+        FATAL("Failed to load SSBO data!");
+        exit(1);
+      }
+      if (!loadBufferDataStaging(&instance_bvh_ssbo, &device, vma_allocator,
+                                 instance_bvh_nodes.data(), graphics_queue,
+                                 graphics_command_pool)) {
+        FATAL("Failed to load SSBO data!");
+        exit(1);
+      }
+    }
+
+    bool sphere_bvh_rebuilt = false;
+    if (cpu_bvh_dirty) {
+      if (!buildSceneBVH(&scene)) {
+        FATAL("Failed to build a scene BVH!");
+        exit(1);
+      }
+      sphere_bvh_rebuilt = true;
+      cpu_bvh_dirty = false;
+    }
+
+    /* animated spheres only refit the BVH and copy the node and sphere ranges
+     * that changed, a degraded BVH is rebuilt and uploaded whole. when the GPU
+     * builds the BVH only the spheres are copied */
+    if (animate_spheres) {
+      animation_time += frame_time_ms / 1000.0f;
+
+      std::vector<uint32_t> dirty_spheres;
+      animateScene(&scene, animation_time, &dirty_spheres);
+
+      std::vector<VkBufferCopy> sphere_regions;
+      mergeBufferCopyRegions(dirty_spheres, sizeof(Sphere), &sphere_regions);
+      if (!loadBufferDataStagingRegions(
+              &compute_ssbo, &device, vma_allocator, scene.spheres.data(),
+              sphere_regions, graphics_queue, graphics_command_pool)) {
+        FATAL("Failed to load SSBO data!");
+        exit(1);
+      }
+      bvh_upload_bytes = dirty_spheres.size() * sizeof(Sphere);
+
+      /* the light BVH is small next to the spheres, so it goes up whole */
+      if (!scene.emissive_spheres.empty()) {
+        refitSceneLightBVH(&scene);
+        if (!loadBufferDataStaging(&light_bvh_ssbo, &device, vma_allocator,
+                                   scene.light_bvh.nodes.data(),
+                                   graphics_queue, graphics_command_pool)) {
+          FATAL("Failed to load SSBO data!");
+          exit(1);
+        }
+        bvh_upload_bytes += light_bvh_ssbo.size;
+      }
+
+      if (use_gpu_bvh) {
+        gpu_bvh_dirty = true;
+      } else {
+        bool bvh_rebuilt = false;
+        std::vector<uint32_t> dirty_nodes;
+        std::vector<uint32_t> dirty_compressed_nodes;
+        if (!updateSceneBVH(&scene, bvh_rebuild_threshold, &bvh_rebuilt,
+                            &bvh_cost_ratio, &dirty_nodes,
+                            &dirty_compressed_nodes)) {
+          FATAL("Failed to update a scene BVH!");
+          exit(1);
+        }
+
+        if (bvh_rebuilt) {
+          sphere_bvh_rebuilt = true;
+          bvh_rebuild_count++;
+        } else {
+          std::vector<VkBufferCopy> node_regions;
+          mergeBufferCopyRegions(dirty_nodes, sizeof(BVHNode), &node_regions);
+          if (!loadBufferDataStagingRegions(
+                  &bvh_ssbo, &device, vma_allocator,
+                  scene.sphere_bvh.nodes.data(), node_regions, graphics_queue,
+                  graphics_command_pool)) {
+            FATAL("Failed to load SSBO data!");
+            exit(1);
+          }
+          std::vector<VkBufferCopy> compressed_node_regions;
+          mergeBufferCopyRegions(dirty_compressed_nodes,
+                                 sizeof(CompressedBVHNode),
+                                 &compressed_node_regions);
+          if (!loadBufferDataStagingRegions(
+                  &compressed_bvh_ssbo, &device, vma_allocator,
+                  scene.sphere_compressed_bvh.nodes.data(),
+                  compressed_node_regions, graphics_queue,
+                  graphics_command_pool)) {
+            FATAL("Failed to load SSBO data!");
+            exit(1);
+          }
+
+          bvh_upload_bytes += dirty_nodes.size() * sizeof(BVHNode) +
+                              dirty_compressed_nodes.size() *
+                                  sizeof(CompressedBVHNode);
+          bvh_refit_count++;
+        }
+      }
+
+      camera_is_dirty = true;
+    }
+
+    /* a rebuild reorders the spheres, so everything indexed by them goes up
+     * whole */
+    if (sphere_bvh_rebuilt) {
+      sphere_bvh_nodes = scene.sphere_bvh.nodes;
+      sphere_bvh_nodes.resize(scene.spheres.size() * 2 - 1);
+      sphere_compressed_bvh_nodes = scene.sphere_compressed_bvh.nodes;
+      sphere_compressed_bvh_nodes.resize(
+          getCompressedBVHNodeCapacity(scene.spheres.size()));
+
+      if (!loadBufferDataStaging(&compute_ssbo, &device, vma_allocator,
+                                 scene.spheres.data(), graphics_queue,
+                                 graphics_command_pool)) {
+        FATAL("Failed to load SSBO data!");
+        exit(1);
+      }
+      if (!loadBufferDataStaging(&bvh_ssbo, &device, vma_allocator,
+                                 sphere_bvh_nodes.data(), graphics_queue,
+                                 graphics_command_pool)) {
+        FATAL("Failed to load SSBO data!");
+        exit(1);
+      }
+      if (!loadBufferDataStaging(&compressed_bvh_ssbo, &device, vma_allocator,
+                                 sphere_compressed_bvh_nodes.data(),
+                                 graphics_queue, graphics_command_pool)) {
+        FATAL("Failed to load SSBO data!");
+        exit(1);
+      }
+      if (!loadBufferDataStaging(&sphere_material_ssbo, &device, vma_allocator,
+                                 scene.sphere_material_indices.data(),
+                                 graphics_queue, graphics_command_pool)) {
+        FATAL("Failed to load SSBO data!");
+        exit(1);
+      }
+
+      /* the materials didn't change, so neither did the emissive count or
+       * the size of the light BVH */
+      if (!scene.emissive_spheres.empty()) {
+        if (!loadBufferDataStaging(&emissive_sphere_ssbo, &device,
+                                   vma_allocator, scene.emissive_spheres.data(),
+                                   graphics_queue, graphics_command_pool) ||
+            !loadBufferDataStaging(&light_bvh_ssbo, &device, vma_allocator,
+                                   scene.light_bvh.nodes.data(),
+                                   graphics_queue, graphics_command_pool) ||
+            !loadBufferDataStaging(&sphere_light_leaf_ssbo, &device,
+                                   vma_allocator,
+                                   scene.sphere_light_leaves.data(),
+                                   graphics_queue, graphics_command_pool)) {
+          FATAL("Failed to load SSBO data!");
+          exit(1);
+        }
+      }
+
+      bvh_upload_bytes = compute_ssbo.size + bvh_ssbo.size +
+                         compressed_bvh_ssbo.size + sphere_material_ssbo.size +
+                         emissive_sphere_ssbo.size + light_bvh_ssbo.size +
+                         sphere_light_leaf_ssbo.size;
+    }
+
     vkWaitForFences(device.logical_device, 1,
                     &compute_in_flight_fences[current_frame], VK_TRUE,
                     UINT64_MAX);
     vkResetFences(device.logical_device, 1,
                   &compute_in_flight_fences[current_frame]);
 
+    /* the last frame is done with the guide buffers */
+    updateWavefrontGuide(&wavefront, vma_allocator);
+
+    /* the first hits are rasterized on the graphics queue, the compute
+     * submit waits for them */
+    if (wavefront.raster_primary) {
+      VkCommandBuffer gbuffer_command_buffer =
+          gbuffer_command_buffers[current_frame];
+      beginCommandBuffer(gbuffer_command_buffer, 0);
+      recordGBufferPass(&gbuffer, gbuffer_command_buffer,
+                        getGBufferJitter(ubo.frame.x),
+                        scene.spheres.size(), instance_infos,
+                        mesh_geometry.infos, graphics_family_index,
+                        compute_family_index);
+      vkEndCommandBuffer(gbuffer_command_buffer);
+
+      VkSubmitInfo gbuffer_submit_info = {};
+      gbuffer_submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      gbuffer_submit_info.pNext = 0;
+      gbuffer_submit_info.waitSemaphoreCount = 0;
+      gbuffer_submit_info.commandBufferCount = 1;
+      gbuffer_submit_info.pCommandBuffers = &gbuffer_command_buffer;
+      gbuffer_submit_info.signalSemaphoreCount = 1;
+      gbuffer_submit_info.pSignalSemaphores =
+          &gbuffer_finished_semaphores[current_frame];
+
+      if (vkQueueSubmit(graphics_queue, 1, &gbuffer_submit_info, 0) !=
+          VK_SUCCESS) {
+        ERROR("Vulkan queue submit failed.");
+      }
+    }
+
     VkCommandBuffer compute_command_buffer =
         compute_command_buffers[current_frame];
     beginCommandBuffer(compute_command_buffer, 0);
@@ -816,20 +2157,53 @@ int main(int argc, char **argv) {
                            1, &image_memory_barrier);
     }
 
-    vkCmdBindPipeline(compute_command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
-                      compute_pipeline.handle);
-    vkCmdBindDescriptorSets(
-        compute_command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
-        compute_pipeline.layout, 0, 1, &compute_texture_descriptor_set, 0, 0);
-    vkCmdBindDescriptorSets(
-        compute_command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
-        compute_pipeline.layout, 1, 1, &compute_ubo_descriptor_set, 0, 0);
-    vkCmdBindDescriptorSets(
-        compute_command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
-        compute_pipeline.layout, 2, 1, &compute_ssbo_descriptor_set, 0, 0);
+    if (wavefront.raster_primary) {
+      recordGBufferAcquire(&gbuffer, compute_command_buffer,
+                           graphics_family_index, compute_family_index);
+    }
 
-    vkCmdDispatch(compute_command_buffer, texture.width / 16,
-                  texture.height / 16, 1);
+    vkCmdFillBuffer(compute_command_buffer, ray_stats_buffer.handle, 0,
+                    VK_WHOLE_SIZE, 0);
+
+    VkMemoryBarrier ray_stats_barrier = {};
+    ray_stats_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    ray_stats_barrier.pNext = 0;
+    ray_stats_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    ray_stats_barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(compute_command_buffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &ray_stats_barrier, 0, 0, 0, 0);
+
+    recordFrameBudgetBegin(&frame_budget, compute_command_buffer);
+
+    if (use_gpu_bvh && gpu_bvh_dirty) {
+      calculateSceneMortonQuantization(&scene, &gpu_bvh.morton_origin,
+                                       &gpu_bvh.morton_inv_extent);
+      recordGPUBVHBuild(&gpu_bvh, compute_command_buffer);
+      gpu_bvh_dirty = false;
+    }
+
+    recordWavefrontFrame(&wavefront, compute_command_buffer,
+                         compute_texture_descriptor_set,
+                         compute_ubo_descriptor_set,
+                         compute_ssbo_descriptor_set,
+                         material_texture_descriptor_set, frame_sample_count,
+                         (uint32_t)ubo.render_settings.y);
+    if (capture_reference) {
+      recordWavefrontReferenceCapture(&wavefront, compute_command_buffer);
+      capture_reference = false;
+    }
+
+    recordFrameBudgetEnd(&frame_budget, compute_command_buffer);
+
+    ray_stats_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    ray_stats_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(compute_command_buffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &ray_stats_barrier,
+                         0, 0, 0, 0);
 
     if (graphics_family_index != compute_family_index) {
       image_memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
@@ -856,6 +2230,12 @@ int main(int argc, char **argv) {
     //     ubo.frame == 0 ? 0 : &render_finished_semaphores[current_frame];
     // compute_submit_info.pWaitDstStageMask =
     //     ubo.frame == 0 ? 0 : &wait_dst_stage_mask;
+    if (wavefront.raster_primary) {
+      compute_submit_info.waitSemaphoreCount = 1;
+      compute_submit_info.pWaitSemaphores =
+          &gbuffer_finished_semaphores[current_frame];
+      compute_submit_info.pWaitDstStageMask = &wait_dst_stage_mask;
+    }
     compute_submit_info.commandBufferCount = 1;
     compute_submit_info.pCommandBuffers =
         &compute_command_buffers[current_frame];
@@ -863,6 +2243,7 @@ int main(int argc, char **argv) {
     compute_submit_info.pSignalSemaphores =
         &compute_finished_semaphores[current_frame];
 
+    uint64_t compute_start_counter = SDL_GetPerformanceCounter();
     VkResult result = vkQueueSubmit(compute_queue, 1, &compute_submit_info,
                                     compute_in_flight_fences[current_frame]);
     if (result != VK_SUCCESS) {
@@ -872,6 +2253,24 @@ int main(int argc, char **argv) {
     vkWaitForFences(device.logical_device, 1,
                     &compute_in_flight_fences[current_frame], VK_TRUE,
                     UINT64_MAX);
+
+    memcpy(&ray_stats, lockBuffer(&ray_stats_buffer, vma_allocator),
+           sizeof(RayStats));
+    unlockBuffer(&ray_stats_buffer, vma_allocator);
+    ray_stats_sample_count = frame_sample_count;
+
+    if (camera_is_dirty || camera_moved || instances_are_dirty ||
+        animate_spheres || ImGui::GetIO().WantCaptureMouse) {
+      last_interaction_ms = SDL_GetTicks();
+    }
+    float compute_time_ms =
+        (SDL_GetPerformanceCounter() - compute_start_counter) * 1000.0f /
+        SDL_GetPerformanceFrequency();
+    updateFrameBudget(&frame_budget, &device, frame_sample_count,
+                      compute_time_ms,
+                      SDL_GetTicks() - last_interaction_ms >=
+                          frame_budget.idle_delay_ms);
+
     vkWaitForFences(device.logical_device, 1, &in_flight_fences[current_frame],
                     true, UINT64_MAX);
     VK_CHECK(vkResetFences(device.logical_device, 1,
@@ -1017,17 +2416,27 @@ int main(int argc, char **argv) {
 
     current_frame = (current_frame + 1) % swapchain.max_frames_in_flight;
 
-    const uint32_t ms_per_frame = 1000 / 120;
-    const uint32_t elapsed_time_ms = SDL_GetTicks() - start_time_ms;
-    if (elapsed_time_ms < ms_per_frame) {
-      SDL_Delay(ms_per_frame - elapsed_time_ms);
-    }
+    /* the frame budget paces the loop, the frame waits for its GPU work */
+    frame_time_ms = (SDL_GetPerformanceCounter() - start_counter) * 1000.0f /
+                    SDL_GetPerformanceFrequency();
 
     Input::GetMousePosition(&previous_mouse.x, &previous_mouse.y);
 
     ubo.frame.x++;
+    ubo.frame.y++;
+    ubo.frame.z += frame_sample_count;
+    accumulation_time_ms += frame_time_ms;
     if (camera_is_dirty) {
       ubo.frame.x = 0;
+      ubo.frame.z = 0;
+      accumulation_time_ms = 0.0f;
+      rmse_curves[wavefront.path_guiding].clear();
+      if (!camera_rotated) {
+        wavefront.clear_cache = true;
+        /* what the guide learned is tied to where the scene was */
+        getSceneBounds(&scene, &scene_bounds_min, &scene_bounds_max);
+        resetWavefrontGuide(&wavefront, scene_bounds_min, scene_bounds_max);
+      }
     }
   }
 
@@ -1041,12 +2450,21 @@ int main(int argc, char **argv) {
 
   shutdownDescriptorLayoutCache(&device);
 
-  destroyPipeline(&compute_pipeline, &device);
+  destroyWavefrontRenderer(&wavefront, &device, vma_allocator);
+  destroyGPUBVHBuilder(&gpu_bvh, &device, vma_allocator);
+  destroyGBuffer(&gbuffer, &device, vma_allocator);
+  destroyFrameBudget(&frame_budget, &device);
 
-  destroyBuffer(&compute_ssbo, vma_allocator);
+  for (uint32_t i = 0; i < compute_ssbo_buffers.size(); ++i) {
+    destroyBuffer(compute_ssbo_buffers[i], vma_allocator);
+  }
   destroyBuffer(&compute_ubo_buffer, vma_allocator);
 
   destroyTexture(&texture, &device, vma_allocator);
+  for (uint32_t i = 0; i < material_textures.size(); ++i) {
+    destroyTexture(&material_textures[i], &device, vma_allocator);
+  }
+  destroyTexture(&placeholder_texture, &device, vma_allocator);
 
   shutdownDescriptorAllocator(&device);
 
@@ -1055,6 +2473,9 @@ int main(int argc, char **argv) {
   vkFreeCommandBuffers(device.logical_device, graphics_command_pool,
                        graphics_command_buffers.size(),
                        graphics_command_buffers.data());
+  vkFreeCommandBuffers(device.logical_device, graphics_command_pool,
+                       gbuffer_command_buffers.size(),
+                       gbuffer_command_buffers.data());
   vkFreeCommandBuffers(device.logical_device, compute_command_pool,
                        compute_command_buffers.size(),
                        compute_command_buffers.data());
@@ -1068,6 +2489,8 @@ int main(int argc, char **argv) {
     vkDestroySemaphore(device.logical_device, compute_finished_semaphores[i],
                        0);
     vkDestroyFence(device.logical_device, compute_in_flight_fences[i], 0);
+    vkDestroySemaphore(device.logical_device, gbuffer_finished_semaphores[i],
+                       0);
   }
   for (uint32_t i = 0; i < framebuffers.size(); ++i) {
     vkDestroyFramebuffer(device.logical_device, framebuffers[i], 0);
@@ -1085,7 +2508,9 @@ int main(int argc, char **argv) {
 #endif
   vkDestroyInstance(instance, 0);
 
-  return 0;
+  shutdownThreadPool();
+
+  return gpu_bvh_validation_failed ? 1 : 0;
 }
 
 bool createInstance(VkApplicationInfo application_info, SDL_Window *window,
@@ -1381,7 +2806,7 @@ pipelineShaderStageCreateInfo(VkShaderStageFlagBits stage_flag,
   return pipeline_shader_stage_create_info;
 }
 
-bool loadTexture(const char *path, VulkanDevice *device,
+bool loadTexture(const char *path, VkFormat format, VulkanDevice *device,
                  VmaAllocator vma_allocator, VkQueue queue,
                  VkCommandPool command_pool, uint32_t queue_family_index,
                  VulkanTexture *out_texture) {
@@ -1389,21 +2814,53 @@ bool loadTexture(const char *path, VulkanDevice *device,
   stbi_set_flip_vertically_on_load(true);
   unsigned char *data = stbi_load(path, &texture_width, &texture_height,
                                   &texture_num_channels, STBI_rgb_alpha);
+  stbi_set_flip_vertically_on_load(false);
   if (!data) {
-    FATAL("Failed to load image at path %s!", path);
+    ERROR("Failed to load image at path %s!", path);
     return false;
   }
 
-  createTexture(device, vma_allocator, VK_FORMAT_R8G8B8A8_SRGB, texture_width,
-                VK_IMAGE_USAGE_TRANSFER_DST_BIT |
-                    VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
-                    VK_IMAGE_USAGE_SAMPLED_BIT,
-                texture_height, out_texture);
-  writeTextureData(out_texture, device, data, vma_allocator, queue,
-                   command_pool, queue_family_index);
-
-  stbi_set_flip_vertically_on_load(false);
+  /* the mip chain is blitted down from the image on upload */
+  bool loaded =
+      createTexture(device, vma_allocator, format, texture_width,
+                    texture_height,
+                    getTextureMipLevels(texture_width, texture_height),
+                    VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                        VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                        VK_IMAGE_USAGE_SAMPLED_BIT,
+                    out_texture) &&
+      writeTextureData(out_texture, device, data, vma_allocator, queue,
+                       command_pool, queue_family_index);
   stbi_image_free(data);
 
+  return loaded;
+}
+
+bool createStorageBuffer(VulkanDevice *device, VmaAllocator vma_allocator,
+                         void *data, uint64_t size, VkQueue queue,
+                         VkCommandPool command_pool, VulkanBuffer *out_buffer) {
+  /* empty storage buffers are not allowed, the shader never reads the
+   * placeholder since the element counts are zero */
+  bool is_empty = size == 0;
+  if (is_empty) {
+    size = 16;
+  }
+
+  if (!createBuffer(vma_allocator, size,
+                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                        VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                    VMA_MEMORY_USAGE_GPU_ONLY, out_buffer)) {
+    ERROR("Failed to create a storage buffer!");
+    return false;
+  }
+
+  if (!is_empty && !loadBufferDataStaging(out_buffer, device, vma_allocator,
+                                          data, queue, command_pool)) {
+    ERROR("Failed to load storage buffer data!");
+    return false;
+  }
+
   return true;
-}
\ No newline at end of file
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "glm/glm.hpp"
+
+struct RayTracingMaterial {
+  /* a - smoothness */
+  glm::vec4 colour;
+  /* a - emission strength */
+  glm::vec4 emission_colour;
+  /* a - specular probability */
+  glm::vec4 specular_colour;
+  /* index into Scene::texture_paths plus one, 0 for none. the albedo texture
+   * tints colour, the green channel of the roughness texture scales 1 -
+   * smoothness the way glTF stores it */
+  uint32_t albedo_texture;
+  uint32_t roughness_texture;
+  uint32_t padding[2];
+};
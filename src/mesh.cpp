@@ -0,0 +1,210 @@
+#include "mesh.h"
+
+#include "logger.h"
+
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+#include <float.h>
+#include <string.h>
+
+/* the first texture of the given type, relative to the directory of the
+ * model. empty when there is none or it is embedded in the file */
+static std::string getMaterialTexturePath(const char *path,
+                                          const aiMaterial *ai_material,
+                                          aiTextureType type) {
+  aiString texture_path;
+  if (ai_material->GetTexture(type, 0, &texture_path) != AI_SUCCESS) {
+    return std::string();
+  }
+  if (texture_path.C_Str()[0] == '*') {
+    WARN("Embedded texture %s of %s is not supported", texture_path.C_Str(),
+         path);
+    return std::string();
+  }
+
+  const char *separator = strrchr(path, '/');
+  std::string directory =
+      separator ? std::string(path, separator - path + 1) : std::string();
+  return directory + texture_path.C_Str();
+}
+
+static void loadMeshMaterial(const char *path, const aiMaterial *ai_material,
+                             Mesh *mesh) {
+  mesh->material = {};
+  mesh->material.colour = glm::vec4(0.5, 0.5, 0.5, 0.0);
+  mesh->material.emission_colour = glm::vec4(0);
+  mesh->material.specular_colour = glm::vec4(1.0, 1.0, 1.0, 0.0);
+  if (!ai_material) {
+    return;
+  }
+
+  aiColor3D diffuse;
+  if (ai_material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuse) == AI_SUCCESS) {
+    mesh->material.colour =
+        glm::vec4(diffuse.r, diffuse.g, diffuse.b, mesh->material.colour.w);
+  }
+  aiColor3D emissive;
+  if (ai_material->Get(AI_MATKEY_COLOR_EMISSIVE, emissive) == AI_SUCCESS &&
+      (emissive.r > 0 || emissive.g > 0 || emissive.b > 0)) {
+    mesh->material.emission_colour =
+        glm::vec4(emissive.r, emissive.g, emissive.b, 1.0);
+  }
+
+  mesh->albedo_texture_path =
+      getMaterialTexturePath(path, ai_material, aiTextureType_DIFFUSE);
+  if (mesh->albedo_texture_path.empty()) {
+    mesh->albedo_texture_path =
+        getMaterialTexturePath(path, ai_material, aiTextureType_BASE_COLOR);
+  }
+  mesh->roughness_texture_path = getMaterialTexturePath(
+      path, ai_material, aiTextureType_DIFFUSE_ROUGHNESS);
+}
+
+bool loadMesh(const char *path, std::vector<Mesh> *out_meshes) {
+  Assimp::Importer importer;
+  const aiScene *ai_scene = importer.ReadFile(
+      path, aiProcess_Triangulate | aiProcess_GenSmoothNormals |
+                aiProcess_JoinIdenticalVertices |
+                aiProcess_PreTransformVertices);
+  if (!ai_scene || !ai_scene->mRootNode ||
+      (ai_scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE)) {
+    ERROR("Failed to load a mesh at path %s: %s", path,
+          importer.GetErrorString());
+    return false;
+  }
+
+  /* every sub-mesh becomes a mesh of its own so it keeps its material */
+  uint32_t first_mesh = out_meshes->size();
+  uint32_t vertex_count = 0;
+  uint32_t triangle_count = 0;
+  for (uint32_t i = 0; i < ai_scene->mNumMeshes; ++i) {
+    const aiMesh *ai_mesh = ai_scene->mMeshes[i];
+
+    Mesh mesh = {};
+    for (uint32_t j = 0; j < ai_mesh->mNumVertices; ++j) {
+      MeshVertex vertex = {};
+      vertex.position =
+          glm::vec3(ai_mesh->mVertices[j].x, ai_mesh->mVertices[j].y,
+                    ai_mesh->mVertices[j].z);
+      if (ai_mesh->HasNormals()) {
+        vertex.normal =
+            glm::vec3(ai_mesh->mNormals[j].x, ai_mesh->mNormals[j].y,
+                      ai_mesh->mNormals[j].z);
+      }
+      if (ai_mesh->HasTextureCoords(0)) {
+        vertex.u = ai_mesh->mTextureCoords[0][j].x;
+        vertex.v = ai_mesh->mTextureCoords[0][j].y;
+      }
+
+      mesh.vertices.emplace_back(vertex);
+    }
+
+    for (uint32_t j = 0; j < ai_mesh->mNumFaces; ++j) {
+      const aiFace &face = ai_mesh->mFaces[j];
+      if (face.mNumIndices != 3) {
+        continue;
+      }
+
+      mesh.indices.emplace_back(face.mIndices[0]);
+      mesh.indices.emplace_back(face.mIndices[1]);
+      mesh.indices.emplace_back(face.mIndices[2]);
+    }
+
+    /* points and lines are left out by the triangle check above */
+    if (mesh.indices.empty()) {
+      continue;
+    }
+
+    const aiMaterial *ai_material =
+        ai_scene->HasMaterials() ? ai_scene->mMaterials[ai_mesh->mMaterialIndex]
+                                 : 0;
+    loadMeshMaterial(path, ai_material, &mesh);
+
+    vertex_count += mesh.vertices.size();
+    triangle_count += mesh.indices.size() / 3;
+    out_meshes->emplace_back(mesh);
+  }
+
+  if (out_meshes->size() == first_mesh) {
+    ERROR("Mesh at path %s has no triangles!", path);
+    return false;
+  }
+
+  INFO("Loaded a mesh at path %s: %u sub-meshes, %u vertices, %u triangles",
+       path, (uint32_t)out_meshes->size() - first_mesh, vertex_count,
+       triangle_count);
+
+  return true;
+}
+
+bool buildMeshBVH(Mesh *mesh, BVHBuilder builder) {
+  const uint32_t triangle_count = mesh->indices.size() / 3;
+
+  std::vector<BVHPrimitive> primitives;
+  primitives.resize(triangle_count);
+  for (uint32_t i = 0; i < triangle_count; ++i) {
+    glm::vec3 a = mesh->vertices[mesh->indices[i * 3 + 0]].position;
+    glm::vec3 b = mesh->vertices[mesh->indices[i * 3 + 1]].position;
+    glm::vec3 c = mesh->vertices[mesh->indices[i * 3 + 2]].position;
+
+    primitives[i].bounds_min = glm::min(a, glm::min(b, c));
+    primitives[i].bounds_max = glm::max(a, glm::max(b, c));
+    primitives[i].centroid = (a + b + c) / 3.0f;
+  }
+
+  if (!buildBVH(primitives, builder, &mesh->bvh)) {
+    ERROR("Failed to build a mesh BVH!");
+    return false;
+  }
+
+  std::vector<uint32_t> ordered_indices;
+  ordered_indices.resize(mesh->indices.size());
+  for (uint32_t i = 0; i < triangle_count; ++i) {
+    uint32_t triangle = mesh->bvh.primitive_indices[i];
+    ordered_indices[i * 3 + 0] = mesh->indices[triangle * 3 + 0];
+    ordered_indices[i * 3 + 1] = mesh->indices[triangle * 3 + 1];
+    ordered_indices[i * 3 + 2] = mesh->indices[triangle * 3 + 2];
+  }
+  mesh->indices = ordered_indices;
+
+  INFO("Built a mesh BVH (%s): %u triangles, %u nodes, SAH cost %.2f, %.2f ms",
+       getBVHBuilderName(builder), triangle_count,
+       (uint32_t)mesh->bvh.nodes.size(), mesh->bvh.build_cost,
+       mesh->bvh.build_time_ms);
+
+  return true;
+}
+
+void packMeshGeometry(const std::vector<Mesh> &meshes,
+                      MeshGeometry *out_geometry) {
+  out_geometry->vertices.clear();
+  out_geometry->indices.clear();
+  out_geometry->nodes.clear();
+  out_geometry->infos.clear();
+
+  for (uint32_t i = 0; i < meshes.size(); ++i) {
+    const Mesh &mesh = meshes[i];
+    uint32_t vertex_offset = out_geometry->vertices.size();
+    uint32_t triangle_offset = out_geometry->indices.size() / 3;
+    uint32_t node_offset = out_geometry->nodes.size();
+
+    out_geometry->vertices.insert(out_geometry->vertices.end(),
+                                  mesh.vertices.begin(), mesh.vertices.end());
+    for (uint32_t j = 0; j < mesh.indices.size(); ++j) {
+      out_geometry->indices.emplace_back(vertex_offset + mesh.indices[j]);
+    }
+    for (uint32_t j = 0; j < mesh.bvh.nodes.size(); ++j) {
+      BVHNode node = mesh.bvh.nodes[j];
+      node.left_first += node.count > 0 ? triangle_offset : node_offset;
+      out_geometry->nodes.emplace_back(node);
+    }
+
+    MeshInfo info = {};
+    info.root_node = node_offset;
+    info.triangle_count = mesh.indices.size() / 3;
+    info.material_index = mesh.material_index;
+    info.first_triangle = triangle_offset;
+    out_geometry->infos.emplace_back(info);
+  }
+}
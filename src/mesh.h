@@ -0,0 +1,56 @@
+#pragma once
+
+#include "bvh.h"
+#include "material.h"
+
+#include "glm/glm.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* uv is packed into the w components to keep the vertex at 32 bytes */
+struct MeshVertex {
+  glm::vec3 position;
+  float u;
+  glm::vec3 normal;
+  float v;
+};
+
+struct Mesh {
+  std::vector<MeshVertex> vertices;
+  /* three per triangle, reordered to match the BVH leaves */
+  std::vector<uint32_t> indices;
+  BVH bvh;
+  RayTracingMaterial material;
+  /* images of the material, empty without one. the scene hands out their
+   * texture slots when the mesh is added */
+  std::string albedo_texture_path;
+  std::string roughness_texture_path;
+  /* index into the scene material table, assigned when added to a scene */
+  uint32_t material_index;
+};
+
+/* matches MeshInfo in ray_tracing.glsl */
+struct MeshInfo {
+  uint32_t root_node;
+  uint32_t triangle_count;
+  uint32_t material_index;
+  /* where the triangles of the mesh start in the shared index buffer, the
+   * raster pass draws them from there */
+  uint32_t first_triangle;
+};
+
+/* every mesh packed into shared buffers, with the node, triangle and vertex
+ * offsets already applied */
+struct MeshGeometry {
+  std::vector<MeshVertex> vertices;
+  std::vector<uint32_t> indices;
+  std::vector<BVHNode> nodes;
+  std::vector<MeshInfo> infos;
+};
+
+/* appends one mesh per sub-mesh of the model, each with its own material */
+bool loadMesh(const char *path, std::vector<Mesh> *out_meshes);
+bool buildMeshBVH(Mesh *mesh, BVHBuilder builder);
+void packMeshGeometry(const std::vector<Mesh> &meshes,
+                      MeshGeometry *out_geometry);
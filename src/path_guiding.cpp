@@ -0,0 +1,242 @@
+#include "path_guiding.h"
+
+#include <math.h>
+
+/* matches GUIDE_ENERGY_SCALE in path_guiding.glsl */
+static const double energy_scale = 1024.0;
+/* share of the energy of a quadtree a quadrant needs to be subdivided */
+static const double subdivision_threshold = 0.01;
+/* Müller et al. split a leaf past c * sqrt(2^iteration) samples */
+static const double spatial_threshold = 12000.0;
+static const uint32_t max_direction_depth = 20;
+/* subdivisions stop short of the capacity, leaving room for the root of
+ * every spatial leaf there can be */
+static const uint32_t direction_node_limit =
+    guide_max_direction_nodes - guide_max_spatial_nodes;
+static const uint32_t leaf_axis = 3;
+
+void resetPathGuide(glm::vec3 bounds_min, glm::vec3 bounds_max,
+                    PathGuide *out_guide) {
+  /* a cube keeps the cells of the halving splits close to cubes as well */
+  glm::vec3 size = bounds_max - bounds_min;
+  float extent = glm::max(size.x, glm::max(size.y, size.z));
+  out_guide->bounds_min = bounds_min;
+  out_guide->bounds_max = bounds_min + glm::vec3(extent);
+
+  GuideSpatialNode root = {};
+  root.child = 0;
+  root.axis = leaf_axis;
+  out_guide->spatial_nodes.clear();
+  out_guide->spatial_nodes.emplace_back(root);
+
+  out_guide->direction_nodes.clear();
+  out_guide->direction_nodes.emplace_back(GuideDirectionNode{});
+
+  out_guide->training_frame = 0;
+  out_guide->iteration = 0;
+}
+
+bool isPathGuideTraining(const PathGuide *guide) {
+  return guide->iteration < guide_iteration_count;
+}
+
+bool isPathGuideTrained(const PathGuide *guide) {
+  return guide->iteration > 0;
+}
+
+bool endPathGuideFrame(PathGuide *guide) {
+  guide->training_frame++;
+  /* iteration i ends after frame 2^(i + 1) - 1 */
+  return (guide->training_frame & (guide->training_frame + 1)) == 0;
+}
+
+static double getTrainedEnergy(const GuideTraining *training, uint32_t node,
+                               uint32_t quadrant) {
+  uint32_t index = (node * 4 + quadrant) * 2;
+  uint64_t value = (uint64_t)training->energies[index] |
+                   ((uint64_t)training->energies[index + 1] << 32);
+  return value / energy_scale;
+}
+
+static uint32_t copyDirectionTree(std::vector<GuideDirectionNode> *nodes,
+                                  uint32_t root) {
+  uint32_t copy_root = nodes->size();
+  GuideDirectionNode root_node = (*nodes)[root];
+  nodes->emplace_back(root_node);
+
+  /* pairs of a copied node and the node it was copied from */
+  std::vector<uint32_t> node_stack;
+  node_stack.emplace_back(copy_root);
+  node_stack.emplace_back(root);
+  while (!node_stack.empty()) {
+    uint32_t node = node_stack[node_stack.size() - 2];
+    uint32_t source = node_stack.back();
+    node_stack.resize(node_stack.size() - 2);
+
+    for (uint32_t quadrant = 0; quadrant < 4; ++quadrant) {
+      uint32_t source_child = (*nodes)[source].children[quadrant];
+      if (source_child == 0) {
+        continue;
+      }
+      uint32_t child = nodes->size();
+      GuideDirectionNode child_node = (*nodes)[source_child];
+      nodes->emplace_back(child_node);
+      (*nodes)[node].children[quadrant] = child;
+      node_stack.emplace_back(child);
+      node_stack.emplace_back(source_child);
+    }
+  }
+
+  return copy_root;
+}
+
+/* the quadtree of a leaf for the next iteration, appended to out_nodes. a
+ * tree that learned nothing is kept as it was */
+static uint32_t
+refineDirectionTree(const GuideTraining *training,
+                    const std::vector<GuideDirectionNode> &old_nodes,
+                    uint32_t old_root,
+                    std::vector<GuideDirectionNode> *out_nodes) {
+  double total = 0.0;
+  for (uint32_t quadrant = 0; quadrant < 4; ++quadrant) {
+    total += getTrainedEnergy(training, old_root, quadrant);
+  }
+
+  uint32_t root = out_nodes->size();
+  if (total <= 0.0) {
+    out_nodes->emplace_back(old_nodes[old_root]);
+    for (uint32_t quadrant = 0; quadrant < 4; ++quadrant) {
+      out_nodes->back().children[quadrant] = 0;
+    }
+    std::vector<uint32_t> node_stack;
+    node_stack.emplace_back(root);
+    node_stack.emplace_back(old_root);
+    while (!node_stack.empty()) {
+      uint32_t node = node_stack[node_stack.size() - 2];
+      uint32_t old_node = node_stack.back();
+      node_stack.resize(node_stack.size() - 2);
+      for (uint32_t quadrant = 0; quadrant < 4; ++quadrant) {
+        uint32_t old_child = old_nodes[old_node].children[quadrant];
+        if (old_child == 0 || out_nodes->size() >= direction_node_limit) {
+          continue;
+        }
+        uint32_t child = out_nodes->size();
+        out_nodes->emplace_back(old_nodes[old_child]);
+        for (uint32_t i = 0; i < 4; ++i) {
+          out_nodes->back().children[i] = 0;
+        }
+        (*out_nodes)[node].children[quadrant] = child;
+        node_stack.emplace_back(child);
+        node_stack.emplace_back(old_child);
+      }
+    }
+    return root;
+  }
+
+  GuideDirectionNode root_node = {};
+  for (uint32_t quadrant = 0; quadrant < 4; ++quadrant) {
+    root_node.energy[quadrant] =
+        (float)getTrainedEnergy(training, old_root, quadrant);
+  }
+  out_nodes->emplace_back(root_node);
+
+  /* triples of a new node, the old node it learned in or UINT32_MAX for
+   * one that didn't exist yet, and its depth */
+  std::vector<uint32_t> node_stack;
+  node_stack.emplace_back(root);
+  node_stack.emplace_back(old_root);
+  node_stack.emplace_back(0);
+  while (!node_stack.empty()) {
+    uint32_t node = node_stack[node_stack.size() - 3];
+    uint32_t old_node = node_stack[node_stack.size() - 2];
+    uint32_t depth = node_stack.back();
+    node_stack.resize(node_stack.size() - 3);
+
+    for (uint32_t quadrant = 0; quadrant < 4; ++quadrant) {
+      float energy = (*out_nodes)[node].energy[quadrant];
+      if (energy / total <= subdivision_threshold ||
+          depth + 1 >= max_direction_depth ||
+          out_nodes->size() >= direction_node_limit) {
+        continue;
+      }
+
+      /* a new quadrant spreads its energy evenly over its children until
+       * it has learned their share */
+      uint32_t old_child = old_node == UINT32_MAX
+                               ? UINT32_MAX
+                               : old_nodes[old_node].children[quadrant];
+      if (old_child == 0) {
+        old_child = UINT32_MAX;
+      }
+      GuideDirectionNode child_node = {};
+      for (uint32_t i = 0; i < 4; ++i) {
+        child_node.energy[i] =
+            old_child == UINT32_MAX
+                ? energy / 4.0f
+                : (float)getTrainedEnergy(training, old_child, i);
+      }
+
+      uint32_t child = out_nodes->size();
+      out_nodes->emplace_back(child_node);
+      (*out_nodes)[node].children[quadrant] = child;
+      node_stack.emplace_back(child);
+      node_stack.emplace_back(old_child);
+      node_stack.emplace_back(depth + 1);
+    }
+  }
+
+  return root;
+}
+
+void refinePathGuide(const GuideTraining *training, PathGuide *guide) {
+  const double sample_threshold =
+      spatial_threshold * sqrt((double)(1u << guide->iteration));
+
+  std::vector<GuideDirectionNode> old_nodes;
+  old_nodes.swap(guide->direction_nodes);
+
+  /* pairs of a node and its depth, the leaves split here are appended and
+   * only get visited next iteration */
+  std::vector<uint32_t> node_stack;
+  node_stack.emplace_back(0);
+  node_stack.emplace_back(0);
+  while (!node_stack.empty()) {
+    uint32_t node_index = node_stack[node_stack.size() - 2];
+    uint32_t depth = node_stack.back();
+    node_stack.resize(node_stack.size() - 2);
+
+    GuideSpatialNode node = guide->spatial_nodes[node_index];
+    if (node.axis != leaf_axis) {
+      node_stack.emplace_back(node.child);
+      node_stack.emplace_back(depth + 1);
+      node_stack.emplace_back(node.child + 1);
+      node_stack.emplace_back(depth + 1);
+      continue;
+    }
+
+    uint32_t root = refineDirectionTree(training, old_nodes, node.child,
+                                        &guide->direction_nodes);
+    guide->spatial_nodes[node_index].child = root;
+
+    uint32_t tree_size = guide->direction_nodes.size() - root;
+    if (training->sample_counts[node_index] <= sample_threshold ||
+        guide->spatial_nodes.size() + 2 > guide_max_spatial_nodes ||
+        guide->direction_nodes.size() + tree_size > direction_node_limit) {
+      continue;
+    }
+
+    GuideSpatialNode left = {};
+    left.child = root;
+    left.axis = leaf_axis;
+    GuideSpatialNode right = {};
+    right.child = copyDirectionTree(&guide->direction_nodes, root);
+    right.axis = leaf_axis;
+
+    guide->spatial_nodes[node_index].child = guide->spatial_nodes.size();
+    guide->spatial_nodes[node_index].axis = depth % 3;
+    guide->spatial_nodes.emplace_back(left);
+    guide->spatial_nodes.emplace_back(right);
+  }
+
+  guide->iteration++;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include <stdint.h>
+#include <vector>
+
+/* match GUIDE_* in path_guiding.glsl */
+const uint32_t guide_max_spatial_nodes = 1 << 16;
+const uint32_t guide_max_direction_nodes = 1 << 18;
+/* diffuse vertices of a path that train the guide, counted from the camera */
+const uint32_t guide_vertex_count = 4;
+const uint32_t guide_vertex_size = 32;
+/* iteration i trains over 2^i frames, so the guide stops learning after the
+ * first 2^guide_iteration_count - 1 frames */
+const uint32_t guide_iteration_count = 6;
+
+/* matches GuideSpatialNode in path_guiding.glsl. an inner node halves its box
+ * along axis and keeps its children at child and child + 1, a leaf has axis
+ * 3 and keeps the root of its directional quadtree in child */
+struct GuideSpatialNode {
+  uint32_t child;
+  uint32_t axis;
+};
+
+/* matches GuideDirectionNode in path_guiding.glsl. the quadrants of a square
+ * of the cylindrical mapping of the sphere, quadrant x + 2 * y. a child of 0
+ * marks a leaf quadrant, energy is the incident radiance learned over each
+ * quadrant and sums up the energy of its child */
+struct GuideDirectionNode {
+  uint32_t children[4];
+  float energy[4];
+};
+
+/* matches the start of GuideSpatialTree in path_guiding.glsl, the nodes
+ * follow */
+struct GuideSpatialHeader {
+  glm::vec4 bounds_min;
+  glm::vec4 bounds_max;
+};
+
+/* matches GuideTraining in path_guiding.glsl, what an iteration learned. the
+ * samples recorded in every spatial leaf, then the energy of every quadrant
+ * of every direction node in 64-bit fixed point as a low and a high word */
+struct GuideTraining {
+  uint32_t sample_counts[guide_max_spatial_nodes];
+  uint32_t energies[guide_max_direction_nodes * 4 * 2];
+};
+
+/* the spatial tree over the scene bounds and the directional quadtrees of
+ * its leaves, as the shaders sample them */
+struct PathGuide {
+  glm::vec3 bounds_min;
+  glm::vec3 bounds_max;
+  std::vector<GuideSpatialNode> spatial_nodes;
+  std::vector<GuideDirectionNode> direction_nodes;
+
+  /* frames trained since the reset and the iterations folded in so far */
+  uint32_t training_frame;
+  uint32_t iteration;
+};
+
+/* a single leaf with an empty quadtree, which the shaders don't sample until
+ * the first iteration has been folded in */
+void resetPathGuide(glm::vec3 bounds_min, glm::vec3 bounds_max,
+                    PathGuide *out_guide);
+bool isPathGuideTraining(const PathGuide *guide);
+bool isPathGuideTrained(const PathGuide *guide);
+/* counts a trained frame, true when it ended an iteration */
+bool endPathGuideFrame(PathGuide *guide);
+/* Müller et al. 2017. rebuilds every quadtree from the energy its leaf
+ * learned, subdividing quadrants that hold more than a hundredth of it, and
+ * splits the leaves that recorded more samples than the iteration allows in
+ * two, each half starting from a copy of the quadtree */
+void refinePathGuide(const GuideTraining *training, PathGuide *guide);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+/* matches the STAT_ slots of RayStats in ray_tracing.glsl */
+enum RayStat {
+  RAY_STAT_RAYS,
+  /* bytes the traversal and shading read with the current layout */
+  RAY_STAT_BYTES_READ,
+  /* the same reads with materials inlined into 64 byte spheres */
+  RAY_STAT_LEGACY_BYTES_READ,
+  /* coherence of the wavefront kernels, only counted while enabled. the
+   * distinct spheres fetched and materials shaded are summed over groups */
+  RAY_STAT_EXTEND_GROUPS,
+  RAY_STAT_UNIQUE_SPHERES,
+  RAY_STAT_SHADE_GROUPS,
+  RAY_STAT_UNIQUE_MATERIALS,
+  /* emissive sphere samples of next event estimation and the light BVH
+   * nodes weighed for them, only counted while enabled */
+  RAY_STAT_LIGHT_PICKS,
+  RAY_STAT_LIGHT_NODES,
+  /* luminance of the sphere samples that arrive and its square, in steps of
+   * 1/16 */
+  RAY_STAT_LIGHT_CONTRIBUTION,
+  RAY_STAT_LIGHT_CONTRIBUTION_SQUARED,
+  /* pixels adaptive sampling still traces */
+  RAY_STAT_ACTIVE_PIXELS,
+  /* squared error of the accumulation against the captured reference, summed
+   * over pixels in steps of 1/65536, only counted while enabled */
+  RAY_STAT_SQUARED_ERROR,
+  /* rays extend traced, the segments of every path summed */
+  RAY_STAT_PATH_SEGMENTS,
+  /* paths the radiance cache ended and the cells it holds */
+  RAY_STAT_CACHE_TERMINATIONS,
+  RAY_STAT_CACHE_ENTRIES,
+  RAY_STAT_COUNT
+};
+
+/* every counter is 64-bit, split into a low and a high word since the
+ * shader only has 32-bit atomics */
+struct RayStats {
+  uint32_t counters[RAY_STAT_COUNT * 2];
+};
+
+inline uint64_t getRayStat(const RayStats *stats, RayStat stat) {
+  return (uint64_t)stats->counters[stat * 2] |
+         ((uint64_t)stats->counters[stat * 2 + 1] << 32);
+}
@@ -0,0 +1,460 @@
+#include "scene.h"
+
+#include "logger.h"
+
+#include <float.h>
+#include <random>
+#include <string.h>
+
+uint32_t addSceneMaterial(Scene *scene, const RayTracingMaterial &material) {
+  /* FNV-1a over the raw material bytes */
+  uint64_t hash = 14695981039346656037ull;
+  const uint8_t *bytes = (const uint8_t *)&material;
+  for (uint32_t i = 0; i < sizeof(RayTracingMaterial); ++i) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+
+  auto found = scene->material_lookup.find(hash);
+  if (found != scene->material_lookup.end() &&
+      memcmp(&scene->materials[found->second], &material,
+             sizeof(RayTracingMaterial)) == 0) {
+    return found->second;
+  }
+
+  uint32_t index = scene->materials.size();
+  scene->materials.emplace_back(material);
+  if (found == scene->material_lookup.end()) {
+    scene->material_lookup[hash] = index;
+  }
+
+  return index;
+}
+
+uint32_t addSceneTexture(Scene *scene, const char *path) {
+  for (uint32_t i = 0; i < scene->texture_paths.size(); ++i) {
+    if (scene->texture_paths[i] == path) {
+      return i + 1;
+    }
+  }
+
+  scene->texture_paths.emplace_back(path);
+  return scene->texture_paths.size();
+}
+
+void addSceneSphere(Scene *scene, glm::vec3 position, float radius,
+                    const RayTracingMaterial &material) {
+  Sphere sphere = {};
+  sphere.position = position;
+  sphere.radius = radius;
+  scene->spheres.emplace_back(sphere);
+  scene->sphere_material_indices.emplace_back(
+      addSceneMaterial(scene, material));
+
+  SphereAnimation animation = {};
+  animation.rest_position = position;
+  animation.amplitude = 0.0f;
+  animation.frequency = 1.0f;
+  animation.phase = 0.0f;
+  scene->sphere_animations.emplace_back(animation);
+}
+
+void createDefaultScene(Scene *out_scene) {
+  RayTracingMaterial material = {};
+  material.colour = glm::vec4(0.5, 0.5, 0.5, 1.0);
+  material.emission_colour = glm::vec4(0);
+  material.specular_colour = glm::vec4(1.0, 1.0, 1.0, 0.5);
+  addSceneSphere(out_scene, glm::vec3(0, 0, -5), 1.0, material);
+
+  material.colour = glm::vec4(1.0, 1.0, 1.0, 0.5);
+  material.emission_colour = glm::vec4(0);
+  material.specular_colour = glm::vec4(1.0, 1.0, 1.0, 0.0);
+  material.albedo_texture =
+      addSceneTexture(out_scene, "assets/textures/brickwall.jpg");
+  addSceneSphere(out_scene, glm::vec3(3, 0, -5), 1.0, material);
+  material.albedo_texture = 0;
+
+  material.colour = glm::vec4(0.2, 0.8, 0.05, 0.0);
+  material.emission_colour = glm::vec4(0);
+  material.specular_colour = glm::vec4(1.0, 1.0, 1.0, 0.0);
+  addSceneSphere(out_scene, glm::vec3(0, -101, -5), 100.0, material);
+
+  /* a small bright light, which bounces alone take long to find */
+  material.colour = glm::vec4(1.0, 1.0, 1.0, 0.0);
+  material.emission_colour = glm::vec4(1.0, 0.9, 0.7, 20.0);
+  material.specular_colour = glm::vec4(1.0, 1.0, 1.0, 0.0);
+  addSceneSphere(out_scene, glm::vec3(-2, 1.5, -4), 0.2, material);
+
+  std::vector<SphereAnimation> &animations = out_scene->sphere_animations;
+  animations[0].amplitude = 0.5f;
+  animations[1].amplitude = 0.5f;
+  animations[1].phase = 1.5f;
+}
+
+void createClosedRoomScene(Scene *out_scene) {
+  createDefaultScene(out_scene);
+
+  /* the default ground already is the floor at y = -1, the walls are spheres
+   * of the same size just outside the camera at the origin */
+  const float wall_radius = 100.0f;
+  RayTracingMaterial material = {};
+  material.emission_colour = glm::vec4(0);
+  material.specular_colour = glm::vec4(1.0, 1.0, 1.0, 0.0);
+
+  material.colour = glm::vec4(0.75, 0.75, 0.75, 0.0);
+  addSceneSphere(out_scene, glm::vec3(0, 4 + wall_radius, -5), wall_radius,
+                 material);
+  addSceneSphere(out_scene, glm::vec3(0, 0, -10 - wall_radius), wall_radius,
+                 material);
+  addSceneSphere(out_scene, glm::vec3(0, 0, 2 + wall_radius), wall_radius,
+                 material);
+
+  material.colour = glm::vec4(0.75, 0.2, 0.2, 0.0);
+  addSceneSphere(out_scene, glm::vec3(-5 - wall_radius, 0, -5), wall_radius,
+                 material);
+  material.colour = glm::vec4(0.2, 0.2, 0.75, 0.0);
+  addSceneSphere(out_scene, glm::vec3(5 + wall_radius, 0, -5), wall_radius,
+                 material);
+
+  material.colour = glm::vec4(1.0, 1.0, 1.0, 0.0);
+  material.emission_colour = glm::vec4(1.0, 0.95, 0.9, 15.0);
+  addSceneSphere(out_scene, glm::vec3(0, 3.5, -5), 0.4, material);
+}
+
+void createRandomSpheresScene(uint32_t sphere_count, uint32_t seed,
+                              Scene *out_scene) {
+  createDefaultScene(out_scene);
+
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+  /* the spheres pick from a small palette, so most of them share materials */
+  const uint32_t palette_size = 32;
+  std::vector<RayTracingMaterial> palette;
+  palette.resize(palette_size);
+  for (uint32_t i = 0; i < palette_size; ++i) {
+    palette[i].colour = glm::vec4(unit(generator), unit(generator),
+                                  unit(generator), unit(generator));
+    palette[i].emission_colour = glm::vec4(0);
+    palette[i].specular_colour =
+        glm::vec4(1.0, 1.0, 1.0, unit(generator) * 0.5f);
+  }
+
+  /* scatter the spheres over the ground sphere of the default scene */
+  float extent = glm::sqrt((float)sphere_count) * 0.75f;
+  for (uint32_t i = 0; i < sphere_count; ++i) {
+    float radius = 0.1f + unit(generator) * 0.3f;
+    glm::vec3 position =
+        glm::vec3((unit(generator) - 0.5f) * extent, radius - 1.0f,
+                  -5.0f - unit(generator) * extent);
+    const RayTracingMaterial &material =
+        palette[(uint32_t)(unit(generator) * palette_size) % palette_size];
+    addSceneSphere(out_scene, position, radius, material);
+
+    SphereAnimation &animation = out_scene->sphere_animations.back();
+    animation.rest_position = position + glm::vec3(0, 0.5f, 0);
+    animation.amplitude = 0.5f;
+    animation.frequency = 0.5f + unit(generator);
+    animation.phase = unit(generator) * 6.2831853f;
+  }
+}
+
+void addSceneLights(Scene *scene, uint32_t light_count, uint32_t seed) {
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+  float extent = glm::sqrt((float)light_count) * 0.5f;
+  for (uint32_t i = 0; i < light_count; ++i) {
+    RayTracingMaterial material = {};
+    material.colour = glm::vec4(1.0, 1.0, 1.0, 0.0);
+    material.emission_colour = glm::vec4(unit(generator), unit(generator),
+                                         unit(generator), 5.0f);
+    material.specular_colour = glm::vec4(1.0, 1.0, 1.0, 0.0);
+
+    glm::vec3 position = glm::vec3((unit(generator) - 0.5f) * extent,
+                                   2.0f + unit(generator) * 2.0f,
+                                   -5.0f - unit(generator) * extent);
+    addSceneSphere(scene, position, 0.02f + unit(generator) * 0.03f,
+                   material);
+  }
+}
+
+static void calculateSpherePrimitives(const std::vector<Sphere> &spheres,
+                                      std::vector<BVHPrimitive> *out_primitives) {
+  out_primitives->resize(spheres.size());
+  for (uint32_t i = 0; i < spheres.size(); ++i) {
+    const Sphere &sphere = spheres[i];
+    BVHPrimitive &primitive = (*out_primitives)[i];
+    primitive.bounds_min = sphere.position - glm::vec3(sphere.radius);
+    primitive.bounds_max = sphere.position + glm::vec3(sphere.radius);
+    primitive.centroid = sphere.position;
+  }
+}
+
+static void calculateLightPrimitives(const Scene &scene,
+                                     std::vector<BVHPrimitive> *out_primitives) {
+  out_primitives->resize(scene.emissive_spheres.size());
+  for (uint32_t i = 0; i < scene.emissive_spheres.size(); ++i) {
+    const Sphere &sphere = scene.spheres[scene.emissive_spheres[i]];
+    BVHPrimitive &primitive = (*out_primitives)[i];
+    primitive.bounds_min = sphere.position - glm::vec3(sphere.radius);
+    primitive.bounds_max = sphere.position + glm::vec3(sphere.radius);
+    primitive.centroid = sphere.position;
+  }
+}
+
+static bool buildSceneLightBVH(Scene *scene) {
+  scene->emissive_spheres.clear();
+  std::vector<float> fluxes;
+  for (uint32_t i = 0; i < scene->spheres.size(); ++i) {
+    const glm::vec4 &emission =
+        scene->materials[scene->sphere_material_indices[i]].emission_colour;
+    if (emission.w > 0.0f &&
+        (emission.x > 0.0f || emission.y > 0.0f || emission.z > 0.0f)) {
+      scene->emissive_spheres.emplace_back(i);
+
+      /* a sphere of uniform radiance L emits pi * L over each bit of its
+       * area */
+      float radius = scene->spheres[i].radius;
+      float luminance = glm::dot(glm::vec3(emission),
+                                 glm::vec3(0.2126f, 0.7152f, 0.0722f)) *
+                        emission.w;
+      fluxes.emplace_back(luminance * 4.0f * 3.1415926f * 3.1415926f * radius *
+                          radius);
+    }
+  }
+
+  std::vector<BVHPrimitive> primitives;
+  calculateLightPrimitives(*scene, &primitives);
+  if (!buildLightBVH(primitives, fluxes, &scene->light_bvh)) {
+    ERROR("Failed to build a light BVH!");
+    return false;
+  }
+
+  scene->sphere_light_leaves.assign(scene->spheres.size(), UINT32_MAX);
+  for (uint32_t i = 0; i < scene->emissive_spheres.size(); ++i) {
+    scene->sphere_light_leaves[scene->emissive_spheres[i]] =
+        scene->light_bvh.light_leaves[i];
+  }
+
+  INFO("Built a light BVH over %u emissive spheres: %u nodes",
+       (uint32_t)scene->emissive_spheres.size(),
+       (uint32_t)scene->light_bvh.nodes.size());
+
+  return true;
+}
+
+void refitSceneLightBVH(Scene *scene) {
+  std::vector<BVHPrimitive> primitives;
+  calculateLightPrimitives(*scene, &primitives);
+  refitLightBVH(primitives, &scene->light_bvh);
+}
+
+bool buildSceneBVH(Scene *scene) {
+  std::vector<BVHPrimitive> primitives;
+  calculateSpherePrimitives(scene->spheres, &primitives);
+
+  if (!buildBVH(primitives, scene->bvh_builder, &scene->sphere_bvh)) {
+    ERROR("Failed to build a sphere BVH!");
+    return false;
+  }
+  if (!buildCompressedBVH(&scene->sphere_bvh, &scene->sphere_compressed_bvh)) {
+    ERROR("Failed to build a compressed sphere BVH!");
+    return false;
+  }
+
+  std::vector<Sphere> ordered_spheres;
+  ordered_spheres.resize(scene->spheres.size());
+  std::vector<uint32_t> ordered_material_indices;
+  ordered_material_indices.resize(scene->spheres.size());
+  for (uint32_t i = 0; i < ordered_spheres.size(); ++i) {
+    uint32_t sphere = scene->sphere_bvh.primitive_indices[i];
+    ordered_spheres[i] = scene->spheres[sphere];
+    ordered_material_indices[i] = scene->sphere_material_indices[sphere];
+  }
+  scene->spheres = ordered_spheres;
+  scene->sphere_material_indices = ordered_material_indices;
+
+  if (scene->sphere_animations.size() == scene->spheres.size()) {
+    std::vector<SphereAnimation> ordered_animations;
+    ordered_animations.resize(scene->sphere_animations.size());
+    for (uint32_t i = 0; i < ordered_animations.size(); ++i) {
+      ordered_animations[i] =
+          scene->sphere_animations[scene->sphere_bvh.primitive_indices[i]];
+    }
+    scene->sphere_animations = ordered_animations;
+  }
+
+  if (!buildSceneLightBVH(scene)) {
+    return false;
+  }
+
+  INFO("Built a sphere BVH (%s): %u spheres, %u nodes, SAH cost %.2f, %.2f ms",
+       getBVHBuilderName(scene->bvh_builder), (uint32_t)scene->spheres.size(),
+       (uint32_t)scene->sphere_bvh.nodes.size(), scene->sphere_bvh.build_cost,
+       scene->sphere_bvh.build_time_ms);
+  INFO("Compressed the sphere BVH to %u wide nodes: %.2f KB, %.2f KB as "
+       "binary nodes",
+       (uint32_t)scene->sphere_compressed_bvh.nodes.size(),
+       scene->sphere_compressed_bvh.nodes.size() * sizeof(CompressedBVHNode) /
+           1024.0f,
+       scene->sphere_bvh.nodes.size() * sizeof(BVHNode) / 1024.0f);
+
+  return true;
+}
+
+void animateScene(Scene *scene, float time,
+                  std::vector<uint32_t> *out_dirty_spheres) {
+  for (uint32_t i = 0; i < scene->sphere_animations.size(); ++i) {
+    const SphereAnimation &animation = scene->sphere_animations[i];
+    if (animation.amplitude == 0.0f) {
+      continue;
+    }
+
+    float offset = glm::sin(time * animation.frequency * 6.2831853f +
+                            animation.phase) *
+                   animation.amplitude;
+    scene->spheres[i].position =
+        animation.rest_position + glm::vec3(0, offset, 0);
+    out_dirty_spheres->emplace_back(i);
+  }
+}
+
+bool updateSceneBVH(Scene *scene, float rebuild_threshold, bool *out_rebuilt,
+                    float *out_cost_ratio,
+                    std::vector<uint32_t> *out_dirty_nodes,
+                    std::vector<uint32_t> *out_dirty_compressed_nodes) {
+  *out_rebuilt = false;
+  *out_cost_ratio = 1.0f;
+
+  /* the spheres were reordered by the last build, so they already are in leaf
+   * order */
+  std::vector<BVHPrimitive> primitives;
+  calculateSpherePrimitives(scene->spheres, &primitives);
+  refitBVH(primitives, &scene->sphere_bvh, out_dirty_nodes);
+
+  float cost = calculateBVHCost(&scene->sphere_bvh);
+  if (cost <= scene->sphere_bvh.build_cost * rebuild_threshold) {
+    *out_cost_ratio = cost / scene->sphere_bvh.build_cost;
+    refitCompressedBVH(scene->sphere_bvh, &scene->sphere_compressed_bvh,
+                       out_dirty_compressed_nodes);
+    return true;
+  }
+
+  if (!buildSceneBVH(scene)) {
+    ERROR("Failed to rebuild a sphere BVH!");
+    return false;
+  }
+  *out_rebuilt = true;
+
+  return true;
+}
+
+void benchmarkSceneBVH(Scene *scene) {
+  std::vector<BVHPrimitive> primitives;
+  calculateSpherePrimitives(scene->spheres, &primitives);
+
+  INFO("Benchmarking BVH builders over %u spheres",
+       (uint32_t)primitives.size());
+  for (uint32_t i = 0; i < BVH_BUILDER_COUNT; ++i) {
+    BVH bvh;
+    if (!buildBVH(primitives, (BVHBuilder)i, &bvh)) {
+      ERROR("Failed to build a BVH!");
+      continue;
+    }
+
+    INFO("%-8s %10.2f ms %10u nodes %8.2f SAH cost",
+         getBVHBuilderName((BVHBuilder)i), bvh.build_time_ms,
+         (uint32_t)bvh.nodes.size(), bvh.build_cost);
+  }
+}
+
+void calculateSceneMortonQuantization(Scene *scene, glm::vec3 *out_origin,
+                                      glm::vec3 *out_inv_extent) {
+  std::vector<BVHPrimitive> primitives;
+  calculateSpherePrimitives(scene->spheres, &primitives);
+
+  calculateMortonQuantization(primitives, out_origin, out_inv_extent);
+}
+
+void buildSceneLBVHReference(Scene *scene, BVH *out_bvh) {
+  std::vector<BVHPrimitive> primitives;
+  calculateSpherePrimitives(scene->spheres, &primitives);
+
+  buildLBVHReference(primitives, out_bvh);
+}
+
+bool buildSceneTLAS(Scene *scene) {
+  if (scene->instances.empty()) {
+    scene->instance_bvh.nodes.clear();
+    scene->instance_bvh.primitive_indices.clear();
+    return true;
+  }
+
+  std::vector<BVHPrimitive> primitives;
+  primitives.resize(scene->instances.size());
+  for (uint32_t i = 0; i < scene->instances.size(); ++i) {
+    const Instance &instance = scene->instances[i];
+    const BVHNode &root = scene->meshes[instance.mesh_index].bvh.nodes[0];
+
+    glm::vec3 bounds_min = glm::vec3(FLT_MAX);
+    glm::vec3 bounds_max = glm::vec3(-FLT_MAX);
+    for (uint32_t corner = 0; corner < 8; ++corner) {
+      glm::vec3 position =
+          glm::vec3(corner & 1 ? root.bounds_max.x : root.bounds_min.x,
+                    corner & 2 ? root.bounds_max.y : root.bounds_min.y,
+                    corner & 4 ? root.bounds_max.z : root.bounds_min.z);
+      position = glm::vec3(instance.transform * glm::vec4(position, 1.0f));
+      bounds_min = glm::min(bounds_min, position);
+      bounds_max = glm::max(bounds_max, position);
+    }
+
+    primitives[i].bounds_min = bounds_min;
+    primitives[i].bounds_max = bounds_max;
+    primitives[i].centroid = (bounds_min + bounds_max) * 0.5f;
+  }
+
+  if (!buildBVH(primitives, scene->bvh_builder, &scene->instance_bvh)) {
+    ERROR("Failed to build an instance BVH!");
+    return false;
+  }
+
+  return true;
+}
+
+void packSceneInstances(Scene *scene, std::vector<InstanceInfo> *out_infos) {
+  out_infos->resize(scene->instances.size());
+  for (uint32_t i = 0; i < scene->instances.size(); ++i) {
+    const Instance &instance =
+        scene->instances[scene->instance_bvh.primitive_indices[i]];
+    glm::mat4 world_to_object = glm::inverse(instance.transform);
+
+    InstanceInfo &info = (*out_infos)[i];
+    for (uint32_t row = 0; row < 3; ++row) {
+      info.world_to_object[row] =
+          glm::vec4(world_to_object[0][row], world_to_object[1][row],
+                    world_to_object[2][row], world_to_object[3][row]);
+    }
+    info.mesh_index = instance.mesh_index;
+  }
+}
+
+void getSceneBounds(const Scene *scene, glm::vec3 *out_min,
+                    glm::vec3 *out_max) {
+  glm::vec3 bounds_min(FLT_MAX);
+  glm::vec3 bounds_max(-FLT_MAX);
+  if (!scene->sphere_bvh.nodes.empty()) {
+    bounds_min = glm::min(bounds_min, scene->sphere_bvh.nodes[0].bounds_min);
+    bounds_max = glm::max(bounds_max, scene->sphere_bvh.nodes[0].bounds_max);
+  }
+  if (!scene->instance_bvh.nodes.empty()) {
+    bounds_min = glm::min(bounds_min, scene->instance_bvh.nodes[0].bounds_min);
+    bounds_max = glm::max(bounds_max, scene->instance_bvh.nodes[0].bounds_max);
+  }
+
+  if (bounds_min.x > bounds_max.x) {
+    bounds_min = glm::vec3(0.0f);
+    bounds_max = glm::vec3(0.0f);
+  }
+  *out_min = bounds_min;
+  *out_max = bounds_max;
+}
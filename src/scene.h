@@ -0,0 +1,131 @@
+#pragma once
+
+#include "bvh.h"
+#include "light_bvh.h"
+#include "material.h"
+#include "mesh.h"
+
+#include "glm/glm.hpp"
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* only the geometry is read during traversal, the material is looked up
+ * through sphere_material_indices once the closest hit is known */
+struct Sphere {
+  glm::vec3 position;
+  float radius;
+};
+
+/* spheres bob up and down around their rest position, a zero amplitude keeps
+ * them static */
+struct SphereAnimation {
+  glm::vec3 rest_position;
+  float amplitude;
+  float frequency;
+  float phase;
+};
+
+struct Instance {
+  glm::mat4 transform;
+  uint32_t mesh_index;
+};
+
+/* matches InstanceInfo in ray_tracing.glsl */
+struct InstanceInfo {
+  /* rows of the 3x4 world to object transform */
+  glm::vec4 world_to_object[3];
+  uint32_t mesh_index;
+  uint32_t padding[3];
+};
+
+struct Scene {
+  /* used for the sphere BVH, the mesh BVHs and the TLAS */
+  BVHBuilder bvh_builder = BVH_BUILDER_BINNED_SAH;
+
+  std::vector<Sphere> spheres;
+  /* one per sphere, indexes materials */
+  std::vector<uint32_t> sphere_material_indices;
+  /* one per sphere, kept in the same order as the spheres */
+  std::vector<SphereAnimation> sphere_animations;
+  /* spheres with an emissive material, the lights next event estimation
+   * samples. gathered after the spheres are reordered */
+  std::vector<uint32_t> emissive_spheres;
+  /* over the emissive spheres in the order above */
+  LightBVH light_bvh;
+  /* one per sphere, the light BVH leaf of an emissive sphere and UINT32_MAX
+   * for the rest */
+  std::vector<uint32_t> sphere_light_leaves;
+  BVH sphere_bvh;
+  /* the same tree collapsed into quantized 4 wide nodes */
+  CompressedBVH sphere_compressed_bvh;
+
+  /* bottom level structures, each mesh has its own BVH in object space */
+  std::vector<Mesh> meshes;
+  /* top level structure over the world space bounds of the instances */
+  std::vector<Instance> instances;
+  BVH instance_bvh;
+
+  /* deduplicated materials shared by spheres and meshes */
+  std::vector<RayTracingMaterial> materials;
+  /* hash of the material bytes to its index in materials */
+  std::unordered_map<uint64_t, uint32_t> material_lookup;
+  /* images the materials refer to, in the order of the texture array */
+  std::vector<std::string> texture_paths;
+};
+
+/* returns the index of an equal material, adding it when there is none */
+uint32_t addSceneMaterial(Scene *scene, const RayTracingMaterial &material);
+/* returns what a material stores to refer to the image at path, adding it
+ * when it is new */
+uint32_t addSceneTexture(Scene *scene, const char *path);
+void addSceneSphere(Scene *scene, glm::vec3 position, float radius,
+                    const RayTracingMaterial &material);
+
+void createDefaultScene(Scene *out_scene);
+/* the spheres of the default scene inside a box of large spheres lit from the
+ * ceiling, where next to no path escapes to the sky */
+void createClosedRoomScene(Scene *out_scene);
+void createRandomSpheresScene(uint32_t sphere_count, uint32_t seed,
+                              Scene *out_scene);
+/* scatters light_count small emissive spheres of random colours above the
+ * scene, like a lighting rig */
+void addSceneLights(Scene *scene, uint32_t light_count, uint32_t seed);
+
+/* builds the sphere BVH and its compressed layout and reorders the spheres so
+ * the leaves of both can index them directly, then gathers the emissive
+ * spheres in their new order and builds the light BVH over them */
+bool buildSceneBVH(Scene *scene);
+/* moves the spheres to their animated positions at the given time, appending
+ * the indices of the spheres that moved */
+void animateScene(Scene *scene, float time,
+                  std::vector<uint32_t> *out_dirty_spheres);
+/* refits the sphere BVH to the current sphere positions. once the SAH cost
+ * grows past rebuild_threshold times the cost of the last build the BVH is
+ * rebuilt instead, which reorders the spheres and sets out_rebuilt.
+ * out_cost_ratio is the SAH cost of the updated BVH over that of the last
+ * build */
+bool updateSceneBVH(Scene *scene, float rebuild_threshold, bool *out_rebuilt,
+                    float *out_cost_ratio,
+                    std::vector<uint32_t> *out_dirty_nodes,
+                    std::vector<uint32_t> *out_dirty_compressed_nodes);
+/* refits the light BVH to the current sphere positions */
+void refitSceneLightBVH(Scene *scene);
+/* builds the sphere BVH with every builder and logs how they compare, the
+ * scene itself is left untouched */
+void benchmarkSceneBVH(Scene *scene);
+/* CPU reference of the BVH the lbvh_*.comp passes build over the spheres in
+ * their current order */
+void buildSceneLBVHReference(Scene *scene, BVH *out_bvh);
+/* the bounds the lbvh_*.comp passes quantize the sphere centroids over */
+void calculateSceneMortonQuantization(Scene *scene, glm::vec3 *out_origin,
+                                      glm::vec3 *out_inv_extent);
+/* only needs to be rebuilt when instances move, the meshes are untouched */
+bool buildSceneTLAS(Scene *scene);
+/* instance records in the order the TLAS leaves refer to */
+void packSceneInstances(Scene *scene, std::vector<InstanceInfo> *out_infos);
+/* union of the root bounds of the sphere BVH and the TLAS, which need to be
+ * built or refitted first */
+void getSceneBounds(const Scene *scene, glm::vec3 *out_min,
+                    glm::vec3 *out_max);
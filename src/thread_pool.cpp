@@ -0,0 +1,140 @@
+#include "thread_pool.h"
+
+#include "logger.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ThreadPoolTask {
+  std::function<void()> function;
+  ThreadPoolGroup *group;
+};
+
+struct ThreadPool {
+  std::vector<std::thread> workers;
+  std::deque<ThreadPoolTask> tasks;
+  std::mutex mutex;
+  std::condition_variable task_available;
+  bool running;
+};
+
+static ThreadPool *thread_pool;
+
+static void runThreadPoolTask(ThreadPoolTask *task) {
+  task->function();
+  task->group->pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+static bool popThreadPoolTask(ThreadPoolTask *out_task) {
+  std::lock_guard<std::mutex> lock(thread_pool->mutex);
+  if (thread_pool->tasks.empty()) {
+    return false;
+  }
+
+  *out_task = std::move(thread_pool->tasks.front());
+  thread_pool->tasks.pop_front();
+
+  return true;
+}
+
+static void threadPoolWorker() {
+  while (true) {
+    ThreadPoolTask task;
+    {
+      std::unique_lock<std::mutex> lock(thread_pool->mutex);
+      thread_pool->task_available.wait(lock, [] {
+        return !thread_pool->running || !thread_pool->tasks.empty();
+      });
+      if (!thread_pool->running && thread_pool->tasks.empty()) {
+        return;
+      }
+
+      task = std::move(thread_pool->tasks.front());
+      thread_pool->tasks.pop_front();
+    }
+
+    runThreadPoolTask(&task);
+  }
+}
+
+bool initializeThreadPool(uint32_t thread_count) {
+  thread_pool = new ThreadPool();
+  thread_pool->running = true;
+
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    thread_pool->workers.emplace_back(threadPoolWorker);
+  }
+
+  INFO("Started a thread pool with %u workers", thread_count);
+
+  return true;
+}
+
+void shutdownThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(thread_pool->mutex);
+    thread_pool->running = false;
+  }
+  thread_pool->task_available.notify_all();
+
+  for (uint32_t i = 0; i < thread_pool->workers.size(); ++i) {
+    thread_pool->workers[i].join();
+  }
+
+  delete thread_pool;
+  thread_pool = 0;
+}
+
+uint32_t getThreadPoolSize() {
+  return thread_pool ? thread_pool->workers.size() : 0;
+}
+
+void submitThreadPoolTask(ThreadPoolGroup *group, std::function<void()> task) {
+  group->pending.fetch_add(1, std::memory_order_acq_rel);
+
+  ThreadPoolTask pool_task = {std::move(task), group};
+  if (getThreadPoolSize() == 0) {
+    runThreadPoolTask(&pool_task);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(thread_pool->mutex);
+    thread_pool->tasks.emplace_back(std::move(pool_task));
+  }
+  thread_pool->task_available.notify_one();
+}
+
+void waitThreadPoolGroup(ThreadPoolGroup *group) {
+  while (group->pending.load(std::memory_order_acquire) > 0) {
+    /* help out instead of blocking, the tasks we wait on may be queued
+     * behind others */
+    ThreadPoolTask task;
+    if (thread_pool && popThreadPoolTask(&task)) {
+      runThreadPoolTask(&task);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void parallelFor(uint32_t count, uint32_t chunk_size,
+                 std::function<void(uint32_t begin, uint32_t end)> body) {
+  if (count <= chunk_size || getThreadPoolSize() == 0) {
+    for (uint32_t begin = 0; begin < count; begin += chunk_size) {
+      body(begin, std::min(begin + chunk_size, count));
+    }
+    return;
+  }
+
+  ThreadPoolGroup group;
+  for (uint32_t begin = 0; begin < count; begin += chunk_size) {
+    uint32_t end = std::min(begin + chunk_size, count);
+    submitThreadPoolTask(&group, [&body, begin, end] { body(begin, end); });
+  }
+  waitThreadPoolGroup(&group);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+
+/* tracks the tasks of one batch that have not finished yet */
+struct ThreadPoolGroup {
+  std::atomic<uint32_t> pending = 0;
+};
+
+/* a thread count of 0 runs every task inline on the submitting thread */
+bool initializeThreadPool(uint32_t thread_count);
+void shutdownThreadPool();
+uint32_t getThreadPoolSize();
+
+void submitThreadPoolTask(ThreadPoolGroup *group, std::function<void()> task);
+/* runs queued tasks on the calling thread until the group is done, so it is
+ * safe to wait from inside a task */
+void waitThreadPoolGroup(ThreadPoolGroup *group);
+/* splits [0, count) into chunks of chunk_size and runs them on the pool, the
+ * chunk index of a range is begin / chunk_size */
+void parallelFor(uint32_t count, uint32_t chunk_size,
+                 std::function<void(uint32_t begin, uint32_t end)> body);
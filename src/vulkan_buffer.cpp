@@ -4,6 +4,7 @@
 #include "vulkan_common.h"
 #include "vulkan_resources.h"
 
+#include <algorithm>
 #include <string.h>
 
 bool createBuffer(VmaAllocator vma_allocator, uint64_t size,
@@ -88,6 +89,80 @@ bool loadBufferDataStaging(VulkanBuffer *buffer, VulkanDevice *device,
   return true;
 }
 
+bool loadBufferDataStagingRegions(VulkanBuffer *buffer, VulkanDevice *device,
+                                  VmaAllocator vma_allocator, void *data,
+                                  std::vector<VkBufferCopy> regions,
+                                  VkQueue queue, VkCommandPool command_pool) {
+  if (regions.empty()) {
+    return true;
+  }
+
+  uint64_t staging_size = 0;
+  for (uint32_t i = 0; i < regions.size(); ++i) {
+    regions[i].srcOffset = staging_size;
+    staging_size += regions[i].size;
+  }
+
+  VulkanBuffer staging_buffer;
+  if (!createBuffer(vma_allocator, staging_size,
+                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    VMA_MEMORY_USAGE_CPU_ONLY, &staging_buffer)) {
+    ERROR("Failed to create a staging buffer!");
+    return false;
+  }
+
+  uint8_t *data_ptr = (uint8_t *)lockBuffer(&staging_buffer, vma_allocator);
+  for (uint32_t i = 0; i < regions.size(); ++i) {
+    memcpy(data_ptr + regions[i].srcOffset,
+           (uint8_t *)data + regions[i].dstOffset, regions[i].size);
+  }
+  unlockBuffer(&staging_buffer, vma_allocator);
+
+  vkQueueWaitIdle(queue);
+
+  VkCommandBuffer temp_command_buffer;
+  allocateAndBeginSingleUseCommandBuffer(device, command_pool,
+                                         &temp_command_buffer);
+
+  vkCmdCopyBuffer(temp_command_buffer, staging_buffer.handle, buffer->handle,
+                  regions.size(), regions.data());
+
+  endAndFreeSingleUseCommandBuffer(temp_command_buffer, device, command_pool,
+                                   queue);
+
+  destroyBuffer(&staging_buffer, vma_allocator);
+
+  return true;
+}
+
+void mergeBufferCopyRegions(std::vector<uint32_t> element_indices,
+                            uint64_t element_size,
+                            std::vector<VkBufferCopy> *out_regions) {
+  std::sort(element_indices.begin(), element_indices.end());
+
+  for (uint32_t i = 0; i < element_indices.size(); ++i) {
+    uint64_t offset = element_indices[i] * element_size;
+    if (!out_regions->empty()) {
+      VkBufferCopy &last = out_regions->back();
+      if (last.dstOffset + last.size == offset) {
+        last.size += element_size;
+        continue;
+      }
+      if (last.dstOffset + last.size > offset) {
+        continue;
+      }
+    }
+
+    VkBufferCopy region = {};
+    region.srcOffset = 0;
+    region.dstOffset = offset;
+    region.size = element_size;
+    out_regions->emplace_back(region);
+  }
+}
+
 bool copyBufferTo(VulkanDevice *device, VulkanBuffer *source,
                   VulkanBuffer *dest, VkQueue queue,
                   VkCommandPool command_pool) {
@@ -3,6 +3,7 @@
 #include "vulkan_device.h"
 
 #include "vk_mem_alloc.h"
+#include <vector>
 #include <vulkan/vulkan.h>
 
 struct VulkanBuffer {
@@ -26,6 +27,17 @@ bool loadBufferData(VulkanBuffer *buffer, VmaAllocator vma_allocator,
 bool loadBufferDataStaging(VulkanBuffer *buffer, VulkanDevice *device,
                            VmaAllocator vma_allocator, void *data,
                            VkQueue queue, VkCommandPool command_pool);
+/* uploads only the dstOffset/size ranges of data, which mirrors the whole
+ * buffer. the ranges are packed back to back into a staging buffer, so the
+ * srcOffsets are filled in here */
+bool loadBufferDataStagingRegions(VulkanBuffer *buffer, VulkanDevice *device,
+                                  VmaAllocator vma_allocator, void *data,
+                                  std::vector<VkBufferCopy> regions,
+                                  VkQueue queue, VkCommandPool command_pool);
+/* merges element indices into contiguous copy regions */
+void mergeBufferCopyRegions(std::vector<uint32_t> element_indices,
+                            uint64_t element_size,
+                            std::vector<VkBufferCopy> *out_regions);
 bool copyBufferTo(VulkanDevice *device, VulkanBuffer *source,
                   VulkanBuffer *dest, VkQueue queue,
                   VkCommandPool command_pool);
\ No newline at end of file
@@ -40,10 +40,18 @@ void bindDescriptorBuilderImage(
     uint32_t binding, VkDescriptorImageInfo *image_info, VkDescriptorType type,
     VkShaderStageFlags stage_flags,
     VulkanDescriptorBuilder *out_descriptor_builder) {
+  bindDescriptorBuilderImages(binding, image_info, 1, type, stage_flags,
+                              out_descriptor_builder);
+}
+
+void bindDescriptorBuilderImages(
+    uint32_t binding, VkDescriptorImageInfo *image_infos, uint32_t count,
+    VkDescriptorType type, VkShaderStageFlags stage_flags,
+    VulkanDescriptorBuilder *out_descriptor_builder) {
   VkDescriptorSetLayoutBinding layout_binding = {};
   layout_binding.binding = binding;
   layout_binding.descriptorType = type;
-  layout_binding.descriptorCount = 1;
+  layout_binding.descriptorCount = count;
   layout_binding.stageFlags = stage_flags;
   layout_binding.pImmutableSamplers = nullptr;
 
@@ -55,9 +63,9 @@ void bindDescriptorBuilderImage(
   /* write_descriptor_set.dstSet; set later */
   write_descriptor_set.dstBinding = binding;
   write_descriptor_set.dstArrayElement = 0;
-  write_descriptor_set.descriptorCount = 1;
+  write_descriptor_set.descriptorCount = count;
   write_descriptor_set.descriptorType = type;
-  write_descriptor_set.pImageInfo = image_info;
+  write_descriptor_set.pImageInfo = image_infos;
   write_descriptor_set.pBufferInfo = 0;
   write_descriptor_set.pTexelBufferView = 0;
 
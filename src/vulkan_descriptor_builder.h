@@ -21,5 +21,11 @@ void bindDescriptorBuilderImage(uint32_t binding,
                                 VkDescriptorType type,
                                 VkShaderStageFlags stage_flags, 
                                 VulkanDescriptorBuilder *out_descriptor_builder);
+/* fills an array binding of count elements from image_infos */
+void bindDescriptorBuilderImages(uint32_t binding,
+                                 VkDescriptorImageInfo *image_infos,
+                                 uint32_t count, VkDescriptorType type,
+                                 VkShaderStageFlags stage_flags,
+                                 VulkanDescriptorBuilder *out_descriptor_builder);
 bool endDescriptorBuilder(VulkanDescriptorBuilder *descriptor_builder, VulkanDevice *device, VkDescriptorSet *out_set, VkDescriptorSetLayout *out_layout);
 bool endDescriptorBuilder(VulkanDescriptorBuilder *descriptor_builder, VulkanDevice *device, VkDescriptorSet *out_set);
@@ -95,6 +95,18 @@ bool createDevice(VkInstance instance, VkSurfaceKHR surface,
       return false;
     }
 
+    /* the material textures are one array indexed per hit */
+    VkPhysicalDeviceVulkan12Features vulkan_12_features = {};
+    vulkan_12_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceFeatures2 device_features_2 = {};
+    device_features_2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    device_features_2.pNext = &vulkan_12_features;
+    vkGetPhysicalDeviceFeatures2(current_physical_device, &device_features_2);
+    if (!vulkan_12_features.shaderSampledImageArrayNonUniformIndexing) {
+      return false;
+    }
+
     VkPhysicalDeviceProperties device_properties;
     vkGetPhysicalDeviceProperties(current_physical_device, &device_properties);
     VkPhysicalDeviceFeatures device_features;
@@ -177,9 +189,14 @@ bool createDevice(VkInstance instance, VkSurfaceKHR surface,
 
   VkPhysicalDeviceFeatures device_features = {};
 
+  VkPhysicalDeviceVulkan12Features vulkan_12_features = {};
+  vulkan_12_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  vulkan_12_features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+
   VkDeviceCreateInfo device_create_info = {};
   device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-  device_create_info.pNext = 0;
+  device_create_info.pNext = &vulkan_12_features;
   device_create_info.flags = 0;
   device_create_info.queueCreateInfoCount = queue_create_infos.size();
   device_create_info.pQueueCreateInfos = queue_create_infos.data();
@@ -6,7 +6,8 @@ bool createGraphicsPipeline(
     VulkanDevice *device, VkRenderPass render_pass,
     std::vector<VkDescriptorSetLayout> descriptor_set_layouts,
     std::vector<VkPipelineShaderStageCreateInfo> stages,
-    VulkanPipeline *out_pipeline) {
+    uint32_t color_attachment_count, bool blend, bool depth_test,
+    uint32_t push_constant_size, VulkanPipeline *out_pipeline) {
   VkPipelineViewportStateCreateInfo viewport_state = {};
   viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
   viewport_state.pNext = 0;
@@ -49,8 +50,8 @@ bool createGraphicsPipeline(
       VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
   depth_stencil.pNext = 0;
   depth_stencil.flags = 0;
-  depth_stencil.depthTestEnable = VK_FALSE;
-  depth_stencil.depthWriteEnable = VK_FALSE;
+  depth_stencil.depthTestEnable = depth_test ? VK_TRUE : VK_FALSE;
+  depth_stencil.depthWriteEnable = depth_test ? VK_TRUE : VK_FALSE;
   depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
   depth_stencil.depthBoundsTestEnable = VK_FALSE;
   depth_stencil.stencilTestEnable = VK_FALSE;
@@ -60,7 +61,7 @@ bool createGraphicsPipeline(
   depth_stencil.maxDepthBounds = 1.0f;
 
   VkPipelineColorBlendAttachmentState color_blend_attachment_state;
-  color_blend_attachment_state.blendEnable = VK_TRUE;
+  color_blend_attachment_state.blendEnable = blend ? VK_TRUE : VK_FALSE;
   color_blend_attachment_state.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
   color_blend_attachment_state.dstColorBlendFactor =
       VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
@@ -80,8 +81,11 @@ bool createGraphicsPipeline(
   color_blend_state_create_info.flags = 0;
   color_blend_state_create_info.logicOpEnable = VK_FALSE;
   color_blend_state_create_info.logicOp = VK_LOGIC_OP_COPY;
-  color_blend_state_create_info.attachmentCount = 1;
-  color_blend_state_create_info.pAttachments = &color_blend_attachment_state;
+  std::vector<VkPipelineColorBlendAttachmentState> color_blend_attachments(
+      color_attachment_count, color_blend_attachment_state);
+  color_blend_state_create_info.attachmentCount =
+      color_blend_attachments.size();
+  color_blend_state_create_info.pAttachments = color_blend_attachments.data();
   /* color_blend_state_create_info.blendConstants[4]; */
 
   std::vector<VkDynamicState> dynamic_states;
@@ -114,6 +118,12 @@ bool createGraphicsPipeline(
   input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
   input_assembly.primitiveRestartEnable = VK_FALSE;
 
+  VkPushConstantRange push_constant_range = {};
+  push_constant_range.stageFlags =
+      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+  push_constant_range.offset = 0;
+  push_constant_range.size = push_constant_size;
+
   VkPipelineLayoutCreateInfo pipeline_layout_create_info = {};
   pipeline_layout_create_info.sType =
       VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
@@ -121,8 +131,9 @@ bool createGraphicsPipeline(
   pipeline_layout_create_info.flags = 0;
   pipeline_layout_create_info.setLayoutCount = descriptor_set_layouts.size();
   pipeline_layout_create_info.pSetLayouts = descriptor_set_layouts.data();
-  pipeline_layout_create_info.pushConstantRangeCount = 0;
-  pipeline_layout_create_info.pPushConstantRanges = 0;
+  pipeline_layout_create_info.pushConstantRangeCount =
+      push_constant_size > 0 ? 1 : 0;
+  pipeline_layout_create_info.pPushConstantRanges = &push_constant_range;
 
   VK_CHECK(vkCreatePipelineLayout(device->logical_device,
                                   &pipeline_layout_create_info, 0,
@@ -159,7 +170,13 @@ bool createGraphicsPipeline(
 bool createComputePipeline(
     VulkanDevice *device,
     std::vector<VkDescriptorSetLayout> descriptor_set_layouts,
-    VkPipelineShaderStageCreateInfo stage, VulkanPipeline *out_pipeline) {
+    VkPipelineShaderStageCreateInfo stage, uint32_t push_constant_size,
+    VulkanPipeline *out_pipeline) {
+  VkPushConstantRange push_constant_range = {};
+  push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  push_constant_range.offset = 0;
+  push_constant_range.size = push_constant_size;
+
   VkPipelineLayoutCreateInfo pipeline_layout_create_info = {};
   pipeline_layout_create_info.sType =
       VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
@@ -167,8 +184,9 @@ bool createComputePipeline(
   pipeline_layout_create_info.flags = 0;
   pipeline_layout_create_info.setLayoutCount = descriptor_set_layouts.size();
   pipeline_layout_create_info.pSetLayouts = descriptor_set_layouts.data();
-  pipeline_layout_create_info.pushConstantRangeCount = 0;
-  pipeline_layout_create_info.pPushConstantRanges = 0;
+  pipeline_layout_create_info.pushConstantRangeCount =
+      push_constant_size > 0 ? 1 : 0;
+  pipeline_layout_create_info.pPushConstantRanges = &push_constant_range;
 
   VK_CHECK(vkCreatePipelineLayout(device->logical_device,
                                   &pipeline_layout_create_info, 0,
@@ -9,13 +9,18 @@ struct VulkanPipeline {
   VkPipelineLayout layout;
 };
 
+/* vertices are fetched by the shaders, there is no vertex input. blending
+ * applies to every colour attachment and the push constants are visible to
+ * the vertex and fragment stages */
 bool createGraphicsPipeline(
     VulkanDevice *device, VkRenderPass render_pass,
     std::vector<VkDescriptorSetLayout> descriptor_set_layouts,
     std::vector<VkPipelineShaderStageCreateInfo> stages,
-    VulkanPipeline *out_pipeline);
+    uint32_t color_attachment_count, bool blend, bool depth_test,
+    uint32_t push_constant_size, VulkanPipeline *out_pipeline);
 bool createComputePipeline(
     VulkanDevice *device,
     std::vector<VkDescriptorSetLayout> descriptor_set_layouts,
-    VkPipelineShaderStageCreateInfo stage, VulkanPipeline *out_pipeline);
+    VkPipelineShaderStageCreateInfo stage, uint32_t push_constant_size,
+    VulkanPipeline *out_pipeline);
 void destroyPipeline(VulkanPipeline *pipeline, VulkanDevice *device);
\ No newline at end of file
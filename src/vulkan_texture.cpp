@@ -4,9 +4,32 @@
 #include "vulkan_common.h"
 #include "vulkan_resources.h"
 
+uint32_t getTextureMipLevels(uint32_t width, uint32_t height) {
+  uint32_t mip_levels = 1;
+  uint32_t size = width > height ? width : height;
+  while (size > 1) {
+    size /= 2;
+    ++mip_levels;
+  }
+  return mip_levels;
+}
+
+/* depth attachments are viewed through their depth aspect */
+static VkImageAspectFlags getTextureAspect(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_D16_UNORM:
+  case VK_FORMAT_X8_D24_UNORM_PACK32:
+  case VK_FORMAT_D32_SFLOAT:
+    return VK_IMAGE_ASPECT_DEPTH_BIT;
+  default:
+    return VK_IMAGE_ASPECT_COLOR_BIT;
+  }
+}
+
 bool createTexture(VulkanDevice *device, VmaAllocator vma_allocator,
                    VkFormat format, uint32_t width, uint32_t height,
-                   VkImageUsageFlags usage_flags, VulkanTexture *out_texture) {
+                   uint32_t mip_levels, VkImageUsageFlags usage_flags,
+                   VulkanTexture *out_texture) {
   if (usage_flags & VK_IMAGE_USAGE_STORAGE_BIT) {
     VkFormatProperties format_properties;
     vkGetPhysicalDeviceFormatProperties(device->physical_device, format,
@@ -22,6 +45,7 @@ bool createTexture(VulkanDevice *device, VmaAllocator vma_allocator,
   out_texture->format = format;
   out_texture->width = width;
   out_texture->height = height;
+  out_texture->mip_levels = mip_levels;
 
   VkImageCreateInfo image_create_info = {};
   image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -32,7 +56,7 @@ bool createTexture(VulkanDevice *device, VmaAllocator vma_allocator,
   image_create_info.extent.width = width;
   image_create_info.extent.height = height;
   image_create_info.extent.depth = 1;
-  image_create_info.mipLevels = 1;
+  image_create_info.mipLevels = mip_levels;
   image_create_info.arrayLayers = 1;
   image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
   image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
@@ -65,9 +89,9 @@ bool createTexture(VulkanDevice *device, VmaAllocator vma_allocator,
   view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
   view_create_info.format = format;
   /* view_create_info.components; */
-  view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  view_create_info.subresourceRange.aspectMask = getTextureAspect(format);
   view_create_info.subresourceRange.baseMipLevel = 0;
-  view_create_info.subresourceRange.levelCount = 1;
+  view_create_info.subresourceRange.levelCount = mip_levels;
   view_create_info.subresourceRange.baseArrayLayer = 0;
   view_create_info.subresourceRange.layerCount = 1;
 
@@ -90,7 +114,7 @@ bool createTexture(VulkanDevice *device, VmaAllocator vma_allocator,
   sampler_create_info.compareEnable = VK_FALSE;
   sampler_create_info.compareOp = VK_COMPARE_OP_NEVER;
   sampler_create_info.minLod = 0.0f;
-  sampler_create_info.maxLod = (float)1;
+  sampler_create_info.maxLod = (float)mip_levels;
   sampler_create_info.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
   sampler_create_info.unnormalizedCoordinates = VK_FALSE;
 
@@ -100,6 +124,74 @@ bool createTexture(VulkanDevice *device, VmaAllocator vma_allocator,
   return true;
 }
 
+/* every level starts out as a transfer destination with the first one
+ * written, each is blitted from the one above and left readable by the
+ * shaders */
+static void generateTextureMips(VulkanTexture *texture,
+                                VkCommandBuffer command_buffer,
+                                uint32_t queue_family_index) {
+  VkImageMemoryBarrier barrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+  barrier.srcQueueFamilyIndex = queue_family_index;
+  barrier.dstQueueFamilyIndex = queue_family_index;
+  barrier.image = texture->handle;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+
+  const VkPipelineStageFlags shader_stages =
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+  int32_t width = texture->width;
+  int32_t height = texture->height;
+  for (uint32_t i = 1; i < texture->mip_levels; ++i) {
+    barrier.subresourceRange.baseMipLevel = i - 1;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, 0, 0, 0, 1,
+                         &barrier);
+
+    int32_t next_width = width > 1 ? width / 2 : 1;
+    int32_t next_height = height > 1 ? height / 2 : 1;
+
+    VkImageBlit blit = {};
+    blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.srcSubresource.mipLevel = i - 1;
+    blit.srcSubresource.baseArrayLayer = 0;
+    blit.srcSubresource.layerCount = 1;
+    blit.srcOffsets[1] = {width, height, 1};
+    blit.dstSubresource = blit.srcSubresource;
+    blit.dstSubresource.mipLevel = i;
+    blit.dstOffsets[1] = {next_width, next_height, 1};
+    vkCmdBlitImage(command_buffer, texture->handle,
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, texture->handle,
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+                   VK_FILTER_LINEAR);
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         shader_stages, 0, 0, 0, 0, 0, 1, &barrier);
+
+    width = next_width;
+    height = next_height;
+  }
+
+  barrier.subresourceRange.baseMipLevel = texture->mip_levels - 1;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       shader_stages, 0, 0, 0, 0, 0, 1, &barrier);
+}
+
 void destroyTexture(VulkanTexture *texture, VulkanDevice *device,
                     VmaAllocator vma_allocator) {
   vkDestroySampler(device->logical_device, texture->sampler, 0);
@@ -114,6 +206,18 @@ bool writeTextureData(VulkanTexture *texture, VulkanDevice *device,
    */
   uint32_t size = texture->width * texture->height * 4;
 
+  /* the chain is blitted with linear filtering */
+  if (texture->mip_levels > 1) {
+    VkFormatProperties format_properties;
+    vkGetPhysicalDeviceFormatProperties(device->physical_device,
+                                        texture->format, &format_properties);
+    if (!(format_properties.optimalTilingFeatures &
+          VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+      ERROR("Device can't generate mips for the texture format!");
+      return false;
+    }
+  }
+
   VulkanBuffer staging_buffer;
   if (!createBuffer(vma_allocator, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
@@ -145,9 +249,12 @@ bool writeTextureData(VulkanTexture *texture, VulkanDevice *device,
     ERROR("Failed to copy buffer data to texture!");
     return false;
   }
-  if (!transitionTextureLayout(
-          texture, temp_command_buffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, queue_family_index)) {
+  if (texture->mip_levels > 1) {
+    generateTextureMips(texture, temp_command_buffer, queue_family_index);
+  } else if (!transitionTextureLayout(texture, temp_command_buffer,
+                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                      queue_family_index)) {
     ERROR("Failed to transition image layout!");
     return false;
   }
@@ -171,7 +278,7 @@ bool transitionTextureLayout(VulkanTexture *texture,
   barrier.image = texture->handle;
   barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
   barrier.subresourceRange.baseMipLevel = 0;
-  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.levelCount = texture->mip_levels;
   barrier.subresourceRange.baseArrayLayer = 0;
   barrier.subresourceRange.layerCount = 1;
 
@@ -14,14 +14,20 @@ struct VulkanTexture {
 
   VkFormat format;
   uint32_t width, height;
+  /* 1 without a mip chain */
+  uint32_t mip_levels;
 };
 
+/* down to 1x1 */
+uint32_t getTextureMipLevels(uint32_t width, uint32_t height);
 bool createTexture(VulkanDevice *device, VmaAllocator vma_allocator,
                    VkFormat format, uint32_t width, uint32_t height,
-                   VkImageUsageFlags usage_flags, VulkanTexture *out_texture);
+                   uint32_t mip_levels, VkImageUsageFlags usage_flags,
+                   VulkanTexture *out_texture);
 void destroyTexture(VulkanTexture *texture, VulkanDevice *device,
                     VmaAllocator vma_allocator);
 
+/* writes the first mip level and blits the rest of the chain down from it */
 bool writeTextureData(VulkanTexture *texture, VulkanDevice *device,
                       void *pixels, VmaAllocator vma_allocator, VkQueue queue,
                       VkCommandPool command_pool, uint32_t queue_family_index);
@@ -0,0 +1,510 @@
+#include "wavefront.h"
+
+#include "logger.h"
+#include "vulkan_resources.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/* matches WAVEFRONT_TILE_SIZE in wavefront_common.glsl, the indirect
+ * dispatches are sized on the GPU */
+static const uint32_t tile_size = 16;
+/* matches WAVEFRONT_GROUP_SIZE, for the dispatches sized on the CPU */
+static const uint32_t group_size = 64;
+/* sizes of PathState, PathHit, ShadowRay and PixelFeatures in
+ * wavefront_common.glsl */
+static const uint32_t path_size = 96;
+static const uint32_t path_hit_size = 48;
+static const uint32_t shadow_ray_size = 64;
+static const uint32_t pixel_features_size = 32;
+/* matches SORT_BIN_COUNT in wavefront_common.glsl */
+static const uint32_t sort_bin_count = 512;
+/* size of RadianceCacheEntry in radiance_cache.glsl */
+static const uint32_t cache_entry_size = 48;
+/* size of Reservoir in light_resampling.glsl */
+static const uint32_t reservoir_size = 48;
+/* indirect arguments of the bounce passes and of generate */
+static const VkDeviceSize bounce_dispatch_offset =
+    offsetof(WavefrontQueueState, dispatch);
+static const VkDeviceSize generate_dispatch_offset =
+    offsetof(WavefrontQueueState, generate_dispatch);
+
+static const char *wavefront_pass_shader_paths[WAVEFRONT_PASS_COUNT] = {
+    "assets/shaders/wavefront_generate.comp.spv",
+    "assets/shaders/wavefront_dispatch.comp.spv",
+    "assets/shaders/wavefront_extend.comp.spv",
+    "assets/shaders/wavefront_shade.comp.spv",
+    "assets/shaders/wavefront_connect.comp.spv",
+    "assets/shaders/wavefront_resolve.comp.spv",
+    "assets/shaders/wavefront_sort_count.comp.spv",
+    "assets/shaders/wavefront_sort_scan.comp.spv",
+    "assets/shaders/wavefront_sort_scatter.comp.spv",
+    "assets/shaders/wavefront_compact.comp.spv",
+    "assets/shaders/wavefront_compact_dispatch.comp.spv",
+    "assets/shaders/wavefront_denoise.comp.spv",
+    "assets/shaders/wavefront_cache_update.comp.spv",
+    "assets/shaders/wavefront_cache_debug.comp.spv",
+    "assets/shaders/wavefront_guide_record.comp.spv",
+    "assets/shaders/wavefront_resample_temporal.comp.spv",
+    "assets/shaders/wavefront_resample_spatial.comp.spv",
+    "assets/shaders/wavefront_gbuffer_hits.comp.spv"};
+
+const char *wavefront_sort_mode_names[WAVEFRONT_SORT_COUNT] = {
+    "None", "Direction", "Material"};
+
+const char *wavefront_light_selection_names[WAVEFRONT_LIGHT_SELECTION_COUNT] =
+    {"Uniform", "Light BVH"};
+
+const char *wavefront_sequence_names[WAVEFRONT_SEQUENCE_COUNT] = {
+    "PCG", "Owen-scrambled Sobol"};
+
+const char *wavefront_reservoir_bias_names[WAVEFRONT_RESERVOIR_BIAS_COUNT] = {
+    "Biased", "Unbiased"};
+
+const char *getWavefrontPassShaderPath(WavefrontPass pass) {
+  return wavefront_pass_shader_paths[pass];
+}
+
+static bool createWavefrontBuffer(VmaAllocator vma_allocator, uint64_t size,
+                                  VkBufferUsageFlags usage,
+                                  VulkanBuffer *out_buffer) {
+  return createBuffer(vma_allocator, size,
+                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                          VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
+                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                      VMA_MEMORY_USAGE_GPU_ONLY, out_buffer);
+}
+
+/* for the guide trees the host writes and the training it reads back */
+static bool createWavefrontHostBuffer(VmaAllocator vma_allocator,
+                                      uint64_t size, VmaMemoryUsage vma_usage,
+                                      VulkanBuffer *out_buffer) {
+  return createBuffer(vma_allocator, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                      vma_usage, out_buffer);
+}
+
+bool createWavefrontBuffers(VmaAllocator vma_allocator, uint32_t width,
+                            uint32_t height, WavefrontRenderer *out_renderer) {
+  const uint64_t path_capacity = width * height;
+
+  out_renderer->width = width;
+  out_renderer->height = height;
+  out_renderer->sort_mode = WAVEFRONT_SORT_NONE;
+  out_renderer->coherence_stats = false;
+  out_renderer->next_event_estimation = true;
+  out_renderer->light_selection = WAVEFRONT_LIGHT_SELECTION_BVH;
+  out_renderer->light_stats = false;
+  out_renderer->sequence = WAVEFRONT_SEQUENCE_SOBOL;
+  out_renderer->error_stats = false;
+  out_renderer->has_reference = false;
+  out_renderer->russian_roulette = true;
+  out_renderer->roulette_depth = 3;
+  out_renderer->denoise = false;
+  out_renderer->denoise_iteration_count = 4;
+  out_renderer->reproject_history = false;
+  out_renderer->radiance_cache = false;
+  out_renderer->cache_debug = false;
+  out_renderer->clear_cache = true;
+  out_renderer->path_guiding = false;
+  resetPathGuide(glm::vec3(0.0f), glm::vec3(1.0f), &out_renderer->guide);
+  out_renderer->guide_dirty = true;
+  out_renderer->guide_trained = false;
+  out_renderer->reservoir_resampling = false;
+  out_renderer->reservoir_bias = WAVEFRONT_RESERVOIR_BIASED;
+
+  if (!createWavefrontBuffer(vma_allocator, path_capacity * 2 * path_size, 0,
+                             &out_renderer->paths) ||
+      !createWavefrontBuffer(vma_allocator, path_capacity * path_hit_size, 0,
+                             &out_renderer->hits) ||
+      !createWavefrontBuffer(vma_allocator, sizeof(WavefrontQueueState),
+                             VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                             &out_renderer->queue_state) ||
+      !createWavefrontBuffer(vma_allocator, path_capacity * 4 * sizeof(float),
+                             0, &out_renderer->radiance) ||
+      !createWavefrontBuffer(vma_allocator, sort_bin_count * sizeof(uint32_t),
+                             0, &out_renderer->sort_bins) ||
+      !createWavefrontBuffer(vma_allocator, path_capacity * sizeof(uint32_t),
+                             0, &out_renderer->sort_keys) ||
+      !createWavefrontBuffer(vma_allocator, path_capacity * sizeof(uint32_t),
+                             0, &out_renderer->path_order) ||
+      !createWavefrontBuffer(vma_allocator, path_capacity * shadow_ray_size, 0,
+                             &out_renderer->shadow_rays) ||
+      !createWavefrontBuffer(vma_allocator, path_capacity * 4 * sizeof(float),
+                             0, &out_renderer->pixel_stats) ||
+      !createWavefrontBuffer(vma_allocator, path_capacity * sizeof(uint32_t),
+                             0, &out_renderer->active_pixels) ||
+      !createWavefrontBuffer(vma_allocator, path_capacity * 4 * sizeof(float),
+                             VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                             &out_renderer->accumulation) ||
+      !createWavefrontBuffer(vma_allocator, path_capacity * 4 * sizeof(float),
+                             0, &out_renderer->reference) ||
+      !createWavefrontBuffer(vma_allocator,
+                             path_capacity * pixel_features_size,
+                             VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                             &out_renderer->features) ||
+      !createWavefrontBuffer(vma_allocator,
+                             path_capacity * 2 * 4 * sizeof(float), 0,
+                             &out_renderer->denoised) ||
+      !createWavefrontBuffer(vma_allocator, path_capacity * 4 * sizeof(float),
+                             0, &out_renderer->history_accumulation) ||
+      !createWavefrontBuffer(vma_allocator,
+                             path_capacity * pixel_features_size, 0,
+                             &out_renderer->history_features) ||
+      !createWavefrontBuffer(vma_allocator,
+                             (uint64_t)wavefront_cache_entry_count *
+                                 cache_entry_size, 0,
+                             &out_renderer->radiance_cache) ||
+      !createWavefrontHostBuffer(
+          vma_allocator,
+          sizeof(GuideSpatialHeader) +
+              guide_max_spatial_nodes * sizeof(GuideSpatialNode),
+          VMA_MEMORY_USAGE_CPU_TO_GPU, &out_renderer->guide_spatial) ||
+      !createWavefrontHostBuffer(
+          vma_allocator,
+          guide_max_direction_nodes * sizeof(GuideDirectionNode),
+          VMA_MEMORY_USAGE_CPU_TO_GPU, &out_renderer->guide_directions) ||
+      !createWavefrontHostBuffer(vma_allocator, sizeof(GuideTraining),
+                                 VMA_MEMORY_USAGE_GPU_TO_CPU,
+                                 &out_renderer->guide_training) ||
+      !createWavefrontBuffer(vma_allocator,
+                             path_capacity * guide_vertex_count *
+                                 guide_vertex_size,
+                             0, &out_renderer->guide_vertices) ||
+      !createWavefrontBuffer(vma_allocator,
+                             path_capacity * 2 * reservoir_size, 0,
+                             &out_renderer->reservoirs)) {
+    ERROR("Failed to create wavefront buffers!");
+    return false;
+  }
+
+  return true;
+}
+
+void destroyWavefrontRenderer(WavefrontRenderer *renderer,
+                              VulkanDevice *device,
+                              VmaAllocator vma_allocator) {
+  for (uint32_t i = 0; i < WAVEFRONT_PASS_COUNT; ++i) {
+    destroyPipeline(&renderer->pipelines[i], device);
+  }
+
+  destroyBuffer(&renderer->paths, vma_allocator);
+  destroyBuffer(&renderer->hits, vma_allocator);
+  destroyBuffer(&renderer->queue_state, vma_allocator);
+  destroyBuffer(&renderer->radiance, vma_allocator);
+  destroyBuffer(&renderer->sort_bins, vma_allocator);
+  destroyBuffer(&renderer->sort_keys, vma_allocator);
+  destroyBuffer(&renderer->path_order, vma_allocator);
+  destroyBuffer(&renderer->shadow_rays, vma_allocator);
+  destroyBuffer(&renderer->pixel_stats, vma_allocator);
+  destroyBuffer(&renderer->active_pixels, vma_allocator);
+  destroyBuffer(&renderer->accumulation, vma_allocator);
+  destroyBuffer(&renderer->reference, vma_allocator);
+  destroyBuffer(&renderer->features, vma_allocator);
+  destroyBuffer(&renderer->denoised, vma_allocator);
+  destroyBuffer(&renderer->history_accumulation, vma_allocator);
+  destroyBuffer(&renderer->history_features, vma_allocator);
+  destroyBuffer(&renderer->radiance_cache, vma_allocator);
+  destroyBuffer(&renderer->guide_spatial, vma_allocator);
+  destroyBuffer(&renderer->guide_directions, vma_allocator);
+  destroyBuffer(&renderer->guide_training, vma_allocator);
+  destroyBuffer(&renderer->guide_vertices, vma_allocator);
+  destroyBuffer(&renderer->reservoirs, vma_allocator);
+}
+
+/* later passes read what earlier ones wrote, the dispatch pass feeds the
+ * indirect arguments and the queue counters get cleared by transfers */
+static void wavefrontBarrier(VkCommandBuffer command_buffer,
+                             VkPipelineStageFlags src_stage,
+                             VkAccessFlags src_access) {
+  VkMemoryBarrier memory_barrier = {};
+  memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memory_barrier.pNext = 0;
+  memory_barrier.srcAccessMask = src_access;
+  memory_barrier.dstAccessMask =
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT |
+      VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+  vkCmdPipelineBarrier(command_buffer, src_stage,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                           VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                           VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       0, 1, &memory_barrier, 0, 0, 0, 0);
+}
+
+static void bindPass(WavefrontRenderer *renderer,
+                     VkCommandBuffer command_buffer, WavefrontPass pass,
+                     WavefrontPushConstants push_constants) {
+  VulkanPipeline *pipeline = &renderer->pipelines[pass];
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    pipeline->handle);
+  vkCmdPushConstants(command_buffer, pipeline->layout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                     sizeof(WavefrontPushConstants), &push_constants);
+}
+
+static void dispatchPass(WavefrontRenderer *renderer,
+                         VkCommandBuffer command_buffer, WavefrontPass pass,
+                         WavefrontPushConstants push_constants,
+                         uint32_t group_count_x, uint32_t group_count_y) {
+  bindPass(renderer, command_buffer, pass, push_constants);
+  vkCmdDispatch(command_buffer, group_count_x, group_count_y, 1);
+
+  wavefrontBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                   VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+static void dispatchPassIndirect(WavefrontRenderer *renderer,
+                                 VkCommandBuffer command_buffer,
+                                 WavefrontPass pass,
+                                 WavefrontPushConstants push_constants,
+                                 VkDeviceSize args_offset) {
+  bindPass(renderer, command_buffer, pass, push_constants);
+  vkCmdDispatchIndirect(command_buffer, renderer->queue_state.handle,
+                        args_offset);
+
+  wavefrontBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                   VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+/* copies a whole buffer once the passes before it are done, the passes after
+ * it wait for the copy */
+static void copyWavefrontBuffer(VkCommandBuffer command_buffer,
+                                VulkanBuffer *src_buffer,
+                                VulkanBuffer *dst_buffer) {
+  VkMemoryBarrier memory_barrier = {};
+  memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memory_barrier.pNext = 0;
+  memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memory_barrier,
+                       0, 0, 0, 0);
+
+  VkBufferCopy copy_region = {};
+  copy_region.srcOffset = 0;
+  copy_region.dstOffset = 0;
+  copy_region.size = src_buffer->size;
+  vkCmdCopyBuffer(command_buffer, src_buffer->handle, dst_buffer->handle, 1,
+                  &copy_region);
+
+  wavefrontBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                   VK_ACCESS_TRANSFER_WRITE_BIT);
+}
+
+/* counting sort of the read queue indices into path_order, the dispatch pass
+ * has already emptied the bins */
+static void recordSort(WavefrontRenderer *renderer,
+                       VkCommandBuffer command_buffer,
+                       WavefrontPushConstants push_constants) {
+  dispatchPassIndirect(renderer, command_buffer, WAVEFRONT_PASS_SORT_COUNT,
+                       push_constants, bounce_dispatch_offset);
+  dispatchPass(renderer, command_buffer, WAVEFRONT_PASS_SORT_SCAN,
+               push_constants, 1, 1);
+  dispatchPassIndirect(renderer, command_buffer, WAVEFRONT_PASS_SORT_SCATTER,
+                       push_constants, bounce_dispatch_offset);
+}
+
+void recordWavefrontFrame(WavefrontRenderer *renderer,
+                          VkCommandBuffer command_buffer,
+                          VkDescriptorSet image_descriptor_set,
+                          VkDescriptorSet ubo_descriptor_set,
+                          VkDescriptorSet scene_descriptor_set,
+                          VkDescriptorSet texture_descriptor_set,
+                          uint32_t sample_count, uint32_t bounce_count) {
+  const uint32_t tile_count_x = (renderer->width + tile_size - 1) / tile_size;
+  const uint32_t tile_count_y = (renderer->height + tile_size - 1) / tile_size;
+
+  vkCmdFillBuffer(command_buffer, renderer->radiance.handle, 0, VK_WHOLE_SIZE,
+                  0);
+  if (renderer->clear_cache) {
+    vkCmdFillBuffer(command_buffer, renderer->radiance_cache.handle, 0,
+                    VK_WHOLE_SIZE, 0);
+    renderer->clear_cache = false;
+  }
+
+  /* shade overwrites the features and resolve the accumulation, so the last
+   * frame's copies go aside first */
+  if (renderer->reproject_history) {
+    copyWavefrontBuffer(command_buffer, &renderer->accumulation,
+                        &renderer->history_accumulation);
+    copyWavefrontBuffer(command_buffer, &renderer->features,
+                        &renderer->history_features);
+  }
+
+  /* every pass shares the pipeline layout, so the sets stay bound across
+   * pipelines */
+  VkDescriptorSet descriptor_sets[] = {
+      image_descriptor_set, ubo_descriptor_set, scene_descriptor_set,
+      renderer->descriptor_set, texture_descriptor_set};
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          renderer->pipelines[WAVEFRONT_PASS_GENERATE].layout,
+                          0, 5, descriptor_sets, 0, 0);
+
+  WavefrontPushConstants push_constants = {};
+  push_constants.path_capacity = renderer->width * renderer->height;
+  push_constants.sort_mode = renderer->sort_mode;
+  push_constants.coherence_stats = renderer->coherence_stats;
+  push_constants.next_event_estimation = renderer->next_event_estimation;
+  push_constants.light_selection = renderer->light_selection;
+  push_constants.light_stats = renderer->light_stats;
+  push_constants.sequence = renderer->sequence;
+  push_constants.error_stats =
+      renderer->error_stats && renderer->has_reference;
+  push_constants.roulette_depth =
+      renderer->russian_roulette ? renderer->roulette_depth : UINT32_MAX;
+  push_constants.radiance_cache = renderer->radiance_cache;
+  push_constants.cache_debug = renderer->cache_debug;
+  renderer->guide_trained =
+      renderer->path_guiding && isPathGuideTraining(&renderer->guide);
+  if (renderer->path_guiding && isPathGuideTrained(&renderer->guide)) {
+    push_constants.guiding |= WAVEFRONT_GUIDING_SAMPLE;
+  }
+  if (renderer->guide_trained) {
+    push_constants.guiding |= WAVEFRONT_GUIDING_TRAIN;
+  }
+  const bool resamples_lights =
+      renderer->reservoir_resampling && renderer->next_event_estimation;
+  push_constants.reservoir_resampling = resamples_lights;
+  push_constants.reservoir_bias = renderer->reservoir_bias;
+
+  /* the work list holds over every sample of the frame */
+  vkCmdFillBuffer(command_buffer, renderer->queue_state.handle,
+                  offsetof(WavefrontQueueState, active_pixel_count),
+                  sizeof(uint32_t), 0);
+  wavefrontBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                   VK_ACCESS_TRANSFER_WRITE_BIT);
+  dispatchPass(renderer, command_buffer, WAVEFRONT_PASS_COMPACT,
+               push_constants, tile_count_x, tile_count_y);
+  dispatchPass(renderer, command_buffer, WAVEFRONT_PASS_COMPACT_DISPATCH,
+               push_constants, 1, 1);
+
+  for (uint32_t sample = 0; sample < sample_count; ++sample) {
+    vkCmdFillBuffer(command_buffer, renderer->queue_state.handle, 0,
+                    sizeof(WavefrontQueueState::counts), 0);
+    wavefrontBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                     VK_ACCESS_TRANSFER_WRITE_BIT);
+
+    push_constants.sample_index = sample;
+    push_constants.bounce = 0;
+    push_constants.read_queue = 0;
+    dispatchPassIndirect(renderer, command_buffer, WAVEFRONT_PASS_GENERATE,
+                         push_constants, generate_dispatch_offset);
+
+    for (uint32_t bounce = 0; bounce < bounce_count; ++bounce) {
+      push_constants.bounce = bounce;
+      push_constants.read_queue = bounce % 2;
+      dispatchPass(renderer, command_buffer, WAVEFRONT_PASS_DISPATCH,
+                   push_constants, 1, 1);
+      if (renderer->sort_mode == WAVEFRONT_SORT_DIRECTION) {
+        recordSort(renderer, command_buffer, push_constants);
+      }
+      /* every sample of the frame shares the rasterized first hits */
+      WavefrontPass extend_pass = renderer->raster_primary && bounce == 0
+                                      ? WAVEFRONT_PASS_GBUFFER_HITS
+                                      : WAVEFRONT_PASS_EXTEND;
+      dispatchPassIndirect(renderer, command_buffer, extend_pass,
+                           push_constants, bounce_dispatch_offset);
+      if (renderer->sort_mode == WAVEFRONT_SORT_MATERIAL) {
+        recordSort(renderer, command_buffer, push_constants);
+      }
+      if (resamples_lights && bounce == 0) {
+        dispatchPassIndirect(renderer, command_buffer,
+                             WAVEFRONT_PASS_RESAMPLE_TEMPORAL, push_constants,
+                             bounce_dispatch_offset);
+        dispatchPassIndirect(renderer, command_buffer,
+                             WAVEFRONT_PASS_RESAMPLE_SPATIAL, push_constants,
+                             bounce_dispatch_offset);
+      }
+      dispatchPassIndirect(renderer, command_buffer, WAVEFRONT_PASS_SHADE,
+                           push_constants, bounce_dispatch_offset);
+      /* shade queues at most one shadow ray per path, so the dispatch sized
+       * to the read queue covers them */
+      if (renderer->next_event_estimation) {
+        dispatchPassIndirect(renderer, command_buffer, WAVEFRONT_PASS_CONNECT,
+                             push_constants, bounce_dispatch_offset);
+      }
+    }
+
+    if (renderer->guide_trained) {
+      dispatchPassIndirect(renderer, command_buffer,
+                           WAVEFRONT_PASS_GUIDE_RECORD, push_constants,
+                           generate_dispatch_offset);
+    }
+  }
+
+  if (renderer->radiance_cache) {
+    dispatchPass(renderer, command_buffer, WAVEFRONT_PASS_CACHE_UPDATE,
+                 push_constants, wavefront_cache_entry_count / group_size, 1);
+  }
+
+  dispatchPass(renderer, command_buffer, WAVEFRONT_PASS_RESOLVE,
+               push_constants, tile_count_x, tile_count_y);
+
+  if (renderer->denoise && renderer->denoise_iteration_count > 0) {
+    push_constants.denoise_iteration_count =
+        renderer->denoise_iteration_count;
+    for (uint32_t iteration = 0; iteration < renderer->denoise_iteration_count;
+         ++iteration) {
+      push_constants.denoise_iteration = iteration;
+      dispatchPass(renderer, command_buffer, WAVEFRONT_PASS_DENOISE,
+                   push_constants, tile_count_x, tile_count_y);
+    }
+  }
+
+  if (renderer->radiance_cache && renderer->cache_debug) {
+    dispatchPass(renderer, command_buffer, WAVEFRONT_PASS_CACHE_DEBUG,
+                 push_constants, tile_count_x, tile_count_y);
+  }
+}
+
+void resetWavefrontGuide(WavefrontRenderer *renderer, glm::vec3 bounds_min,
+                         glm::vec3 bounds_max) {
+  resetPathGuide(bounds_min, bounds_max, &renderer->guide);
+  renderer->guide_dirty = true;
+  renderer->guide_trained = false;
+}
+
+void updateWavefrontGuide(WavefrontRenderer *renderer,
+                          VmaAllocator vma_allocator) {
+  PathGuide *guide = &renderer->guide;
+  bool ended_iteration = renderer->guide_trained && !renderer->guide_dirty &&
+                         endPathGuideFrame(guide);
+  renderer->guide_trained = false;
+  if (!ended_iteration && !renderer->guide_dirty) {
+    return;
+  }
+
+  /* the training of an iteration a reset cut short is dropped */
+  GuideTraining *training =
+      (GuideTraining *)lockBuffer(&renderer->guide_training, vma_allocator);
+  if (ended_iteration) {
+    refinePathGuide(training, guide);
+  }
+  memset(training, 0, sizeof(GuideTraining));
+  unlockBuffer(&renderer->guide_training, vma_allocator);
+  renderer->guide_dirty = false;
+
+  uint8_t *spatial_data =
+      (uint8_t *)lockBuffer(&renderer->guide_spatial, vma_allocator);
+  GuideSpatialHeader header = {};
+  header.bounds_min = glm::vec4(guide->bounds_min, 0.0f);
+  header.bounds_max = glm::vec4(guide->bounds_max, 0.0f);
+  memcpy(spatial_data, &header, sizeof(GuideSpatialHeader));
+  memcpy(spatial_data + sizeof(GuideSpatialHeader),
+         guide->spatial_nodes.data(),
+         guide->spatial_nodes.size() * sizeof(GuideSpatialNode));
+  unlockBuffer(&renderer->guide_spatial, vma_allocator);
+
+  memcpy(lockBuffer(&renderer->guide_directions, vma_allocator),
+         guide->direction_nodes.data(),
+         guide->direction_nodes.size() * sizeof(GuideDirectionNode));
+  unlockBuffer(&renderer->guide_directions, vma_allocator);
+}
+
+void recordWavefrontReferenceCapture(WavefrontRenderer *renderer,
+                                     VkCommandBuffer command_buffer) {
+  copyWavefrontBuffer(command_buffer, &renderer->accumulation,
+                      &renderer->reference);
+  renderer->has_reference = true;
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include "path_guiding.h"
+#include "vulkan_buffer.h"
+#include "vulkan_device.h"
+#include "vulkan_pipeline.h"
+
+#include "vk_mem_alloc.h"
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+/* the wavefront_*.comp kernels. compact puts the pixels adaptive sampling
+ * hasn't marked converged on a work list and every sample generates one path
+ * per pixel on it. each bounce then sizes the indirect dispatches to the rays
+ * still alive, extends them to their closest hit, shades them and connects
+ * the shadow rays shade queued to the lights. resolve adds the samples to a
+ * float accumulation and writes its average to the result image, which the
+ * denoise iterations may filter afterwards. with the radiance cache on,
+ * cache update folds the estimates of the frame into its cells before
+ * resolve and cache debug may show them in place of the image at the end.
+ * while the path guide trains, guide record splats every finished sample
+ * into its training trees. with reservoir resampling on, resample temporal
+ * and resample spatial pick the light of the first hits between extend and
+ * shade of the first bounce. with the first hits rasterized, gbuffer hits
+ * reads them from the G-buffer in place of the first extend */
+enum WavefrontPass {
+  WAVEFRONT_PASS_GENERATE,
+  WAVEFRONT_PASS_DISPATCH,
+  WAVEFRONT_PASS_EXTEND,
+  WAVEFRONT_PASS_SHADE,
+  WAVEFRONT_PASS_CONNECT,
+  WAVEFRONT_PASS_RESOLVE,
+  WAVEFRONT_PASS_SORT_COUNT,
+  WAVEFRONT_PASS_SORT_SCAN,
+  WAVEFRONT_PASS_SORT_SCATTER,
+  WAVEFRONT_PASS_COMPACT,
+  WAVEFRONT_PASS_COMPACT_DISPATCH,
+  WAVEFRONT_PASS_DENOISE,
+  WAVEFRONT_PASS_CACHE_UPDATE,
+  WAVEFRONT_PASS_CACHE_DEBUG,
+  WAVEFRONT_PASS_GUIDE_RECORD,
+  WAVEFRONT_PASS_RESAMPLE_TEMPORAL,
+  WAVEFRONT_PASS_RESAMPLE_SPATIAL,
+  WAVEFRONT_PASS_GBUFFER_HITS,
+  WAVEFRONT_PASS_COUNT
+};
+
+/* how the read queue gets reordered before tracing or shading it. direction
+ * bins rays by octant and origin cell before extend, material bins them by
+ * what they hit before shade */
+enum WavefrontSortMode {
+  WAVEFRONT_SORT_NONE,
+  WAVEFRONT_SORT_DIRECTION,
+  WAVEFRONT_SORT_MATERIAL,
+  WAVEFRONT_SORT_COUNT
+};
+
+extern const char *wavefront_sort_mode_names[WAVEFRONT_SORT_COUNT];
+
+/* how next event estimation picks among the emissive spheres. the light BVH
+ * weighs them by flux, distance and orientation at the shading point */
+enum WavefrontLightSelection {
+  WAVEFRONT_LIGHT_SELECTION_UNIFORM,
+  WAVEFRONT_LIGHT_SELECTION_BVH,
+  WAVEFRONT_LIGHT_SELECTION_COUNT
+};
+
+extern const char
+    *wavefront_light_selection_names[WAVEFRONT_LIGHT_SELECTION_COUNT];
+
+/* where the random numbers of a path come from. Sobol gives every pixel its
+ * own shuffled and scrambled copy of a low discrepancy sequence per pair of
+ * dimensions, PCG draws independent numbers */
+enum WavefrontSequence {
+  WAVEFRONT_SEQUENCE_PCG,
+  WAVEFRONT_SEQUENCE_SOBOL,
+  WAVEFRONT_SEQUENCE_COUNT
+};
+
+extern const char *wavefront_sequence_names[WAVEFRONT_SEQUENCE_COUNT];
+
+/* how merged reservoirs normalize their weights. biased divides by every
+ * candidate seen, unbiased traces a ray from every merged reservoir to
+ * leave out the candidates of those that couldn't have drawn the winner */
+enum WavefrontReservoirBias {
+  WAVEFRONT_RESERVOIR_BIASED,
+  WAVEFRONT_RESERVOIR_UNBIASED,
+  WAVEFRONT_RESERVOIR_BIAS_COUNT
+};
+
+extern const char
+    *wavefront_reservoir_bias_names[WAVEFRONT_RESERVOIR_BIAS_COUNT];
+
+/* bits of WavefrontPushConstants::guiding, match GUIDING_* in
+ * path_guiding.glsl */
+enum WavefrontGuiding {
+  WAVEFRONT_GUIDING_SAMPLE = 1,
+  WAVEFRONT_GUIDING_TRAIN = 2
+};
+
+/* matches WavefrontPushConstants in wavefront_common.glsl */
+struct WavefrontPushConstants {
+  uint32_t sample_index;
+  uint32_t bounce;
+  uint32_t read_queue;
+  uint32_t path_capacity;
+  uint32_t sort_mode;
+  uint32_t coherence_stats;
+  uint32_t next_event_estimation;
+  uint32_t light_selection;
+  uint32_t light_stats;
+  uint32_t sequence;
+  uint32_t error_stats;
+  uint32_t roulette_depth;
+  uint32_t denoise_iteration;
+  uint32_t denoise_iteration_count;
+  uint32_t radiance_cache;
+  uint32_t cache_debug;
+  uint32_t guiding;
+  uint32_t reservoir_resampling;
+  uint32_t reservoir_bias;
+};
+
+/* matches QueueState in wavefront_common.glsl */
+struct WavefrontQueueState {
+  uint32_t counts[2];
+  uint32_t shadow_count;
+  uint32_t active_pixel_count;
+  VkDispatchIndirectCommand dispatch;
+  uint32_t dispatch_padding;
+  VkDispatchIndirectCommand generate_dispatch;
+  uint32_t generate_dispatch_padding;
+};
+
+/* paths, path hits, queue state, radiance, sort bins, sort keys, path
+ * order, shadow rays, pixel stats, active pixels, accumulation, reference,
+ * features, denoised, history accumulation, history features, radiance
+ * cache, guide spatial tree, guide direction trees, guide training, guide
+ * vertices, reservoirs */
+const uint32_t wavefront_binding_count = 22;
+
+/* matches CACHE_ENTRY_COUNT in radiance_cache.glsl */
+const uint32_t wavefront_cache_entry_count = 1 << 20;
+
+/* the kernels use the result image and G-buffer, UBO and scene sets of the
+ * renderer at 0 to 2 and their own set at 3 */
+struct WavefrontRenderer {
+  VulkanPipeline pipelines[WAVEFRONT_PASS_COUNT];
+  VkDescriptorSet descriptor_set;
+
+  VulkanBuffer paths;
+  VulkanBuffer hits;
+  VulkanBuffer queue_state;
+  VulkanBuffer radiance;
+  VulkanBuffer sort_bins;
+  VulkanBuffer sort_keys;
+  VulkanBuffer path_order;
+  VulkanBuffer shadow_rays;
+  VulkanBuffer pixel_stats;
+  VulkanBuffer active_pixels;
+  VulkanBuffer accumulation;
+  VulkanBuffer reference;
+  VulkanBuffer features;
+  VulkanBuffer denoised;
+  VulkanBuffer history_accumulation;
+  VulkanBuffer history_features;
+  VulkanBuffer radiance_cache;
+  /* the sampled trees are written and the training read back by the host */
+  VulkanBuffer guide_spatial;
+  VulkanBuffer guide_directions;
+  VulkanBuffer guide_training;
+  VulkanBuffer guide_vertices;
+  VulkanBuffer reservoirs;
+
+  uint32_t width;
+  uint32_t height;
+
+  WavefrontSortMode sort_mode;
+  bool coherence_stats;
+  bool next_event_estimation;
+  WavefrontLightSelection light_selection;
+  bool light_stats;
+  WavefrontSequence sequence;
+  /* the error stat is only counted once a reference has been captured */
+  bool error_stats;
+  bool has_reference;
+  /* Russian roulette on paths past roulette_depth bounces */
+  bool russian_roulette;
+  uint32_t roulette_depth;
+  /* a-trous iterations over the image guided by the first hit features,
+   * each one doubles the filter radius */
+  bool denoise;
+  uint32_t denoise_iteration_count;
+  /* set for a frame whose camera moved since the last one, which keeps the
+   * accumulation and features of the last frame aside for resolve to
+   * reproject */
+  bool reproject_history;
+  /* a world-space hash grid of diffuse radiance that paths past their first
+   * diffuse vertex end at once its cells have enough samples. clear_cache
+   * empties it before the frame, cache_debug shows it instead of the image */
+  bool radiance_cache;
+  bool cache_debug;
+  bool clear_cache;
+  /* draws diffuse bounces from a mix of the cosine lobe and the quadtrees
+   * of the guide, which learns over the first frames after a reset */
+  bool path_guiding;
+  PathGuide guide;
+  /* the trees need uploading, and whether the last frame trained them */
+  bool guide_dirty;
+  bool guide_trained;
+  /* ReSTIR for the light of the first hits, only while next event
+   * estimation is on */
+  bool reservoir_resampling;
+  WavefrontReservoirBias reservoir_bias;
+  /* the first bounce takes its hits from the G-buffer rasterized for the
+   * frame instead of tracing the camera rays, see gbuffer.h */
+  bool raster_primary;
+};
+
+const char *getWavefrontPassShaderPath(WavefrontPass pass);
+
+/* the buffers in the order of the descriptor set bindings */
+bool createWavefrontBuffers(VmaAllocator vma_allocator, uint32_t width,
+                            uint32_t height, WavefrontRenderer *out_renderer);
+void destroyWavefrontRenderer(WavefrontRenderer *renderer,
+                              VulkanDevice *device,
+                              VmaAllocator vma_allocator);
+
+/* records a frame of sample_count samples with up to bounce_count bounces
+ * each. the passes of a bounce only run over the paths still alive, so a
+ * frame costs what its longest path does rather than every pixel paying for
+ * it. the settings of the renderer are read at record time */
+void recordWavefrontFrame(WavefrontRenderer *renderer,
+                          VkCommandBuffer command_buffer,
+                          VkDescriptorSet image_descriptor_set,
+                          VkDescriptorSet ubo_descriptor_set,
+                          VkDescriptorSet scene_descriptor_set,
+                          VkDescriptorSet texture_descriptor_set,
+                          uint32_t sample_count, uint32_t bounce_count);
+/* starts the guide over in the given scene bounds */
+void resetWavefrontGuide(WavefrontRenderer *renderer, glm::vec3 bounds_min,
+                         glm::vec3 bounds_max);
+/* once the frame recorded last is done, folds what it trained into the guide
+ * when it ended an iteration and uploads the trees that changed */
+void updateWavefrontGuide(WavefrontRenderer *renderer,
+                          VmaAllocator vma_allocator);
+/* copies the accumulation after the frame recorded before it aside, later
+ * frames measure their error against it */
+void recordWavefrontReferenceCapture(WavefrontRenderer *renderer,
+                                     VkCommandBuffer command_buffer);